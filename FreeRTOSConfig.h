@@ -28,13 +28,23 @@
 #define configMINIMAL_STACK_SIZE								( (unsigned short)256 ) 
 #define configTOTAL_HEAP_SIZE										( (size_t)( 32 * 1024 ) ) 	// Seems not to change anything
 #define configMAX_TASK_NAME_LEN									16
-#define configUSE_TRACE_FACILITY								0		// Only enable for debug purpose, not intended for normal use
+#ifdef INCLUDE_DIAG
+	// Needed by diag.c for per task stack and runtime statistics
+	#define configUSE_TRACE_FACILITY							1
+	#define configGENERATE_RUN_TIME_STATS					1
+	// Runtime counter is the CPU cycle counter CCOUNT (80MHz, wraps every 53s)
+	#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+	#define portGET_RUN_TIME_COUNTER_VALUE()			({ uint32_t ccount; __asm__ __volatile__( "rsr %0, ccount" : "=a"(ccount) ); ccount; })
+#else
+	#define configUSE_TRACE_FACILITY							0		// Only enable for debug purpose, not intended for normal use
+#endif
 #define configUSE_STATS_FORMATTING_FUNCTIONS 		0		// Only enable for debug purpose, not intended for normal use
 #define configUSE_16_BIT_TICKS									0
 #define configIDLE_SHOULD_YIELD									1
 
 #define INCLUDE_xTaskGetIdleTaskHandle 					1
 #define INCLUDE_xTimerGetTimerDaemonTaskHandle 	1
+#define INCLUDE_xTimerPendFunctionCall					1		// Used for debug commands
 
 #define configCHECK_FOR_STACK_OVERFLOW  				2
 #define configUSE_MUTEXES  											1
@@ -74,6 +84,11 @@ to exclude the API function. */
 #ifdef INCLUDE_TRACE
 	#include "trace.h" 
 	#define traceTASK_SWITCHED_IN()								trace_task_switch()
+	#define traceQUEUE_SEND( pxQueue )						trace_event( TRACE_QUEUE_SEND, (uint32_t)(pxQueue) )
+	#define traceQUEUE_SEND_FROM_ISR( pxQueue )		trace_event( TRACE_QUEUE_SEND_FROM_ISR, (uint32_t)(pxQueue) )
+	#define traceQUEUE_RECEIVE( pxQueue )					trace_event( TRACE_QUEUE_RECEIVE, (uint32_t)(pxQueue) )
+	#define traceBLOCKING_ON_QUEUE_RECEIVE( pxQueue )		trace_event( TRACE_QUEUE_BLOCK, (uint32_t)(pxQueue) )
+	#define traceTASK_PRIORITY_INHERIT( pxTCB, uxPriority )	trace_event( TRACE_PRIORITY_INHERIT, (uxPriority) )
 #endif
 
 
@@ -0,0 +1,84 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include "espressif/esp_common.h"
+
+#include "boot.h"
+#include "mqtt.h"
+#include "wifi.h"
+#ifdef BOOT_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+static uint32_t boot_ms[BOOT_PHASE_COUNT];			// 0 until reached
+static bool boot_published = false;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void boot_pub( void );
+static uint32_t boot_span( boot_phase_t from, boot_phase_t to );
+
+#ifdef BOOT_DEBUG
+	#define boot_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define boot_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Cheap after first call of a phase, so it can be called on every frame.
+// Boot message is published once with first value after broker connection.
+void boot_mark( boot_phase_t phase )
+{
+	bool publish;
+
+	if( (phase >= BOOT_PHASE_COUNT) || (boot_ms[phase] != 0) ) return;
+	// Values before connection are dropped with publish queue
+	if( (phase == BOOT_VALUE) && (boot_ms[BOOT_MQTT] == 0) ) return;
+
+	boot_ms[phase] = sdk_system_get_time() / 1000;
+	if( boot_ms[phase] == 0 ) boot_ms[phase] = 1;
+	boot_debug_print( "%s: Phase %u after %ums\n", __FUNCTION__, phase, boot_ms[phase] );
+
+	taskENTER_CRITICAL();
+	publish = (boot_published == false) && (phase == BOOT_VALUE);
+	if( publish == true ) boot_published = true;
+	taskEXIT_CRITICAL();
+
+	if( publish == true ) boot_pub();
+}
+
+
+
+// Duration of each phase in ms, counted from the phase it waits for. SML and wifi both
+// start at init. 'total' is the time from boot to first value:
+// {"init":85,"sml":1210,"wifi":2950,"mqtt":310,"value":420,"total":3765,"cached":true}
+static void boot_pub( void )
+{
+	mqtt_pub( "Boot", "{\"init\":%u,\"sml\":%u,\"wifi\":%u,\"mqtt\":%u,\"value\":%u,\"total\":%u,\"cached\":%s}",
+	          boot_ms[BOOT_INIT], boot_span(BOOT_INIT, BOOT_FRAME), boot_span(BOOT_INIT, BOOT_WIFI),
+	          boot_span(BOOT_WIFI, BOOT_MQTT), boot_span(BOOT_MQTT, BOOT_VALUE), boot_ms[BOOT_VALUE],
+	          wifi_connect_cached() ? "true" : "false" );
+}
+
+
+
+// 0 when a phase was not reached
+static uint32_t boot_span( boot_phase_t from, boot_phase_t to )
+{
+	if( (boot_ms[from] == 0) || (boot_ms[to] < boot_ms[from]) ) return 0;
+	return boot_ms[to] - boot_ms[from];
+}
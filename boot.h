@@ -0,0 +1,43 @@
+#ifndef BOOT_H_
+#define BOOT_H_
+
+#include "stdbool.h"
+#include "stdint.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define BOOT_DEBUG
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+// Phases after power on, each is recorded once in ms since boot
+typedef enum
+{
+	BOOT_INIT,								// User init finished
+	BOOT_FRAME,								// First SML frame with valid CRC
+	BOOT_WIFI,								// First IP address
+	BOOT_MQTT,								// First connection to broker
+	BOOT_VALUE,								// First meter values published after broker connection
+	BOOT_PHASE_COUNT
+} boot_phase_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+void boot_mark( boot_phase_t phase );
+
+
+
+#endif // BOOT_H_
@@ -2,22 +2,41 @@
 #define BUFFER_H_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
 
 
 
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Longest text of buffer_put_format() when it needs to be split at end of data
+#define BUFFER_FORMAT_LEN							128
+
+
+
 //*****************************************************************************
 // Data structures
 //*****************************************************************************
 
+// Ring buffer with power of two size, at most 32768 bytes.
+// head and tail run freely and are masked on access, so head - tail is the
+// used length also after they wrapped, and all bytes of data can be used.
+//
+// Single producer, single consumer: Producer functions (put, write span, commit)
+// only change head, consumer functions (get, read span, consume) only change tail.
+// Both sides can run at the same time, e.g. interrupt and task, without lock.
+// Index loads acquire and stores release, so data is written before the index
+// which publishes it is seen by the other side.
 typedef struct
 {
 	uint8_t* data;
-	uint16_t head;
-	uint16_t tail;
-	uint16_t len;
-	uint16_t token;
+	uint16_t mask;							// Size - 1
+	uint16_t head;							// Written by producer only
+	uint16_t tail;							// Written by consumer only
 } buffer_t;
 
 
@@ -28,143 +47,189 @@ typedef struct
 // Otherwise they won't be inline because of seperateobject file.
 //*****************************************************************************
 
-inline void buffer_init( void* data, uint16_t len, buffer_t* buf )
+#define buffer_load( index )					__atomic_load_n( &(index), __ATOMIC_ACQUIRE )
+#define buffer_store( index, value )	__atomic_store_n( &(index), (value), __ATOMIC_RELEASE )
+
+
+// Size needs to be a power of two
+static inline bool buffer_init( void* data, uint16_t len, buffer_t* buf )
 {
+	buf->data = NULL;
+	if( (data == NULL) || (len == 0) || (len > 0x8000) || ((len & (len - 1)) != 0) ) return false;
 	buf->data = data;
-	buf->len = len;
+	buf->mask = len - 1;
 	buf->head = 0;
 	buf->tail = 0;
+	return true;
 }
 
-inline uint16_t buffer_used( buffer_t* buf )
+static inline uint16_t buffer_size( buffer_t* buf )
 {
-	if (buf->head > buf->tail)
-		return (buf->head - buf->tail);
-	else
-		return 0;
+	return buf->mask + 1;
 }
 
-inline uint16_t buffer_free( buffer_t* buf )
+static inline uint16_t buffer_used( buffer_t* buf )
 {
-	if( buf->head < buf->len )
-		return (buf->len - buf->head);						
-	else
-		return 0;
+	return (uint16_t)(buffer_load(buf->head) - buffer_load(buf->tail));
 }
 
-inline bool buffer_put_data( void* data, uint16_t len, buffer_t* buf ) 
+static inline uint16_t buffer_free( buffer_t* buf )
 {
-	if( (buf->data == NULL) || (data == NULL) || (buffer_free(buf) < len) ) return false;
+	return buffer_size(buf) - buffer_used(buf);
+}
 
-	memcpy(&buf->data[buf->head], data, len);
-	buf->head += len;
-	return true;
+// Only when neither side is active
+static inline void buffer_clear( buffer_t* buf )
+{
+	buf->head = 0;
+	buf->tail = 0;
 }
 
-inline bool buffer_put_string( const char* text, buffer_t* buf ) 
+
+
+//*****************************************************************************
+// Zero copy access
+// A span is the contiguous part up to end of data, the rest starts at data[0]
+//*****************************************************************************
+
+// Producer: Where next bytes can be written, returns their count
+static inline uint16_t buffer_write_span( buffer_t* buf, uint8_t** ptr )
 {
-	size_t len;
-	
-	if( (buf->data == NULL) || (text == NULL) ) return false;
-	
-	len = strlen(text);
-	if( buffer_free(buf) < len ) return false;
+	uint16_t head = buf->head;
+	uint16_t used = (uint16_t)(head - buffer_load(buf->tail));
+	uint16_t offs = head & buf->mask;
+	uint16_t len = buffer_size(buf) - offs;
 
-	memcpy(&buf->data[buf->head], text, len);
-	buf->head += len;
-	return true;
+	*ptr = &buf->data[offs];
+	return (len < buffer_size(buf) - used) ? len : (buffer_size(buf) - used);
 }
 
-inline bool buffer_put_byte( char byte, buffer_t* buf )
+// Producer: Publish len bytes written to span
+static inline void buffer_commit( buffer_t* buf, uint16_t len )
 {
-	if( (buf->data == NULL) || (buffer_free(buf) == 0) ) return false;
+	buffer_store( buf->head, (uint16_t)(buf->head + len) );
+}
 
-	buf->data[buf->head++] = byte;
-	return true;
+// Consumer: Oldest bytes, returns their count
+static inline uint16_t buffer_read_span( buffer_t* buf, uint8_t** ptr )
+{
+	uint16_t tail = buf->tail;
+	uint16_t used = (uint16_t)(buffer_load(buf->head) - tail);
+	uint16_t offs = tail & buf->mask;
+	uint16_t len = buffer_size(buf) - offs;
+
+	*ptr = &buf->data[offs];
+	return (len < used) ? len : used;
 }
 
-inline uint8_t buffer_get_byte( buffer_t* buf )
+// Consumer: Release len bytes of span
+static inline void buffer_consume( buffer_t* buf, uint16_t len )
 {
-	if( (buf->data != NULL) && (buffer_used(buf) >= 1) )
-	{
-		return buf->data[buf->tail++];
-	}
-	return 0x00;
+	buffer_store( buf->tail, (uint16_t)(buf->tail + len) );
 }
 
-inline uint8_t* buffer_ptr( buffer_t* buf )
+
+
+//*****************************************************************************
+// Copy access
+//*****************************************************************************
+
+// All or nothing, at most two copies when data wraps
+static inline bool buffer_put_data( const void* data, uint16_t len, buffer_t* buf )
 {
-	if( buf->data == NULL ) return NULL;
+	uint8_t* ptr;
+	uint16_t span;
+
+	if( (buf->data == NULL) || (data == NULL) || (buffer_free(buf) < len) ) return false;
 
-	return &buf->data[buf->tail];
+	span = buffer_write_span( buf, &ptr );
+	if( span > len ) span = len;
+	memcpy( ptr, data, span );
+	memcpy( buf->data, (const uint8_t*)data + span, len - span );
+	buffer_commit( buf, len );
+	return true;
 }
 
-inline void buffer_clear( buffer_t* buf )
+static inline bool buffer_put_string( const char* text, buffer_t* buf )
 {
-	buf->head = 0;
-	buf->tail = 0;
+	if( text == NULL ) return false;
+	return buffer_put_data( text, strlen(text), buf );
 }
 
-
-inline char* buffer_token( const char chr, buffer_t* buf ) 
+static inline bool buffer_put_byte( char byte, buffer_t* buf )
 {
-	char* token;
-	
-	if( (buf->data == NULL) || (buffer_used(buf) == 0) ) return NULL;
-	token = (char*)&buf->data[buf->tail];
-	for (; buf->tail <= buf->head; buf->tail++) 
-	{
-		if( buf->data[buf->tail] == chr)  
-		{
-			buf->data[buf->tail] = '\0';
-			buf->tail++;
-			return token;
-		}
-	}
-	return token; // token not found, return last position (be carefull, possibliy not \0 terminated)
+	uint16_t head = buf->head;
+
+	if( (buf->data == NULL) || ((uint16_t)(head - buffer_load(buf->tail)) > buf->mask) ) return false;
+
+	buf->data[head & buf->mask] = byte;
+	buffer_store( buf->head, (uint16_t)(head + 1) );
+	return true;
 }
 
+// Returns 0x00 when empty
+static inline uint8_t buffer_get_byte( buffer_t* buf )
+{
+	uint16_t tail = buf->tail;
+	uint8_t byte;
 
+	if( (buf->data == NULL) || (buffer_load(buf->head) == tail) ) return 0x00;
 
-inline bool buffer_put_format( buffer_t* buf, const char* format, ... )
+	byte = buf->data[tail & buf->mask];
+	buffer_store( buf->tail, (uint16_t)(tail + 1) );
+	return byte;
+}
+
+// Copies up to len bytes, returns count
+static inline uint16_t buffer_get_data( void* data, uint16_t len, buffer_t* buf )
+{
+	uint8_t* ptr;
+	uint16_t span, used;
+
+	if( buf->data == NULL ) return 0;
+	used = buffer_used( buf );
+	if( len > used ) len = used;
+
+	span = buffer_read_span( buf, &ptr );
+	if( span > len ) span = len;
+	memcpy( data, ptr, span );
+	memcpy( (uint8_t*)data + span, buf->data, len - span );
+	buffer_consume( buf, len );
+	return len;
+}
+
+// Producer: Formatted text without terminating zero, all or nothing.
+// Formatted in place when it fits before end of data, otherwise copied in two parts.
+static inline bool buffer_put_format( buffer_t* buf, const char* format, ... )
 {
 	va_list arglist;
-	uint16_t len;
-	
+	uint8_t* ptr;
+	uint16_t span;
+	int len;
+
 	if( buf->data == NULL ) return false;
 
+	span = buffer_write_span( buf, &ptr );
 	va_start( arglist, format );
-	len = vsnprintf( (char*)&buf->data[buf->head], buffer_free(buf), format, arglist );
-	va_end( arglist );	
-	if( len < 0 ) 
-	{
-		return false;
-	}
-	buf->head += len;	
-	if( buffer_free(buf) <= 1 ) 
+	len = vsnprintf( (char*)ptr, span, format, arglist );
+	va_end( arglist );
+	if( len < 0 ) return false;
+	if( len < span )
 	{
-		return false; 
+		buffer_commit( buf, len );
+		return true;
 	}
-	return true;
-}
-
-
 
-// Free up space when some tail bytes are already used, which are all bytes before tail
-inline bool buffer_crop( buffer_t* buf ) 
-{
-	uint16_t used = buffer_used(buf);
-	uint16_t n;
-	
-	if( buf->tail == 0 ) return true;
-	for( n=0; n<used; n++ )
+	// Span too short, zero termination needs one byte more
+	if( (len >= BUFFER_FORMAT_LEN) || (len > buffer_free(buf)) ) return false;
 	{
-		buf->data[n] = buf->data[n+buf->tail];
+		char text[BUFFER_FORMAT_LEN];
+		va_start( arglist, format );
+		vsnprintf( text, sizeof(text), format, arglist );
+		va_end( arglist );
+		return buffer_put_data( text, len, buf );
 	}
-	buf->tail = 0;
-	buf->head = used;
-	return true;
 }
 
 
-#endif // BUFFER_H
+#endif // BUFFER_H_
@@ -2,23 +2,37 @@
 #include "debug.h"
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "timers.h"
 #include "espressif/esp_common.h"
 #include "lwip/tcp.h"
 #include "string.h"
+#include "buffer.h"
 
 
 
 //*****************************************************************************
 // Global data structures
 //*****************************************************************************
+typedef struct
+{
+	const char*					name;
+	debug_command_t			callback;
+} debug_command_entry_t;
+
 typedef struct
 {
 	#ifdef DEBUG_TCP
 		struct tcp_pcb *tcp_pcb;
 		struct tcp_pcb *tcp_pcb_out;
+		char command[DEBUG_COMMAND_LEN +1];
 	#endif
+	debug_command_entry_t commands[DEBUG_COMMANDS_MAX];
 	char* bufferPtr;
 	SemaphoreHandle_t SemaphoreHandle;
+	#ifdef DEBUG_EARLY_LOG
+		buffer_t early;								// Data is NULL after it was sent
+		uint32_t early_lost;					// Bytes which didn't fit
+	#endif
 } debug_t;
 
 
@@ -31,6 +45,12 @@ debug_t* debug = NULL;
 #ifdef DEBUG_TCP
 	static err_t debug_accept( void *arg, struct tcp_pcb *pcb, err_t err );
 	static void debug_close( void );
+	static err_t debug_recv( void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err );
+	static void debug_command( void* param1, uint32_t param2 );
+	#ifdef DEBUG_EARLY_LOG
+		static bool debug_early_write( void );
+		static void debug_early_send( void* param1, uint32_t param2 );
+	#endif
 #endif
 
 #ifdef DEBUG_DEBUG
@@ -66,6 +86,12 @@ bool debug_init( void )
 	#endif
 	debug->bufferPtr = NULL;
 	debug->SemaphoreHandle = NULL;
+	memset( debug->commands, 0x00, sizeof(debug->commands) );
+	#ifdef DEBUG_EARLY_LOG
+		// Without memory output is just dropped until client connects
+		buffer_init( pvPortMalloc(DEBUG_EARLY_LOG), DEBUG_EARLY_LOG, &debug->early );
+		debug->early_lost = 0;
+	#endif
 	
 	debug->SemaphoreHandle = xSemaphoreCreateMutex();
 	if( debug->SemaphoreHandle == NULL ) 
@@ -130,6 +156,51 @@ bool debug_wifi_init( void )
 }
 
 
+bool debug_add_command( const char* name, debug_command_t callback )
+{
+	if( (debug == NULL) || (name == NULL) || (callback == NULL) ) return false;
+
+	for( uint8_t n=0; n<DEBUG_COMMANDS_MAX; n++ )
+	{
+		if( debug->commands[n].name == NULL )
+		{
+			debug->commands[n].callback = callback;
+			debug->commands[n].name = name;
+			return true;
+		}
+	}
+	debug_printf( "%s: No space left for '%s'\n", __FUNCTION__, name );
+	return false;
+}
+
+
+
+// Long outputs would overflow tcp send buffer, which closes connection.
+// Wait until enough space is available, returns false on timeout or without connection.
+bool debug_wait_space( size_t len )
+{
+	#ifdef DEBUG_TCP
+		size_t space;
+		uint32_t timeout = DEBUG_SPACE_TIMEOUT;
+
+		if( debug == NULL ) return false;
+		while( debug->tcp_pcb_out != NULL )
+		{
+			LOCK_TCPIP_CORE();
+			space = tcp_sndbuf( debug->tcp_pcb_out );
+			if( space < len ) tcp_output( debug->tcp_pcb_out );
+			UNLOCK_TCPIP_CORE();
+			if( space >= len ) return true;
+			if( timeout < 10 ) break;
+			timeout -= 10;
+			vTaskDelay( 10 / portTICK_RATE_MS );
+		}
+	#endif
+	return false;
+}
+
+
+
 void debug_print( const char *format, ... )
 {
 	va_list arglist;
@@ -147,7 +218,11 @@ void debug_print_va( const char *format, va_list arglist )
 	#if defined(DEBUG_TCP) || defined(DEBUG_PRINTF)
 	  if( debug == NULL ) return;
 		#if defined(DEBUG_TCP) && !defined(DEBUG_PRINTF)
-			if( debug->tcp_pcb_out == NULL ) return;
+			#ifdef DEBUG_EARLY_LOG
+				if( (debug->tcp_pcb_out == NULL) && (debug->early.data == NULL) ) return;
+			#else
+				if( debug->tcp_pcb_out == NULL ) return;
+			#endif
 		#endif	
 
 		bool ret = xSemaphoreTake( debug->SemaphoreHandle, (DEBUG_PRINT_TIMEOUT / portTICK_RATE_MS) );
@@ -168,6 +243,17 @@ void debug_print_va( const char *format, va_list arglist )
 			err_t err;
 			size_t len;
 			
+			#ifdef DEBUG_EARLY_LOG
+			// Also after connect until early output is sent, to keep order
+			if( debug->early.data != NULL )
+			{
+				if( buffer_put_string(debug->bufferPtr, &debug->early) == false ) 
+				{
+					debug->early_lost += strlen( debug->bufferPtr );
+				}
+			}
+			else
+			#endif
 			if( debug->tcp_pcb_out != NULL )
 			{
 				len = strlen(debug->bufferPtr);
@@ -221,7 +307,15 @@ void debug_print_va( const char *format, va_list arglist )
 		if( ret == ERR_OK )
 		{
 			debug->tcp_pcb_out = pcb;
+			tcp_recv( pcb, debug_recv );
 			debug_printf( "Done\n" );
+			#ifdef DEBUG_EARLY_LOG
+				// Waiting for space isn't possible inside tcpip thread, see debug_recv()
+				if( (debug->early.data != NULL) && (xTimerPendFunctionCall(debug_early_send, NULL, 0, 0) == pdFALSE) )
+				{
+					debug_printf( "%s: Failed to pass early output\n", __FUNCTION__ );
+				}
+			#endif
 		}
 		else 
 		{
@@ -233,10 +327,126 @@ void debug_print_va( const char *format, va_list arglist )
 
 
 	
+	#ifdef DEBUG_EARLY_LOG
+	// Consumer of early buffer, prints go on to it as producer until it is freed.
+	// Spans up to end of ring, each needs to fit into tcp send buffer at once.
+	static bool debug_early_write( void )
+	{
+		uint8_t* ptr;
+		uint16_t len;
+		err_t err;
+
+		while( (len = buffer_read_span(&debug->early, &ptr)) > 0 )
+		{
+			if( len > TCP_MSS ) len = TCP_MSS;
+			if( debug_wait_space(len) == false ) return false;
+			LOCK_TCPIP_CORE();
+			err = tcp_write( debug->tcp_pcb_out, ptr, len, TCP_WRITE_FLAG_COPY );
+			if( err == ERR_OK ) tcp_output( debug->tcp_pcb_out );
+			UNLOCK_TCPIP_CORE();
+			if( err != ERR_OK )
+			{
+				debug_printf( "%s: Failed to write (%d)\n", __FUNCTION__, (int)err );
+				debug_close();
+				return false;
+			}
+			buffer_consume( &debug->early, len );
+		}
+		return true;
+	}
+
+
+
+	// Called from timer task after first connection. Most is sent without semaphore,
+	// only the rest and switch to direct output need it.
+	static void debug_early_send( void* param1, uint32_t param2 )
+	{
+		bool ok;
+
+		ok = debug_early_write();
+		if( xSemaphoreTake(debug->SemaphoreHandle, portMAX_DELAY) == pdFALSE ) return;
+		if( ok == true ) ok = debug_early_write();
+		if( (ok == true) && (debug->early_lost > 0) )
+		{
+			snprintf( (char*)debug->early.data, DEBUG_EARLY_LOG, "... %u bytes of boot output lost\n", debug->early_lost );
+			buffer_clear( &debug->early );
+			buffer_commit( &debug->early, strlen((char*)debug->early.data) );
+			debug_early_write();
+		}
+
+		// Rest is dropped when connection was closed meanwhile
+		vPortFree( debug->early.data );
+		debug->early.data = NULL;
+		xSemaphoreGive( debug->SemaphoreHandle );
+	}
+	#endif
+
+
+
 	static void debug_close( void )
 	{		
 		tcp_close( debug->tcp_pcb_out );
 		debug->tcp_pcb_out = NULL;
 		debug_printf( "%s: Connection closed\n", __FUNCTION__);
 	}
+
+
+	// Called from tcpip thread, when a command line is received
+	static err_t debug_recv( void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err )
+	{
+		uint16_t len;
+
+		LWIP_UNUSED_ARG( arg );
+		if( p == NULL )
+		{
+			// Remote side closed connection
+			debug_close();
+			return ERR_OK;
+		}
+
+		len = pbuf_copy_partial( p, debug->command, DEBUG_COMMAND_LEN, 0 );
+		debug->command[len] = '\0';
+		tcp_recved( pcb, p->tot_len );
+		pbuf_free( p );
+
+		// Output of commands goes to tcp again, which isn't possible inside tcpip thread.
+		// So execution is done by timer task.
+		if( xTimerPendFunctionCall( debug_command, NULL, 0, 0 ) == pdFALSE )
+		{
+			debug_printf( "%s: Failed to pass command\n", __FUNCTION__ );
+		}
+		return ERR_OK;
+	}
+
+
+
+	static void debug_command( void* param1, uint32_t param2 )
+	{
+		char* name = debug->command;
+		char* args;
+		size_t len;
+
+		// Strip line ending and split command name from arguments
+		len = strlen( name );
+		while( (len > 0) && (name[len-1] <= ' ') ) name[--len] = '\0';
+		args = strchr( name, ' ' );
+		if( args != NULL ) *args++ = '\0';
+		else args = &name[len];
+
+		if( len == 0 ) return;
+		for( uint8_t n=0; n<DEBUG_COMMANDS_MAX; n++ )
+		{
+			if( (debug->commands[n].name != NULL) && (strcmp(debug->commands[n].name, name) == 0) )
+			{
+				debug->commands[n].callback( args );
+				return;
+			}
+		}
+
+		debug_print( "Unknown command '%s', available:\n", name );
+		for( uint8_t n=0; n<DEBUG_COMMANDS_MAX; n++ )
+		{
+			if( debug->commands[n].name != NULL ) debug_print( DEBUG_INDENT "%s\n", debug->commands[n].name );
+		}
+	}
 #endif
@@ -18,11 +18,19 @@
 #define DEBUG_STRING_SIZE							(DEBUG_STRING_LEN +1)
 #define DEBUG_INDENT									"  "
 #define DEBUG_PRINT_TIMEOUT						50			//ms		
+#define DEBUG_COMMAND_LEN							20			// Max length of a command line received over TCP
+#define DEBUG_COMMANDS_MAX						8
+#define DEBUG_SPACE_TIMEOUT						2000		//ms, waiting for tcp buffer space on long outputs
 // Uncomment to enable printf outputs to debug itself
 //#define DEBUG_DEBUG									
 
 //#define DEBUG_TCP_INSTANT						
 
+// Output before first TCP client is kept and sent when it connects, so boot
+// doesn't need to wait for the client. Power of two, freed after sending.
+// Comment to disable, then output without client is dropped.
+#define DEBUG_EARLY_LOG								2048		// bytes
+
 #define DEBUG_TCP				           	// Output to TCP
 //#define DEBUG_PRINTF		             	// Output to std output
 
@@ -31,6 +39,15 @@
 #endif
 
 
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+// Called from timer task with remaining text after command name
+typedef void(*debug_command_t)( const char* args );
+
+
+
 //*****************************************************************************
 // Function prototypes
 //*****************************************************************************
@@ -39,6 +56,8 @@ bool debug_init( void );
 bool debug_wifi_init( void );
 void debug_print( const char *format, ... );
 void debug_print_va( const char *format, va_list arglist );
+bool debug_add_command( const char* name, debug_command_t callback );
+bool debug_wait_space( size_t len );
 
 
 #endif // DEBUG_H_
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include "espressif/esp_common.h"
+
+#include "diag.h"
+#include "mqtt.h"
+#ifdef DIAG_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+typedef struct
+{
+	TaskHandle_t	handle;
+	uint32_t			runtime;
+} diag_runtime_t;
+
+
+xTaskHandle diag_task_handle = NULL;
+static uint32_t diag_heap_min = UINT32_MAX;
+
+#if configUSE_TRACE_FACILITY
+	static TaskStatus_t diag_tasks[DIAG_MAX_TASKS];
+	static diag_runtime_t diag_runtime[DIAG_MAX_TASKS];
+	static uint32_t diag_runtime_total = 0;
+#endif
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void diag_task( void *pvParameters );
+static void diag_pub_heap( void );
+#if configUSE_TRACE_FACILITY
+	static void diag_pub_tasks( void );
+	static uint32_t diag_runtime_delta( TaskHandle_t handle, uint32_t runtime );
+#endif
+
+#ifdef DIAG_DEBUG
+	#define diag_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define diag_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+bool diag_init( void )
+{
+	if( diag_task_handle != NULL ) return false;
+
+	xTaskCreate( diag_task, "diag", DIAG_TASK_STACK, NULL, DIAG_TASK_PRIORITY, &diag_task_handle );
+	if( diag_task_handle == NULL )
+	{
+		diag_debug_print( "%s: Error creating task\n", __FUNCTION__ );
+		return false;
+	}
+	return true;
+}
+
+
+
+static void diag_task( void *pvParameters )
+{
+	TickType_t wake = xTaskGetTickCount();
+
+	while (true)
+	{
+		vTaskDelayUntil( &wake, ((int32_t)DIAG_INTERVAL * 1000) / portTICK_RATE_MS );
+
+		if( mqtt_is_connected() == false ) continue;
+
+		diag_pub_heap();
+		#if configUSE_TRACE_FACILITY
+			diag_pub_tasks();
+		#endif
+	}
+}
+
+
+
+static void diag_pub_heap( void )
+{
+	struct mallinfo info = mallinfo();
+	uint32_t free = xPortGetFreeHeapSize();
+
+	// Heap allocator doesn't track minimum, so it is sampled here
+	if( free < diag_heap_min ) diag_heap_min = free;
+
+	// 'top' is the untouched space at end of heap, which is the largest block available.
+	// 'chunks' is number of free fragments inside the used heap area
+	diag_debug_print( "%s: free %u, min %u, used %u\n", __FUNCTION__, free, diag_heap_min, info.uordblks );
+	mqtt_pub( "Diag/Heap", "{\"free\":%u,\"min\":%u,\"used\":%u,\"top\":%u,\"chunks\":%u}",
+	          free, diag_heap_min, info.uordblks, info.keepcost, info.ordblks );
+}
+
+
+
+#if configUSE_TRACE_FACILITY
+	static void diag_pub_tasks( void )
+	{
+		UBaseType_t	count;
+		uint32_t		total;
+		uint32_t		total_delta;
+		uint32_t		delta;
+		uint32_t		permille;
+		char				topic[10 + configMAX_TASK_NAME_LEN];
+
+		count = uxTaskGetSystemState( diag_tasks, DIAG_MAX_TASKS, &total );
+		total_delta = total - diag_runtime_total;			// Unsigned arithmetic handles CCOUNT wrap
+		diag_runtime_total = total;
+		if( total_delta == 0 ) total_delta = 1;
+
+		for( UBaseType_t n=0; n<count; n++ )
+		{
+			delta = diag_runtime_delta( diag_tasks[n].xHandle, diag_tasks[n].ulRunTimeCounter );
+			permille = (uint32_t)(((uint64_t)delta * 1000) / total_delta);
+
+			diag_debug_print( "%s: %s stack %u, cpu %u.%u%%\n", __FUNCTION__, diag_tasks[n].pcTaskName,
+			                  diag_tasks[n].usStackHighWaterMark, permille / 10, permille % 10 );
+			snprintf( topic, sizeof(topic), "Diag/Task/%s", diag_tasks[n].pcTaskName );
+			mqtt_pub( topic, "{\"stack\":%u,\"cpu\":%u.%u}",
+			          diag_tasks[n].usStackHighWaterMark, permille / 10, permille % 10 );
+			vTaskDelay( DIAG_PUB_DELAY / portTICK_RATE_MS );
+		}
+	}
+
+
+
+	// Returns runtime since last call for this task and stores current value.
+	// Deleted tasks leave their slot behind, which is reused when table is full.
+	static uint32_t diag_runtime_delta( TaskHandle_t handle, uint32_t runtime )
+	{
+		uint8_t n;
+		uint32_t delta;
+
+		for( n=0; n<DIAG_MAX_TASKS; n++ )
+		{
+			if( diag_runtime[n].handle == handle ) break;
+		}
+		if( n >= DIAG_MAX_TASKS )
+		{
+			for( n=0; n<DIAG_MAX_TASKS; n++ )
+			{
+				if( diag_runtime[n].handle == NULL ) break;
+			}
+			if( n >= DIAG_MAX_TASKS ) n = 0;
+			diag_runtime[n].handle = handle;
+			diag_runtime[n].runtime = runtime;
+			return 0;
+		}
+
+		delta = runtime - diag_runtime[n].runtime;
+		diag_runtime[n].runtime = runtime;
+		return delta;
+	}
+#endif
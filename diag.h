@@ -0,0 +1,35 @@
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stdbool.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define DIAG_DEBUG
+
+#define DIAG_TASK_PRIORITY						1
+#define DIAG_TASK_STACK								400
+
+// Needs to be below 53s, because runtime counter CCOUNT wraps around after that
+#define DIAG_INTERVAL									30		// s
+#define DIAG_PUB_DELAY								200		// ms between messages, avoid flooding mqtt queue
+#define DIAG_MAX_TASKS								16
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+bool diag_init( void );
+
+
+
+#endif // DIAG_H_
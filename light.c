@@ -1,9 +1,11 @@
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
 #include "esp/gpio.h"
-#include "esp/wdev_regs.h"
+#include "esp/timer.h"
 #include <string.h>
 #include "light.h"
+#include "trace.h"
 #ifdef LIGHT_DEBUG
 	#include "debug.h"
 #endif
@@ -17,40 +19,61 @@
 #define LIGHT_PULSE_CONFIRM					5500
 #define LIGHT_PULSE_PIN_WAIT				3500
 #define LIGHT_PULSE_START						5000
+#define LIGHT_PULSE_END							10000	// Off time after info, also keeps next queued command apart
+#define LIGHT_PULSE_MAX							25000	// Longest edge, FRC1 has 23 bit with divider 256
 #define LIGHT_DISPLAY_TEST_TIMEOUT  120000
 
+// FRC1 runs at 80MHz / 256 = 312.5 ticks per ms. Multiply and shift only, handler runs from IRAM.
+#define LIGHT_TIMER_TICKS(ms)				(((uint32_t)(ms) * 625) >> 1)
+#define LIGHT_TIMER_START						16		// Ticks until first edge of a new command
+
 
 
 //*****************************************************************************
 // Local variables and definitions
 //*****************************************************************************
 
-xTaskHandle light_task_handle = NULL;
-uint8_t Pin[4];
-uint32_t display_test_timeout = 0;
-
+// Pulses compiled into edges: Even edges switch light on, odd ones off, each lasting ms[n].
+// Zero length edges are skipped.
+typedef struct
+{
+	uint8_t count;
+	uint16_t ms[LIGHT_EDGES_MAX];
+} light_program_t;
 
 typedef enum
 {
 	LIGHT_TYPE_INFO,
 	LIGHT_TYPE_PIN,
+	LIGHT_TYPE_PATTERN,
 	LIGHT_TYPE_COUNT
 } light_type_t;
 
 const char* const light_type_str[LIGHT_TYPE_COUNT] =
 {
 	[LIGHT_TYPE_INFO] = "info",
-	[LIGHT_TYPE_PIN] = "pin"
+	[LIGHT_TYPE_PIN] = "pin",
+	[LIGHT_TYPE_PATTERN] = "pattern"
 };
-	
+
+static xQueueHandle light_queue = NULL;
+static light_program_t light_current;			// Owned by timer interrupt while running
+static uint8_t light_edge;
+static volatile bool light_running = false;
+static TickType_t light_last;							// Time of last command, for display test
+static bool light_used = false;
+
 
 
 //*****************************************************************************
 // Local function prototypes
 //*****************************************************************************
 
-static void light_pulse(uint32_t on, uint32_t off, uint8_t count);
-void light_task( void *pvParameters );
+static bool light_add_pulses(light_program_t* program, uint16_t on, uint16_t off, uint8_t count);
+static bool light_add_off(light_program_t* program, uint16_t off);
+static bool light_add_pin(light_program_t* program, const char* str, size_t len);
+static bool light_add_pattern(light_program_t* program, const char* str, size_t len);
+static void light_timer_handler(void *arg);
 #ifdef LIGHT_DEBUG
 	#define light_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
 #else	
@@ -68,22 +91,36 @@ bool light_init(void)
 	gpio_write(LIGHT_PIN, true);	// inverted logic
 	gpio_enable(LIGHT_PIN, GPIO_OUTPUT);
 	gpio_set_iomux_function(LIGHT_PIN, LIGHT_IOMUX);
-	
+
+	light_queue = xQueueCreate(LIGHT_QUEUE_SIZE, sizeof(light_program_t));
+	if (light_queue == NULL)
+	{
+		light_debug_print("%s: Failed to create queue\n", __FUNCTION__);
+		return false;
+	}
+
+	// One shot timer, reloaded by handler for every edge
+	timer_set_interrupts(FRC1, false);
+	timer_set_run(FRC1, false);
+	_xt_isr_attach(INUM_TIMER_FRC1, light_timer_handler, NULL);
+	timer_set_divider(FRC1, TIMER_CLKDIV_256);
+	timer_set_reload(FRC1, false);
+	timer_set_interrupts(FRC1, true);
+
 	return true;
 }
 
 
+
+// Called from mqtt and unlock task. Command is compiled and queued, output is done by timer interrupt.
 void light_start( const char* str, size_t len )
 {
+	light_program_t program;
 	light_type_t type;
+	TickType_t now;
 	uint8_t n;
-	
-	// Avoid to mess up different requests
-	if (light_task_handle != NULL)
-	{
-		light_debug_print("%s: Old task active\n", __FUNCTION__);
-		return;
-	}
+	bool ok;
+	bool test;
 	
 	for (type=0; type<LIGHT_TYPE_COUNT; type++)
 	{
@@ -99,92 +136,178 @@ void light_start( const char* str, size_t len )
 		return;
 	}	
 	
-	if (type == LIGHT_TYPE_PIN)
+	// Display test is done on first pulse, when longer time no input
+	program.count = 0;
+	now = xTaskGetTickCount();
+	taskENTER_CRITICAL();
+	test = (light_used == false) || ((now - light_last) > (LIGHT_DISPLAY_TEST_TIMEOUT / portTICK_PERIOD_MS));
+	taskEXIT_CRITICAL();
+	if (test)
 	{
-		if (len != 8)
-		{
-			light_debug_print("%s: Invalid pin command '%.*s'\n", __FUNCTION__, len, str);
-			return;
-		}
-		
-		for (n=0; n<4; n++)
-		{
-			if ((str[n+4] < '0') || (str[n+4] > '9'))
-			{
-				light_debug_print("%s: Invalid pin command '%.*s'\n", __FUNCTION__, len, str);
-				return;
-			}
-			Pin[n] = str[n+4] - '0';
-		}
+		light_add_pulses(&program, LIGHT_PULSE_SHORT, LIGHT_PULSE_START, 1);
 	}
-	
-	light_debug_print("%s: Starting %s\n", __FUNCTION__, light_type_str[type]);
-	xTaskCreate( light_task, 
-	             "light_task", 
-							 LIGHT_TASK_STACK, 
-							 (void*)type, 
-							 LIGHT_TASK_PRIORITY, 
-							 &light_task_handle );
-	
-	if (light_task_handle == NULL)
+
+	switch (type)
 	{
-		light_debug_print("%s: Failed to create task\n", __FUNCTION__);
-	}	
+		case LIGHT_TYPE_INFO:
+			ok = light_add_pulses(&program, LIGHT_PULSE_SHORT, LIGHT_PULSE_SHORT, 9)
+			     && light_add_pulses(&program, LIGHT_PULSE_CONFIRM, LIGHT_PULSE_END, 1);
+			break;
+
+		case LIGHT_TYPE_PIN:
+			ok = light_add_pin(&program, str, len);
+			break;
+
+		default:
+			ok = light_add_pattern(&program, &str[n], len - n);
+			break;
+	}
+	if (ok == false)
+	{
+		light_debug_print("%s: Invalid %s command '%.*s'\n", __FUNCTION__, light_type_str[type], len, str);
+		return;
+	}
+
+	if (xQueueSend(light_queue, &program, 0) != pdTRUE)
+	{
+		light_debug_print("%s: Queue full, %s dropped\n", __FUNCTION__, light_type_str[type]);
+		return;
+	}
+	light_debug_print("%s: Queued %s, %u edges\n", __FUNCTION__, light_type_str[type], program.count);
+
+	// Idle timer is started, a running one takes the command after current one.
+	// Last use is updated here too, both tasks may call in.
+	taskENTER_CRITICAL();
+	light_used = true;
+	light_last = now;
+	if (light_running == false)
+	{
+		light_running = true;
+		light_edge = light_current.count;
+		timer_set_load(FRC1, LIGHT_TIMER_START);
+		timer_set_run(FRC1, true);
+	}
+	taskEXIT_CRITICAL();
 }
 
 
 
-static void light_pulse(uint32_t on, uint32_t off, uint8_t count)
+static bool light_add_pulses(light_program_t* program, uint16_t on, uint16_t off, uint8_t count)
 {
 	uint8_t n;
-	
+
+	if ((program->count & 1) != 0) return false;		// Must follow an off edge
+	if (program->count + (count * 2) > LIGHT_EDGES_MAX) return false;
 	for (n=0; n<count; n++)
 	{
-		gpio_write(LIGHT_PIN, false);	// inverted logic
-		vTaskDelay(on / portTICK_PERIOD_MS);
-		gpio_write(LIGHT_PIN, true);	// inverted logic
-		vTaskDelay(off / portTICK_PERIOD_MS);
+		program->ms[program->count++] = on;
+		program->ms[program->count++] = off;
 	}
+	return true;
 }
 
 
-void light_task( void *pvParameters )
+
+// Extends last off edge, or adds one
+static bool light_add_off(light_program_t* program, uint16_t off)
+{
+	uint32_t ms;
+
+	if ((program->count > 0) && ((program->count & 1) == 0))
+	{
+		ms = program->ms[program->count - 1] + off;
+		program->ms[program->count - 1] = (ms > LIGHT_PULSE_MAX) ? LIGHT_PULSE_MAX : ms;
+		return true;
+	}
+	if ((program->count & 1) == 0) return light_add_pulses(program, 0, off, 1);
+	if (program->count >= LIGHT_EDGES_MAX) return false;
+	program->ms[program->count++] = off;
+	return true;
+}
+
+
+
+// "pin 1234", every digit as count of pulses followed by a pause
+static bool light_add_pin(light_program_t* program, const char* str, size_t len)
 {
-	light_type_t type = (light_type_t)pvParameters;
-	uint32_t time;
 	uint8_t n;
 
-	// Display test is done on first pulse, when longer time no input
-	time = WDEV.SYS_TIME;
-	if ((display_test_timeout == 0) || (time > display_test_timeout))
+	if (len != 8) return false;
+	for (n=0; n<4; n++)
 	{
-		light_pulse(LIGHT_PULSE_SHORT, LIGHT_PULSE_START, 1);
+		if ((str[n+4] < '0') || (str[n+4] > '9')) return false;
 	}
-	// Reset timeout
-	display_test_timeout = time + LIGHT_DISPLAY_TEST_TIMEOUT;
-	
-	switch (type)
+	for (n=0; n<4; n++)
 	{
-		case LIGHT_TYPE_INFO:
-			light_pulse(LIGHT_PULSE_SHORT, LIGHT_PULSE_SHORT, 9);
-			light_pulse(LIGHT_PULSE_CONFIRM, 10000, 1);
-			break;
-			
-		case LIGHT_TYPE_PIN:
-			for (n=0; n<4; n++)
+		if (light_add_pulses(program, LIGHT_PULSE_SHORT, LIGHT_PULSE_SHORT, str[n+4] - '0') == false) return false;
+		if (light_add_off(program, LIGHT_PULSE_PIN_WAIT) == false) return false;
+	}
+	return true;
+}
+
+
+
+// "pattern 120,120,120,5500" in ms, starting with on and alternating.
+// Ends with off, so a command queued next is kept apart.
+static bool light_add_pattern(light_program_t* program, const char* str, size_t len)
+{
+	uint32_t ms = 0;
+	uint8_t first = program->count;
+	bool number = false;
+	size_t n;
+
+	// Payload is not terminated, so numbers are parsed here
+	for (n=0; n<=len; n++)
+	{
+		if ((n < len) && (str[n] >= '0') && (str[n] <= '9'))
+		{
+			ms = (ms * 10) + (str[n] - '0');
+			if (ms > LIGHT_PULSE_MAX) return false;
+			number = true;
+			continue;
+		}
+		if ((n < len) && (str[n] != ' ') && (str[n] != ',') && (str[n] != ':')) return false;
+		if (number == false) continue;
+		if (program->count >= LIGHT_EDGES_MAX) return false;
+		program->ms[program->count++] = ms;
+		ms = 0;
+		number = false;
+	}
+	if (program->count == first) return false;
+	if ((program->count & 1) != 0) return light_add_off(program, LIGHT_PULSE_SHORT);
+	return true;
+}
+
+
+
+// FRC1 interrupt at end of every edge: Output next edge and load its time.
+// Takes next command from queue at end of a program, stops timer when there is none.
+static IRAM void light_timer_handler(void *arg)
+{
+	long int xHigherPriorityTaskWoken = pdFALSE;
+
+	trace_isr(TRACE_IRQ_LIGHT);
+	while (1)
+	{
+		if (light_edge >= light_current.count)
+		{
+			if (xQueueReceiveFromISR(light_queue, &light_current, &xHigherPriorityTaskWoken) == pdFALSE)
 			{
-				light_pulse(LIGHT_PULSE_SHORT, LIGHT_PULSE_SHORT, Pin[n] );
-				vTaskDelay(LIGHT_PULSE_PIN_WAIT / portTICK_PERIOD_MS);
+				gpio_write(LIGHT_PIN, true);	// inverted logic
+				timer_set_run(FRC1, false);
+				light_running = false;
+				break;
 			}
+			light_edge = 0;
+		}
+		if (light_current.ms[light_edge] != 0)
+		{
+			gpio_write(LIGHT_PIN, (light_edge & 1) != 0);	// inverted logic, even edges are on
+			timer_set_load(FRC1, LIGHT_TIMER_TICKS(light_current.ms[light_edge]));
+			light_edge++;
 			break;
-		
-		default:
-			light_debug_print("%s: Invalid type\n", __FUNCTION__);
-			return;
+		}
+		light_edge++;
 	}
-
-	light_debug_print("%s: Finished output\n", __FUNCTION__);
-	vTaskDelay(10);
-	light_task_handle = NULL;
-	vTaskDelete( NULL );		// remove this task
+	if(xHigherPriorityTaskWoken) portYIELD();
 }
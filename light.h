@@ -14,8 +14,9 @@
 #define LIGHT_PIN									2		// PIN where Cathode is connected							
 #define LIGHT_IOMUX								IOMUX_GPIO2_FUNC_GPIO
 
-#define LIGHT_TASK_PRIORITY     	5
-#define LIGHT_TASK_STACK					100
+// Commands waiting while one is output. Each is a compiled program of LIGHT_EDGES_MAX * 2 bytes.
+#define LIGHT_QUEUE_SIZE					3
+#define LIGHT_EDGES_MAX						80		// PIN with all digits 9 and display test needs 74
 
 
 bool light_init( void );
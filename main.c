@@ -12,8 +12,16 @@
 #include "mqtt.h"
 #include "debug.h"
 #include "rboot-ota/ota-tftp.h"
+#include "rboot-ota/ota-http.h"
 #include "sml_server.h"
 #include "light.h"
+#include "diag.h"
+#include "sleep.h"
+#include "ota.h"
+#include "probe.h"
+#include "unlock.h"
+#include "trace.h"
+#include "boot.h"
 
 //*****************************************************************************
 // Configuration
@@ -21,6 +29,17 @@
 
 #define DEBUG
 
+// Bytes of all task stacks, one per xTaskCreate() including short lived and
+// mutually exclusive ones, checked at compile time. It is the target, cut stacks
+// to fit instead of raising it. Static RAM is listed by 'make ram-report'.
+#define TASK_STACK_BUDGET					(24 * 1024)
+
+_Static_assert( (UART_TASK_STACK + MQTT_TASK_STACK + WIFI_INIT_TASK_STACK + SLEEP_TASK_STACK +
+                 DIAG_TASK_STACK + OTA_TASK_STACK + UNLOCK_TASK_STACK + OTA_TFTP_TASK_STACK +
+                 OTA_TFTP_PREERASE_STACK + OTA_HTTP_TASK_STACK + configTIMER_TASK_STACK_DEPTH +
+                 configMINIMAL_STACK_SIZE + TCPIP_THREAD_STACKSIZE) * sizeof(StackType_t) <= TASK_STACK_BUDGET,
+                "Task stacks exceed TASK_STACK_BUDGET" );
+
 
 //*****************************************************************************
 // Local function prototypes
@@ -59,23 +78,22 @@ static void wifi_init_callback( void )
 		main_debug_print( "%s: *** TFTP server init failed ***\n", __FUNCTION__ );
 	}
 	
-	main_debug_print( "%s: Init MQTT\n", __FUNCTION__ );
-	success = mqtt_init();
+	main_debug_print( "%s: Init diagnostics\n", __FUNCTION__ );
+	success = diag_init();
+	if (success == false)
+	{	
+		main_debug_print( "%s: *** Diagnostics init failed ***\n", __FUNCTION__ );
+	}
+
+	main_debug_print( "%s: Init sleep policy\n", __FUNCTION__ );
+	success = sleep_init();
 	if (success == false)
 	{	
-		main_debug_print( "%s: *** Mqtt init failed ***\n", __FUNCTION__ );
+		main_debug_print( "%s: *** Sleep policy init failed ***\n", __FUNCTION__ );
 	}
 }	
 	
 
-enum sleep_type {
-    NONE_SLEEP_T    = 0,
-    LIGHT_SLEEP_T,
-    MODEM_SLEEP_T
-};
-
-void wifi_fpm_set_sleep_type(enum sleep_type type);
- 
 void user_init(void)
 {
 	bool success;
@@ -87,9 +105,14 @@ void user_init(void)
 	//uart_set_parity_enabled(0, true);
 
 	debug_init();
+	probe_init();
+	#ifdef INCLUDE_TRACE
+		trace_init();
+	#endif
 
-	// Wait some time to allow user to  connect and see initalization over uart debugging
-	for( int16_t i=0; i<4000; i++) sdk_os_delay_us(1000);		
+	// Meter sends every few seconds, so UART receives before anything else is started.
+	// Output until debug client connects is kept by debug, see DEBUG_EARLY_LOG.
+	success = sml_server_init();
 	
 	#ifdef DEBUG
 		debug_print( "\n\n\n" );		// Some new lines after boot to see restart	
@@ -99,29 +122,49 @@ void user_init(void)
 		//stats_print_sysparams();
 		ota_print_info();
 	#endif	
-		
+
+	if (success == false)
+	{	
+		main_debug_print( "%s: SML init failed\n", __FUNCTION__ );
+	}
+
+	main_debug_print( "%s: *** Light init ***\n", __FUNCTION__ );
+	success = light_init();
+	if (success == false)
+	{	
+		main_debug_print( "%s: Light init failed\n", __FUNCTION__ );
+	}
+
+	main_debug_print( "%s: *** Meter unlock ***\n", __FUNCTION__ );
+	success = unlock_init();
+	if (success == false)
+	{	
+		main_debug_print( "%s: Meter unlock init failed\n", __FUNCTION__ );
+	}
+
 	main_debug_print( "%s: *** Initializing WIFI ***\n", __FUNCTION__ );
 	success = wifi_init(wifi_init_callback);
 	if (success == false)
 	{	
 		main_debug_print( "%s: WIFI Init failed\n", __FUNCTION__ );
 	}
-		
 
-	main_debug_print( "%s: *** Initializing SML handler ***\n", __FUNCTION__ );
-	success = sml_server_init();
+	// Task waits for IP itself, so it connects to broker as soon as wifi is up
+	main_debug_print( "%s: *** Initializing MQTT ***\n", __FUNCTION__ );
+	success = mqtt_init();
 	if (success == false)
 	{	
-		main_debug_print( "%s: SML init failed\n", __FUNCTION__ );
+		main_debug_print( "%s: Mqtt init failed\n", __FUNCTION__ );
 	}
 
-	main_debug_print( "%s: *** Light init ***\n", __FUNCTION__ );
-	success = light_init();
+	main_debug_print( "%s: *** OTA confirmation ***\n", __FUNCTION__ );
+	success = ota_confirm_init();
 	if (success == false)
 	{	
-		main_debug_print( "%s: Light init failed\n", __FUNCTION__ );
+		main_debug_print( "%s: OTA confirmation init failed\n", __FUNCTION__ );
 	}
 	
+	boot_mark( BOOT_INIT );
 	main_debug_print( "%s: User init finished\n", __FUNCTION__ );
 	main_debug_print( "%s: Free heap memory: %d\n", __FUNCTION__, sdk_system_get_free_heap_size() );
 }
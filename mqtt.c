@@ -15,6 +15,9 @@
 #include "wifi.h"
 //#include "watchdog.h"
 #include "light.h"
+#include "probe.h"
+#include "boot.h"
+#include "rboot-ota/ota-http.h"
 #ifdef MQTT_DEBUG
 	#include "debug.h"
 #endif
@@ -26,8 +29,8 @@
 
 typedef struct
 {
-	uint8_t				Buf[100];
-	uint8_t				ReadBuf[100];
+	uint8_t				Buf[MQTT_BUF_SIZE];
+	uint8_t				ReadBuf[MQTT_READ_BUF_SIZE];
 	char					ClientId[20];
 	int						Port;
 	char					Host[20];
@@ -38,6 +41,7 @@ typedef struct
 
 Mqtt_t* Mqtt = NULL;
 xTaskHandle mqtt_task_handle = NULL;
+static uint32_t mqtt_error_count = 0;
 
 
 
@@ -47,6 +51,8 @@ xTaskHandle mqtt_task_handle = NULL;
 
 static void light_message_received(mqtt_message_data_t *md);
 static void watchdog_message_received(mqtt_message_data_t *md);
+static void probe_message_received(mqtt_message_data_t *md);
+static void ota_message_received(mqtt_message_data_t *md);
 static void mqtt_task(void *pvParameters);
 static char* mqtt_make_topic( const char* name );
 
@@ -96,7 +102,7 @@ bool mqtt_init( void )
 	}
 	
 	mqtt_debug_print( "%s: Creating task\n", __FUNCTION__ );
-	ret = xTaskCreate( &mqtt_task, "mqtt", 500, NULL, 4, &mqtt_task_handle );
+	ret = xTaskCreate( &mqtt_task, "mqtt", MQTT_TASK_STACK, NULL, MQTT_TASK_PRIORITY, &mqtt_task_handle );
 	if( (ret != pdPASS) || (mqtt_task_handle == NULL) )
 	{
 		vPortFree( Mqtt );
@@ -127,6 +133,14 @@ bool mqtt_is_connected( void )
 
 
 
+// Number of failed publishes since boot
+uint32_t mqtt_errors( void )
+{
+	return mqtt_error_count;
+}
+
+
+
 bool mqtt_pub( const char* topic, const char* format, ... ) 
 {
 	uint16_t	payload_len;
@@ -164,15 +178,18 @@ bool mqtt_pub( const char* topic, const char* format, ... )
 		return false;
 	}
 
+	// Argument list is used up after first pass, so it is started again for second
 	va_start( arglist, format );
 	payload_len = vsnprintf( NULL, 0, format, arglist ); 	
+	va_end( arglist );
 	msg->payload = pvPortMalloc( payload_len+1 );
 	if( msg->payload != NULL )
 	{
+		va_start( arglist, format );
 		vsprintf( msg->payload, format, arglist ); 
+		va_end( arglist );
 		msg->payload_len = payload_len;
 	}
-	va_end( arglist );
 
 	if( msg->payload == NULL )
 	{
@@ -183,6 +200,7 @@ bool mqtt_pub( const char* topic, const char* format, ... )
 	}
 	
 	mqtt_debug_print( "%s: Message to queue '%s'='%s'\n", __FUNCTION__, msg->topic, msg->payload );
+	msg->queued = probe_now();
 	if( xQueueSend(Mqtt->PublishQueue, (void *)&msg, 0) == pdFALSE )
 	{
 		mqtt_debug_print( "%s: Queue overflow\n", __FUNCTION__ );
@@ -237,11 +255,17 @@ static void mqtt_task( void *pvParameters )
 	char*												lwt_topic;
 	char*												light_topic;
 	char*												watchdog_topic;
+	char*												probe_topic;
+	char*												ota_topic;
+	uint32_t										probe_start;
 	bool												reconnect;
+	bool												failed = false;
 
 	lwt_topic = mqtt_make_topic( "Status" ); // last will
 	light_topic = mqtt_make_topic( "Remote/Light" );
 	watchdog_topic = mqtt_make_topic( "Remote/Watchdog" );
+	probe_topic = mqtt_make_topic( "Remote/Probe" );
+	ota_topic = mqtt_make_topic( "Remote/Ota" );
 
 	#ifdef MQTT_HOST
 		strcpy(Mqtt->Host, MQTT_HOST);	
@@ -258,16 +282,12 @@ static void mqtt_task( void *pvParameters )
 	while(1) 
 	{
 		reconnect = false;
-			
-		vTaskDelay( 2000 / portTICK_RATE_MS );
+		if( failed == true ) vTaskDelay( MQTT_RETRY_DELAY / portTICK_RATE_MS );
+		failed = true;
+
+		// Block until wifi has an IP, reconnect starts as soon as it is back
+		wifi_wait( WIFI_EVENT_GOT_IP, portMAX_DELAY );
 		mqtt_debug_print( "%s: (Re)connecting to MQTT server ... ", __FUNCTION__ );
-		   
-		ret = sdk_wifi_station_get_connect_status();
-		if( ret != STATION_GOT_IP )
-		{
-			mqtt_debug_print( "error wlan (%d)\n", ret );
-			continue;
-		}
 		 
 		#ifndef MQTT_HOST
 			ret = sdk_wifi_get_ip_info(STATION_IF, &info);
@@ -311,6 +331,7 @@ static void mqtt_task( void *pvParameters )
 			continue;
 		}
 		mqtt_debug_print( "done\n" );
+		failed = false;
 
 		if( light_topic != NULL )
 		{
@@ -330,12 +351,32 @@ static void mqtt_task( void *pvParameters )
 			}
 		}
 
+		if( probe_topic != NULL )
+		{
+			ret = mqtt_subscribe( &Mqtt->Client, probe_topic, MQTT_QOS1, probe_message_received );
+			if ( ret == MQTT_FAILURE )
+			{
+				mqtt_debug_print( "%s: Failed to subscribe '%s'\n", __FUNCTION__, probe_topic );
+			}
+		}
+
+		if( ota_topic != NULL )
+		{
+			ret = mqtt_subscribe( &Mqtt->Client, ota_topic, MQTT_QOS1, ota_message_received );
+			if ( ret == MQTT_FAILURE )
+			{
+				mqtt_debug_print( "%s: Failed to subscribe '%s'\n", __FUNCTION__, ota_topic );
+			}
+		}
+
 		xQueueReset( Mqtt->PublishQueue );
 		
 		ret = mqtt_pub( "Status", "Online" ); 
 		if( ret == false ) continue;
 		ret = mqtt_pub( "Build", __DATE__ " " __TIME__ ); 
 		if( ret == false ) continue;
+		// Boot phases are published once, see boot.c
+		boot_mark( BOOT_MQTT );
 		wifi_pub_stations();		
 
 		while(1)
@@ -349,14 +390,18 @@ static void mqtt_task( void *pvParameters )
 					break; 
 				}
 				mqtt_debug_print( "%s: got message '%s' to publish\n", __FUNCTION__, msg->topic );
+				probe_record( PROBE_QUEUE, msg->queued );
 				mqtt_message_t message;
 				message.payload = msg->payload;
 				message.payloadlen = msg->payload_len;
 				message.dup = 0;
 				message.qos = MQTT_QOS1;
 				message.retained = 0;
+				probe_start = probe_now();
 				ret = mqtt_publish( &Mqtt->Client, msg->topic, &message );
+				probe_record( PROBE_SEND, probe_start );
 				if (ret != MQTT_SUCCESS ){
+					mqtt_error_count++;
 					mqtt_debug_print( "%s: Error while publishing message (%d)\n", __FUNCTION__, ret );
 				}
 				vPortFree( msg->topic );
@@ -369,6 +414,8 @@ static void mqtt_task( void *pvParameters )
 			
 			ret = mqtt_yield( &Mqtt->Client, 1000 );
 			if( ret == MQTT_DISCONNECTED ) break;
+			// Don't wait for keep alive timeout when wifi is already gone
+			if( wifi_wait(WIFI_EVENT_GOT_IP, 0) == 0 ) break;
 		}
 		mqtt_debug_print( "%s: Connection dropped, request restart\n\r", __FUNCTION__ );
 		mqtt_network_disconnect(&network);
@@ -387,10 +434,34 @@ static void light_message_received( mqtt_message_data_t *md )
 }
 
 static void watchdog_message_received( mqtt_message_data_t *md )
+{
+	mqtt_debug_print( "%s: received watchdog message '%.*s'\n", __FUNCTION__, md->message->payloadlen, md->message->payload );
+//	watchdog_set_msg( md->message->payload, md->message->payloadlen );
+}
+
+static void probe_message_received( mqtt_message_data_t *md )
 {
 	mqtt_message_t *message = md->message;
 
-	mqtt_debug_print( "%s: received watchdog message '%.*s'\n", __FUNCTION__, message->payloadlen, message->payload );
-//	watchdog_set_msg( message->payload, message->payloadlen );
+	mqtt_debug_print( "%s: received probe message '%.*s'\n", __FUNCTION__, message->payloadlen, message->payload );
+	if( (message->payloadlen == 5) && (strncmp(message->payload, "reset", 5) == 0) )
+	{
+		probe_reset();
+	}
+	else
+	{
+		probe_pub();
+	}
 }
 
+// Same topic for all meters, payload is update server or empty for default
+static void ota_message_received( mqtt_message_data_t *md )
+{
+	mqtt_message_t *message = md->message;
+
+	mqtt_debug_print( "%s: received ota message '%.*s'\n", __FUNCTION__, message->payloadlen, message->payload );
+	if( ota_http_start(message->payload, message->payloadlen) == false )
+	{
+		mqtt_pub( "Status/Ota", "{\"result\":\"rejected\"}" );
+	}
+}
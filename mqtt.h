@@ -15,7 +15,13 @@
 
 #define MQTT_TOPIC_MAIN 							"OpenWay"
 
+#define MQTT_TASK_PRIORITY						4
+#define MQTT_TASK_STACK								500
+
 #define MQTT_PUBLISH_QUEUE_SIZE				10
+#define MQTT_BUF_SIZE									1024		// Send buffer, limits topic + payload length (wifi station list needs ~800)
+#define MQTT_READ_BUF_SIZE						100
+#define MQTT_RETRY_DELAY							2000		// ms, after failed connect
 
 
 
@@ -27,6 +33,7 @@ typedef struct {
 	char* topic;
 	char* payload;
 	uint16_t payload_len;
+	uint32_t queued;						// CCOUNT when put to queue
 } mqtt_msg;
 
 extern xTaskHandle mqtt_task_handle;
@@ -40,6 +47,7 @@ void mqtt_deinit( void );
 bool mqtt_pub( const char* topic, const char* payload, ... );
 bool mqtt_reconnect( void );
 bool mqtt_is_connected( void );
+uint32_t mqtt_errors( void );
 
 
 #endif /* MQTT_H_ */
@@ -0,0 +1,235 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include "espressif/esp_common.h"
+
+#include "ota.h"
+#include "mqtt.h"
+#include "sml_server.h"
+#include "rboot-ota/rboot-api.h"
+#ifdef OTA_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+xTaskHandle ota_task_handle = NULL;
+static volatile bool ota_slot_claimed = false;
+
+_Static_assert( OTA_RTC_BLOCK >= RBOOT_RTC_ADDR + ((sizeof(rboot_rtc_data) + 3) / 4), "OTA_RTC_BLOCK overlaps RTC data of rboot" );
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void ota_confirm_task( void *pvParameters );
+static void ota_rollback_task( void *pvParameters );
+static bool ota_healthy( void );
+static bool ota_trial_get( uint8_t* slot );
+static void ota_trial_clear( void );
+
+#ifdef OTA_DEBUG
+	#define ota_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define ota_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// After a rollback the previous image boots in standard mode again. Only the own trial
+// marker then still names the failed slot, rboot rewrites its data on each boot.
+// Called before wifi is up, so a trial image which never connects falls back too.
+bool ota_confirm_init( void )
+{
+	rboot_rtc_data rtc;
+	rboot_config conf = rboot_get_config();
+	TaskFunction_t task;
+	uint8_t slot;
+
+	if( ota_task_handle != NULL ) return false;
+	if( rboot_get_rtc_data(&rtc) == false )
+	{
+		// Power on, no OTA in progress
+		ota_trial_clear();
+		return true;
+	}
+
+	if( ota_on_trial() == true )
+	{
+		ota_debug_print( "%s: Slot %d on trial, checking health for %ds\n", __FUNCTION__, rtc.last_rom, OTA_CONFIRM_TIMEOUT );
+		task = ota_confirm_task;
+	}
+	else if( (ota_trial_get(&slot) == true) && (slot != conf.current_rom) )
+	{
+		ota_debug_print( "%s: Slot %d failed on trial, rolled back to %d\n", __FUNCTION__, slot, conf.current_rom );
+		task = ota_rollback_task;
+	}
+	else
+	{
+		ota_trial_clear();
+		return true;
+	}
+
+	xTaskCreate( task, "ota", OTA_TASK_STACK, NULL, OTA_TASK_PRIORITY, &ota_task_handle );
+	if( ota_task_handle == NULL )
+	{
+		ota_debug_print( "%s: Error creating task\n", __FUNCTION__ );
+		return false;
+	}
+	return true;
+}
+
+
+
+static void ota_confirm_task( void *pvParameters )
+{
+	rboot_rtc_data rtc;
+	uint32_t elapsed;
+	bool ret;
+
+	rboot_get_rtc_data( &rtc );
+	for( elapsed=0; elapsed < OTA_CONFIRM_TIMEOUT; elapsed += OTA_CONFIRM_POLL )
+	{
+		if( ota_healthy() == true ) break;
+		vTaskDelay( ((int32_t)OTA_CONFIRM_POLL * 1000) / portTICK_RATE_MS );
+	}
+
+	if( elapsed >= OTA_CONFIRM_TIMEOUT )
+	{
+		// Config still points to previous image, so a restart is the rollback
+		ota_debug_print( "%s: Health check failed, restarting into previous image\n", __FUNCTION__ );
+		sdk_system_restart();
+	}
+
+	vPortEnterCritical();
+	ret = rboot_set_current_rom( rtc.last_rom );
+	vPortExitCritical();
+	ota_debug_print( "%s: Slot %d confirmed after %ds (%s)\n", __FUNCTION__, rtc.last_rom, elapsed, ret ? "OK" : "Failed" );
+	if( ret == true )
+	{
+		mqtt_pub( "Status/Ota", "{\"result\":\"confirmed\",\"slot\":%u,\"time\":%u}", rtc.last_rom, elapsed );
+		// Keep rollback detection quiet after a later restart
+		ota_trial_clear();
+	}
+	else
+	{
+		mqtt_pub( "Status/Ota", "{\"result\":\"error\",\"slot\":%u}", rtc.last_rom );
+	}
+
+	ota_task_handle = NULL;
+	vTaskDelete( NULL );
+}
+
+
+
+// Report rollback as soon as broker is reachable
+static void ota_rollback_task( void *pvParameters )
+{
+	rboot_config conf = rboot_get_config();
+	uint8_t slot = 0;
+
+	while( mqtt_is_connected() == false )
+	{
+		vTaskDelay( ((int32_t)OTA_CONFIRM_POLL * 1000) / portTICK_RATE_MS );
+	}
+
+	ota_trial_get( &slot );
+	mqtt_pub( "Status/Ota", "{\"result\":\"rollback\",\"failed\":%u,\"slot\":%u}", slot, conf.current_rom );
+	ota_trial_clear();			// Report only once
+
+	ota_task_handle = NULL;
+	vTaskDelete( NULL );
+}
+
+
+
+// rboot adds MODE_TEMP_ROM to last_mode in its RTC data when it booted the temporary
+// slot, which then is last_rom. Config still names the previous image until the confirm
+// task makes the new one current, mode stays until next boot.
+bool ota_on_trial( void )
+{
+	rboot_rtc_data rtc;
+
+	if( rboot_get_rtc_data(&rtc) == false ) return false;
+	return ((rtc.last_mode & MODE_TEMP_ROM) != 0) && (rtc.last_rom != rboot_get_config().current_rom);
+}
+
+
+
+bool ota_slot_claim( uint32_t wait_ms )
+{
+	TickType_t start = xTaskGetTickCount();
+	bool claimed;
+
+	for( ;; )
+	{
+		vPortEnterCritical();
+		claimed = (ota_slot_claimed == false);
+		ota_slot_claimed = true;
+		vPortExitCritical();
+		if( claimed == true ) return true;
+		if( (xTaskGetTickCount() - start) >= (wait_ms / portTICK_RATE_MS) ) return false;
+		vTaskDelay( 1 );
+	}
+}
+
+
+
+void ota_slot_release( void )
+{
+	ota_slot_claimed = false;
+}
+
+
+
+bool ota_trial_mark( uint8_t slot )
+{
+	uint32_t marker = OTA_TRIAL_MAGIC | slot;
+
+	return sdk_system_rtc_mem_write( OTA_RTC_BLOCK, &marker, sizeof(marker) );
+}
+
+
+
+// False without marker, also on power on when RTC memory holds random data
+static bool ota_trial_get( uint8_t* slot )
+{
+	uint32_t marker;
+
+	if( sdk_system_rtc_mem_read(OTA_RTC_BLOCK, &marker, sizeof(marker)) == false ) return false;
+	if( (marker & 0xffffff00) != OTA_TRIAL_MAGIC ) return false;
+	*slot = marker & 0xff;
+	return true;
+}
+
+
+
+static void ota_trial_clear( void )
+{
+	uint32_t marker = 0;
+
+	sdk_system_rtc_mem_write( OTA_RTC_BLOCK, &marker, sizeof(marker) );
+}
+
+
+
+// Image is good when it reaches the broker and still parses meter data
+static bool ota_healthy( void )
+{
+	#ifdef OTA_CONFIRM_FRAMES
+		sml_stats_t stats;
+
+		sml_server_stats( &stats );
+		if( stats.frames < OTA_CONFIRM_FRAMES ) return false;
+	#endif
+	return mqtt_is_connected();
+}
@@ -0,0 +1,54 @@
+#ifndef OTA_H_
+#define OTA_H_
+
+#include "stdbool.h"
+#include "stdint.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define OTA_DEBUG
+
+#define OTA_TASK_PRIORITY							1
+#define OTA_TASK_STACK								400
+
+// New image booted in temporary mode needs to pass the health check within this time,
+// otherwise it restarts into the previous image
+#define OTA_CONFIRM_TIMEOUT						300		// s
+#define OTA_CONFIRM_FRAMES						3			// Valid SML frames, comment to not require meter
+#define OTA_CONFIRM_POLL							1			// s
+
+// Own marker of the slot on trial in RTC user memory, behind data of rboot. rboot rewrites
+// its RTC data on each boot, so its temp_rom can't tell whether a trial failed.
+#define OTA_RTC_BLOCK									96		// 4 byte blocks, user memory starts at 64
+#define OTA_TRIAL_MAGIC								0x07a11a00		// Low byte holds slot
+
+// Size of each rboot slot, two slots of 1 MB (see FLASH_SIZE in Makefile). Limit for TFTP and HTTP images.
+#define OTA_SLOT_SIZE									0x100000
+// ms a writer waits for the slot, covers a sector erase of the background pre-erase
+#define OTA_SLOT_WAIT									500
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+// Starts health check when running on trial after OTA, reports rollback of previous trial
+bool ota_confirm_init( void );
+// Call next to rboot_set_temp_rom(), so a failed trial is reported after rollback
+bool ota_trial_mark( uint8_t slot );
+// True while a new image runs on trial and is not confirmed yet
+bool ota_on_trial( void );
+// Inactive slot is written by one of TFTP, HTTP or pre-erase at a time. Claim before
+// the first write, release on every exit which doesn't restart. False when taken.
+bool ota_slot_claim( uint32_t wait_ms );
+void ota_slot_release( void );
+
+
+
+#endif // OTA_H_
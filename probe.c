@@ -0,0 +1,180 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "probe.h"
+#include "mqtt.h"
+#include "debug.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+typedef struct
+{
+	uint32_t	count;
+	uint32_t	min;
+	uint32_t	max;
+	uint64_t	sum;
+	uint32_t	bucket[PROBE_BUCKETS];
+} probe_hist_t;
+
+
+static const char* const probe_stage_str[PROBE_COUNT] =
+{
+	[PROBE_UART_WAKEUP]	= "Wakeup",
+	[PROBE_FRAME]				= "Frame",
+	[PROBE_PARSE]				= "Parse",
+	[PROBE_QUEUE]				= "Queue",
+	[PROBE_SEND]				= "Send"
+};
+
+static probe_hist_t probe_hist[PROBE_COUNT];
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void probe_command( const char* args );
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+bool probe_init( void )
+{
+	probe_reset();
+	return debug_add_command( "probe", probe_command );
+}
+
+
+
+void probe_reset( void )
+{
+	memset( probe_hist, 0x00, sizeof(probe_hist) );
+	for( uint8_t n=0; n<PROBE_COUNT; n++ ) probe_hist[n].min = UINT32_MAX;
+}
+
+
+
+#ifdef PROBE_ENABLE
+// Stages are written by a single task each, so no locking is done here.
+// A reader might see a sample half done, which doesn't matter for statistics.
+void probe_record( probe_stage_t stage, uint32_t start )
+{
+	probe_hist_t* hist = &probe_hist[stage];
+	uint32_t cycles = probe_now() - start;				// Unsigned arithmetic handles CCOUNT wrap
+	uint8_t bucket = (cycles == 0) ? 0 : (31 - __builtin_clz(cycles));
+
+	hist->bucket[bucket]++;
+	hist->count++;
+	hist->sum += cycles;
+	if( cycles < hist->min ) hist->min = cycles;
+	if( cycles > hist->max ) hist->max = cycles;
+}
+#endif
+
+
+
+// Sample count and sum of cycles for consumers building their own averages
+void probe_get( probe_stage_t stage, uint32_t* count, uint64_t* cycles )
+{
+	taskENTER_CRITICAL();
+	*count = probe_hist[stage].count;
+	*cycles = probe_hist[stage].sum;
+	taskEXIT_CRITICAL();
+}
+
+
+
+// Output to debug port, bucket n holds samples with 2^n <= cycles < 2^(n+1)
+void probe_print( void )
+{
+	probe_hist_t* hist;
+
+	for( uint8_t stage=0; stage<PROBE_COUNT; stage++ )
+	{
+		hist = &probe_hist[stage];
+		if( hist->count == 0 )
+		{
+			debug_print( "%s: no samples\n", probe_stage_str[stage] );
+			continue;
+		}
+		debug_print( "%s: n %u, min %uus, avg %uus, max %uus\n", probe_stage_str[stage], hist->count,
+		             hist->min / PROBE_CYCLES_PER_US, (uint32_t)(hist->sum / hist->count) / PROBE_CYCLES_PER_US,
+		             hist->max / PROBE_CYCLES_PER_US );
+		for( uint8_t n=0; n<PROBE_BUCKETS; n++ )
+		{
+			if( hist->bucket[n] == 0 ) continue;
+			debug_print( DEBUG_INDENT ">=%uus: %u\n", (uint32_t)(1UL << n) / PROBE_CYCLES_PER_US, hist->bucket[n] );
+		}
+	}
+}
+
+
+
+// Publish one message per stage. Histogram is sent from first to last used bucket
+// with 'lo' as index of first bucket: {"n":10,"min":3,"avg":5,"max":9,"lo":7,"h":[1,8,1]}
+void probe_pub( void )
+{
+	probe_hist_t* hist;
+	char topic[20];
+	static char payload[MQTT_BUF_SIZE / 2];		// Caller is mqtt task, its stack holds paho frames already
+	uint8_t lo, hi;
+	size_t len;
+	int ret;
+
+	for( uint8_t stage=0; stage<PROBE_COUNT; stage++ )
+	{
+		hist = &probe_hist[stage];
+		snprintf( topic, sizeof(topic), "Diag/Probe/%s", probe_stage_str[stage] );
+		if( hist->count == 0 )
+		{
+			mqtt_pub( topic, "{\"n\":0}" );
+			continue;
+		}
+
+		for( lo=0; (lo < PROBE_BUCKETS-1) && (hist->bucket[lo] == 0); lo++ );
+		for( hi=PROBE_BUCKETS-1; (hi > lo) && (hist->bucket[hi] == 0); hi-- );
+
+		// Failed formatting counts as too long
+		ret = snprintf( payload, sizeof(payload), "{\"n\":%u,\"min\":%u,\"avg\":%u,\"max\":%u,\"lo\":%u,\"h\":[",
+		                hist->count, hist->min / PROBE_CYCLES_PER_US,
+		                (uint32_t)(hist->sum / hist->count) / PROBE_CYCLES_PER_US,
+		                hist->max / PROBE_CYCLES_PER_US, lo );
+		len = (ret < 0) ? sizeof(payload) : (size_t)ret;
+		for( uint8_t n=lo; (n <= hi) && (len < sizeof(payload)); n++ )
+		{
+			ret = snprintf( &payload[len], sizeof(payload) - len, (n == lo) ? "%u" : ",%u", hist->bucket[n] );
+			len = (ret < 0) ? sizeof(payload) : (len + ret);
+		}
+		if( len >= (sizeof(payload) - 2) )
+		{
+			mqtt_pub( topic, "{\"error\":\"Too long\"}" );
+			continue;
+		}
+		strcpy( &payload[len], "]}" );
+		mqtt_pub( topic, "%s", payload );
+	}
+}
+
+
+
+// Debug port command: 'probe' prints histograms, 'probe reset' clears them
+static void probe_command( const char* args )
+{
+	if( strcmp(args, "reset") == 0 )
+	{
+		probe_reset();
+		debug_print( "Probes cleared\n" );
+		return;
+	}
+	probe_print();
+}
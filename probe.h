@@ -0,0 +1,89 @@
+#ifndef PROBE_H_
+#define PROBE_H_
+
+#include "stdbool.h"
+#include "stdint.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Comment to remove all probes from hot path, probe_now() and probe_record() compile to nothing then
+#define PROBE_ENABLE
+
+#define PROBE_BUCKETS									32			// log2 buckets of CPU cycles, covers complete 32bit range
+#define PROBE_CYCLES_PER_US						80
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+// Each stage is the time between two probe points on way from meter byte to broker
+typedef enum
+{
+	PROBE_UART_WAKEUP,				// uart0_rx_handler() entry -> uart task reads byte
+	PROBE_FRAME,							// start sequence -> end sequence in sml_transport_read()
+	PROBE_PARSE,							// sml_file_parse() start -> end
+	PROBE_QUEUE,							// mqtt_pub() enqueue -> taken from queue in mqtt_task
+	PROBE_SEND,								// mqtt_publish() on the wire
+	PROBE_COUNT
+} probe_stage_t;
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+#ifndef PROBE_ENABLE
+// Empty inlines instead of macros, so start variables at call sites stay used
+static inline uint32_t probe_now( void )
+{
+	return 0;
+}
+
+static inline void probe_record( probe_stage_t stage, uint32_t start )
+{
+}
+#elif defined(__XTENSA__)
+// Xtensa cycle counter, inline to be usable from IRAM interrupt handler
+static inline uint32_t probe_now( void )
+{
+	uint32_t ccount;
+	__asm__ __volatile__( "rsr %0, ccount" : "=a"(ccount) );
+	return ccount;
+}
+#else
+#include <time.h>
+
+// Host build, monotonic clock scaled to cycles of PROBE_CYCLES_PER_US
+static inline uint32_t probe_now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000 * PROBE_CYCLES_PER_US + (uint64_t)ts.tv_nsec * PROBE_CYCLES_PER_US / 1000);
+}
+#endif
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+bool probe_init( void );
+#ifdef PROBE_ENABLE
+	void probe_record( probe_stage_t stage, uint32_t start );
+#endif
+void probe_get( probe_stage_t stage, uint32_t* count, uint64_t* cycles );
+void probe_print( void );
+void probe_pub( void );
+void probe_reset( void );
+
+
+
+#endif // PROBE_H_
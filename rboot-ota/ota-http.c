@@ -0,0 +1,495 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "lwip/api.h"
+#include <esp/hwrand.h>
+#include <espressif/esp_common.h>
+
+#include "ota-http.h"
+#include "ota-image.h"
+#include "rboot-api.h"
+#include "ota.h"
+#include "mqtt.h"
+#include "wifi.h"
+#ifdef OTA_HTTP_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define OTA_HTTP_VERSION_LEN				32
+#define OTA_HTTP_FILE_LEN						16
+#define OTA_HTTP_REQUEST_LEN				(OTA_HTTP_HOST_LEN + OTA_HTTP_PATH_LEN + OTA_HTTP_FILE_LEN + 80)
+
+typedef enum
+{
+	OTA_HTTP_DONE,							// Server closed connection after complete body
+	OTA_HTTP_DROPPED,						// Network error or timeout, can be resumed
+	OTA_HTTP_FAILED							// Error message in error
+} ota_http_result_t;
+
+typedef struct ota_http ota_http_t;
+typedef bool (*ota_http_body_t)( ota_http_t* http, const uint8_t* data, uint16_t len );
+
+struct ota_http
+{
+	char						host[OTA_HTTP_HOST_LEN];
+	uint16_t				port;
+	char						path[OTA_HTTP_PATH_LEN];			// Starts and ends with '/'
+	// From manifest
+	char						version[OTA_HTTP_VERSION_LEN];
+	char						file[OTA_HTTP_FILE_LEN];
+	uint32_t				size;
+	char						sha256[OTA_IMAGE_SHA256_LEN * 2 + 1];
+	// Transfer of current file
+	ota_image_t*		image;
+	uint32_t				position;				// Bytes of file passed to body handler
+	uint16_t				resumes;
+	char						line[OTA_HTTP_LINE_LEN];
+	uint8_t					line_len;
+	char						manifest[OTA_HTTP_MANIFEST_LEN];
+	uint16_t				manifest_len;
+	const char*			error;
+};
+
+xTaskHandle ota_http_task_handle = NULL;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void ota_http_task( void* pvParameters );
+static bool ota_http_update( ota_http_t* http, uint32_t slot_addr );
+static bool ota_http_parse_server( ota_http_t* http, const char* server, uint16_t len );
+static bool ota_http_parse_manifest( ota_http_t* http );
+static ota_http_result_t ota_http_get( ota_http_t* http, const char* file, ota_http_body_t body );
+static ota_http_result_t ota_http_read( ota_http_t* http, struct netconn* conn, ota_http_body_t body );
+static bool ota_http_manifest_body( ota_http_t* http, const uint8_t* data, uint16_t len );
+static bool ota_http_image_body( ota_http_t* http, const uint8_t* data, uint16_t len );
+
+#ifdef OTA_HTTP_DEBUG
+	#define ota_http_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define ota_http_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Called from mqtt task, so only the server is checked here
+bool ota_http_start( const char* server, uint16_t len )
+{
+	ota_http_t* http;
+
+	// On trial the configured slot holds the image to fall back to.
+	// A TFTP upload is rejected later, when the slot is claimed.
+	if( (ota_http_task_handle != NULL) || (ota_on_trial() == true) )
+	{
+		ota_http_debug_print( "%s: Update running or image on trial\n", __FUNCTION__ );
+		return false;
+	}
+	if( rboot_get_config().count < 2 ) return false;
+
+	http = pvPortMalloc( sizeof(ota_http_t) );
+	if( http == NULL )
+	{
+		ota_http_debug_print( "%s: Error allocating RAM\n", __FUNCTION__ );
+		return false;
+	}
+	memset( http, 0x00, sizeof(ota_http_t) );
+
+	if( ota_http_parse_server(http, server, len) == false )
+	{
+		ota_http_debug_print( "%s: Invalid server '%.*s'\n", __FUNCTION__, len, server );
+		vPortFree( http );
+		return false;
+	}
+
+	xTaskCreate( ota_http_task, "ota_http", OTA_HTTP_TASK_STACK, http, OTA_HTTP_TASK_PRIORITY, &ota_http_task_handle );
+	if( ota_http_task_handle == NULL )
+	{
+		ota_http_debug_print( "%s: Error creating task\n", __FUNCTION__ );
+		vPortFree( http );
+		return false;
+	}
+	return true;
+}
+
+
+
+static void ota_http_task( void* pvParameters )
+{
+	ota_http_t* http = pvParameters;
+	rboot_config conf = rboot_get_config();
+	uint8_t slot = (conf.current_rom + 1) % conf.count;
+	uint32_t start, ms;
+	bool claimed, updated;
+
+	// All meters get the trigger at the same time, don't let them hit the server together
+	vTaskDelay( (hwrand() % (OTA_HTTP_SPREAD * 1000)) / portTICK_RATE_MS );
+
+	ota_http_debug_print( "%s: Update from %s:%u%s to slot %u\n", __FUNCTION__, http->host, http->port, http->path, slot );
+	start = sdk_system_get_time();
+	// Held until restart, so no TFTP upload can write the slot about to be booted
+	claimed = ota_slot_claim( OTA_SLOT_WAIT );
+	if( claimed == false )
+	{
+		http->error = "Other update in progress";
+		updated = false;
+	}
+	else
+	{
+		updated = ota_http_update( http, conf.roms[slot] );
+	}
+	ms = (sdk_system_get_time() - start) / 1000;
+
+	if( updated == true )
+	{
+		ota_http_debug_print( "%s: %s written in %u ms, %u resumes. Booting slot %u on trial\n", __FUNCTION__,
+		                      http->version, ms, http->resumes, slot );
+		mqtt_pub( "Status/Ota", "{\"result\":\"trial\",\"slot\":%u,\"version\":\"%s\",\"time\":%u,\"resumes\":%u}",
+		          slot, http->version, ms, http->resumes );
+		vTaskDelay( 1000 / portTICK_RATE_MS );				// Let mqtt task send result
+		ota_trial_mark( slot );
+		vPortEnterCritical();
+		if( rboot_set_temp_rom(slot) == true ) sdk_system_restart();
+		vPortExitCritical();
+		http->error = "Failed to set rboot slot";
+	}
+
+	if( http->error == NULL )
+	{
+		mqtt_pub( "Status/Ota", "{\"result\":\"current\",\"version\":\"%s\"}", http->version );
+	}
+	else
+	{
+		ota_http_debug_print( "%s: Failed after %u bytes, %u resumes: %s\n", __FUNCTION__, http->position, http->resumes, http->error );
+		mqtt_pub( "Status/Ota", "{\"result\":\"error\",\"error\":\"%s\",\"bytes\":%u,\"resumes\":%u}",
+		          http->error, http->position, http->resumes );
+	}
+
+	if( claimed == true ) ota_slot_release();
+	vPortFree( http );
+	ota_http_task_handle = NULL;
+	vTaskDelete( NULL );
+}
+
+
+
+// Returns true when a verified image is in slot. Otherwise error is set, or it is NULL
+// if the server has the running version.
+static bool ota_http_update( ota_http_t* http, uint32_t slot_addr )
+{
+	ota_http_result_t result;
+	uint32_t len;
+
+	if( ota_http_get(http, OTA_HTTP_MANIFEST, ota_http_manifest_body) != OTA_HTTP_DONE )
+	{
+		if( http->error == NULL ) http->error = "Manifest not loaded";
+		return false;
+	}
+	if( ota_http_parse_manifest(http) == false ) return false;
+	if( strcmp(http->version, FIRMWARE_VERSION) == 0 ) return false;
+
+	len = strlen( http->file );
+	http->image = ota_image_begin( slot_addr, OTA_SLOT_SIZE, (len > 4) && (strcmp(&http->file[len - 4], ".lz4") == 0) );
+	if( http->image == NULL )
+	{
+		http->error = "Out of memory";
+		return false;
+	}
+	#ifdef OTA_IMAGE_SHA256
+		if( http->sha256[0] != '\0' ) ota_image_expect_sha256( http->image, http->sha256 );
+	#endif
+
+	// Image state is kept over reconnects, so a resume continues where data stopped
+	http->position = 0;
+	while( (result = ota_http_get(http, http->file, ota_http_image_body)) == OTA_HTTP_DROPPED )
+	{
+		// Lost after last byte, a Range request would only get an error
+		if( http->position == http->size )
+		{
+			result = OTA_HTTP_DONE;
+			break;
+		}
+		if( http->resumes >= OTA_HTTP_RESUMES ) break;
+		http->resumes++;
+		ota_http_debug_print( "%s: Connection lost at %u bytes, resume %u\n", __FUNCTION__, http->position, http->resumes );
+		vTaskDelay( OTA_HTTP_RESUME_DELAY / portTICK_RATE_MS );
+		wifi_wait( WIFI_EVENT_GOT_IP, OTA_HTTP_WIFI_WAIT / portTICK_RATE_MS );
+	}
+
+	if( result == OTA_HTTP_DROPPED ) http->error = "Connection lost";
+	else if( (result == OTA_HTTP_DONE) && (http->position != http->size) ) http->error = "Size mismatch";
+	else if( result == OTA_HTTP_DONE ) ota_image_finish( http->image, &http->error );
+
+	ota_image_end( http->image );
+	http->image = NULL;
+	return (http->error == NULL);
+}
+
+
+
+// Accepts "[http://]host[:port][/path]", path gets a trailing '/'
+static bool ota_http_parse_server( ota_http_t* http, const char* server, uint16_t len )
+{
+	char buf[OTA_HTTP_HOST_LEN + OTA_HTTP_PATH_LEN + 16];
+	char* p = buf;
+	char* end;
+	size_t n;
+
+	while( (len > 0) && isspace((unsigned char)server[len - 1]) ) len--;
+	if( len == 0 )
+	{
+		server = OTA_HTTP_SERVER;
+		len = strlen( server );
+	}
+	if( len >= sizeof(buf) ) return false;
+	memcpy( buf, server, len );
+	buf[len] = '\0';
+
+	if( strncmp(p, "http://", 7) == 0 ) p += 7;
+	n = strcspn( p, ":/" );
+	if( (n == 0) || (n >= sizeof(http->host)) ) return false;
+	memcpy( http->host, p, n );
+	http->host[n] = '\0';
+	p += n;
+
+	http->port = 80;
+	if( *p == ':' )
+	{
+		http->port = strtoul( p + 1, &end, 10 );
+		if( (http->port == 0) || (end == p + 1) ) return false;
+		p = end;
+	}
+
+	if( *p == '\0' ) p = "/";
+	n = strlen( p );
+	if( (*p != '/') || (n + 2 > sizeof(http->path)) ) return false;
+	strcpy( http->path, p );
+	if( http->path[n - 1] != '/' ) strcat( http->path, "/" );
+	return true;
+}
+
+
+
+static bool ota_http_parse_manifest( ota_http_t* http )
+{
+	char* save;
+	char* line;
+	char* value;
+
+	for( line = strtok_r(http->manifest, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save) )
+	{
+		value = strchr( line, ' ' );
+		if( value == NULL ) continue;
+		*value++ = '\0';
+
+		if( (strcmp(line, "version") == 0) && (strlen(value) < sizeof(http->version)) ) strcpy( http->version, value );
+		else if( (strcmp(line, "file") == 0) && (strlen(value) < sizeof(http->file)) ) strcpy( http->file, value );
+		else if( strcmp(line, "size") == 0 ) http->size = strtoul( value, NULL, 10 );
+		else if( (strcmp(line, "sha256") == 0) && (strlen(value) < sizeof(http->sha256)) ) strcpy( http->sha256, value );
+	}
+
+	if( (http->version[0] == '\0') || (http->file[0] == '\0') || (http->size == 0) )
+	{
+		http->error = "Invalid manifest";
+		return false;
+	}
+	return true;
+}
+
+
+
+// One request on a new connection. With position > 0 only the rest of the file is requested.
+// Servers ignoring Range answer with the whole file, then the known part is skipped.
+static ota_http_result_t ota_http_get( ota_http_t* http, const char* file, ota_http_body_t body )
+{
+	struct netconn* conn;
+	ip_addr_t addr;
+	char request[OTA_HTTP_REQUEST_LEN];
+	ota_http_result_t result = OTA_HTTP_DROPPED;
+	size_t len;
+	int ret;
+
+	if( netconn_gethostbyname(http->host, &addr) != ERR_OK ) return OTA_HTTP_DROPPED;
+	conn = netconn_new( NETCONN_TCP );
+	if( conn == NULL ) return OTA_HTTP_DROPPED;
+	netconn_set_recvtimeout( conn, OTA_HTTP_TIMEOUT );
+
+	// HTTP/1.0 keeps the server from answering chunked, the body is written as received
+	ret = snprintf( request, sizeof(request), "GET %s%s HTTP/1.0\r\nHost: %s\r\n", http->path, file, http->host );
+	len = (ret < 0) ? sizeof(request) : (size_t)ret;
+	if( (http->position > 0) && (len < sizeof(request)) )
+	{
+		ret = snprintf( &request[len], sizeof(request) - len, "Range: bytes=%u-\r\n", http->position );
+		len = (ret < 0) ? sizeof(request) : (len + ret);
+	}
+	if( len < sizeof(request) )
+	{
+		ret = snprintf( &request[len], sizeof(request) - len, "Connection: close\r\n\r\n" );
+		len = (ret < 0) ? sizeof(request) : (len + ret);
+	}
+	if( len >= sizeof(request) )
+	{
+		http->error = "Request too long";
+		netconn_delete( conn );
+		return OTA_HTTP_FAILED;
+	}
+
+	if( (netconn_connect(conn, &addr, http->port) == ERR_OK)
+	    && (netconn_write(conn, request, len, NETCONN_COPY) == ERR_OK) )
+	{
+		result = ota_http_read( http, conn, body );
+	}
+	netconn_close( conn );
+	netconn_delete( conn );
+	return result;
+}
+
+
+
+static ota_http_result_t ota_http_read( ota_http_t* http, struct netconn* conn, ota_http_body_t body )
+{
+	struct netbuf* netbuf;
+	uint8_t* data;
+	uint16_t len, n;
+	int status = 0;
+	uint32_t pos = 0;							// File position of next body byte
+	int32_t end = -1;							// File position after body, if known
+	bool header = true;
+	err_t err;
+
+	http->line_len = 0;
+	while( (err = netconn_recv(conn, &netbuf)) == ERR_OK )
+	{
+		do
+		{
+			netbuf_data( netbuf, (void**)&data, &len );
+
+			// Header lines, only status and ranges are of interest
+			while( (header == true) && (len > 0) )
+			{
+				char c = *data++;
+				len--;
+				if( c == '\r' ) continue;
+				if( c != '\n' )
+				{
+					if( http->line_len < sizeof(http->line) - 1 ) http->line[http->line_len++] = c;
+					continue;
+				}
+				http->line[http->line_len] = '\0';
+
+				if( http->line_len == 0 )
+				{
+					header = false;
+					if( (status != 200) && (status != 206) )
+					{
+						http->error = (status == 404) ? "File not found" : "HTTP error";
+						netbuf_delete( netbuf );
+						return OTA_HTTP_FAILED;
+					}
+					if( status == 200 ) pos = 0;
+					if( (pos > http->position) || ((end >= 0) && (end <= (int32_t)pos)) )
+					{
+						http->error = "Invalid range";
+						netbuf_delete( netbuf );
+						return OTA_HTTP_FAILED;
+					}
+				}
+				else if( status == 0 )
+				{
+					// "HTTP/1.x 200", anything shorter is no status line
+					if( (http->line_len >= 12) && (strncmp(http->line, "HTTP/", 5) == 0) ) status = atoi( &http->line[9] );
+					else status = -1;
+				}
+				else if( (strncasecmp(http->line, "Transfer-Encoding:", 18) == 0) && (strstr(&http->line[18], "chunked") != NULL) )
+				{
+					// Chunk sizes would end up in flash, not expected after a HTTP/1.0 request
+					http->error = "Chunked transfer not supported";
+					netbuf_delete( netbuf );
+					return OTA_HTTP_FAILED;
+				}
+				else if( strncasecmp(http->line, "Content-Length:", 15) == 0 )
+				{
+					end = pos + strtoul( &http->line[15], NULL, 10 );
+				}
+				else if( strncasecmp(http->line, "Content-Range: bytes ", 21) == 0 )
+				{
+					// Length header might come first, keep end relative to start of range
+					uint32_t start = strtoul( &http->line[21], NULL, 10 );
+					if( end >= 0 ) end += start - pos;
+					pos = start;
+				}
+				http->line_len = 0;
+			}
+
+			// Skip part already received, then pass rest to handler
+			n = (http->position - pos < len) ? (http->position - pos) : len;
+			data += n;
+			len -= n;
+			pos += n;
+			if( len > 0 )
+			{
+				if( body(http, data, len) == false )
+				{
+					netbuf_delete( netbuf );
+					return OTA_HTTP_FAILED;
+				}
+				pos += len;
+				http->position = pos;
+			}
+		} while( netbuf_next(netbuf) >= 0 );
+		netbuf_delete( netbuf );
+	}
+
+	// Server closes after response, anything else or a short body is a drop
+	if( (err == ERR_CLSD) && (header == false) && ((end < 0) || ((int32_t)pos >= end)) ) return OTA_HTTP_DONE;
+	return OTA_HTTP_DROPPED;
+}
+
+
+
+static bool ota_http_manifest_body( ota_http_t* http, const uint8_t* data, uint16_t len )
+{
+	if( http->manifest_len + len >= sizeof(http->manifest) )
+	{
+		http->error = "Manifest too long";
+		return false;
+	}
+	memcpy( &http->manifest[http->manifest_len], data, len );
+	http->manifest_len += len;
+	http->manifest[http->manifest_len] = '\0';
+	return true;
+}
+
+
+
+static bool ota_http_image_body( ota_http_t* http, const uint8_t* data, uint16_t len )
+{
+	if( http->position + len > http->size )
+	{
+		http->error = "Image larger than manifest";
+		return false;
+	}
+	if( ota_image_write(http->image, data, len) == false )
+	{
+		http->error = "Flash write failed";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,85 @@
+#ifndef _OTA_HTTP_H
+#define _OTA_HTTP_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* HTTP pull OTA
+ *
+ * Triggered by a message to 'OpenWay/Remote/Ota', which all meters subscribe,
+ * so one publish updates every meter. Payload is the server as
+ * "host[:port][/path/]", empty payload uses OTA_HTTP_SERVER:
+ *   mosquitto_pub -h <broker> -t OpenWay/Remote/Ota -m 192.168.1.10:8000
+ *
+ * Each meter waits a random time up to OTA_HTTP_SPREAD, then fetches
+ * <path>OTA_HTTP_MANIFEST, plain text with one "key value" per line:
+ *   version <FIRMWARE_VERSION of image>
+ *   file main.lz4              (main.bin or main.lz4, see ota-image.h)
+ *   size <bytes of file>
+ *   sha256 <hex>               (optional, checked with OTA_IMAGE_SHA256)
+ * Nothing is done if version matches the running firmware. Otherwise file is
+ * streamed into the inactive slot and checked like a TFTP upload. A dropped
+ * connection is resumed with a Range request after wifi is back.
+ * Progress and result are published to 'OpenWay/Status/Ota', a good image is
+ * booted on trial (ota.h).
+ *
+ * Local stand-in for the server, serves manifest for the built firmware:
+ *   tools/ota_server.py firmware
+ *
+ * IMPORTANT: Plain HTTP is not a secure protocol, only use on trusted networks.
+ */
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define OTA_HTTP_DEBUG
+
+// Set by Makefile from 'git describe', compared with version in manifest
+#ifndef FIRMWARE_VERSION
+	#define FIRMWARE_VERSION					__DATE__ " " __TIME__
+#endif
+
+#define OTA_HTTP_SERVER							"192.168.1.10:8000"		// Used for empty trigger message
+#define OTA_HTTP_MANIFEST						"manifest.txt"
+
+#define OTA_HTTP_SPREAD							30						// s, max random delay before first request
+#define OTA_HTTP_TIMEOUT						10000					// ms, receive timeout before connection is treated as dropped
+#define OTA_HTTP_RESUMES						10						// Range requests after dropped connections
+#define OTA_HTTP_RESUME_DELAY				2000					// ms, between reconnects
+#define OTA_HTTP_WIFI_WAIT					60000					// ms, max wait for wifi before a resume
+
+#define OTA_HTTP_HOST_LEN						32
+#define OTA_HTTP_PATH_LEN						48
+#define OTA_HTTP_LINE_LEN						96						// Longest header or manifest line kept
+#define OTA_HTTP_MANIFEST_LEN				256
+
+#define OTA_HTTP_TASK_STACK					512
+#define OTA_HTTP_TASK_PRIORITY			2
+
+
+
+//*****************************************************************************
+// Global data
+//*****************************************************************************
+
+extern xTaskHandle ota_http_task_handle;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+// Starts update task with server from trigger message, see above.
+// Returns false when an update is already running or the image is on trial.
+bool ota_http_start( const char* server, uint16_t len );
+
+
+
+#endif
@@ -0,0 +1,354 @@
+#include <FreeRTOS.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ota-image.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+// States of decompression, input collects bytes up to input_len
+enum
+{
+	OTA_LZ4_HEADER,
+	OTA_LZ4_BLOCK_HEADER,
+	OTA_LZ4_BLOCK,							// Compressed, collected in input
+	OTA_LZ4_STORED,							// Raw, passed through
+	OTA_LZ4_DONE
+};
+
+#define OTA_LZ4_HEADER_LEN			8
+#define OTA_LZ4_BLOCK_HEADER_LEN	2
+#define OTA_LZ4_MIN_MATCH				4
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static bool ota_image_raw( ota_image_t* image, const void* data, uint32_t len );
+static bool ota_image_decompress( ota_image_t* image, const uint8_t* data, uint32_t len );
+static bool ota_image_state( ota_image_t* image );
+static bool ota_image_block( ota_image_t* image );
+static int32_t ota_lz4_decode( const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len );
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+ota_image_t* ota_image_begin( uint32_t start_addr, uint32_t limit, bool compressed )
+{
+	ota_image_t* image = malloc( sizeof(ota_image_t) );
+	if( image == NULL ) return NULL;
+
+	image->input = NULL;
+	if( compressed == true )
+	{
+		image->input = malloc( OTA_IMAGE_LZ4_BLOCK );
+		if( image->input == NULL )
+		{
+			free( image );
+			return NULL;
+		}
+	}
+
+	image->start_addr = start_addr;
+	image->limit = limit;
+	image->received = 0;
+	image->state = OTA_LZ4_HEADER;
+	image->input_len = OTA_LZ4_HEADER_LEN;
+	image->input_fill = 0;
+	image->raw_length = 0;
+	image->error = NULL;
+	rboot_sector_init( &image->writer, start_addr );
+	rboot_verify_init( &image->verify );
+	#ifdef OTA_IMAGE_SHA256
+		image->has_expected = false;
+		mbedtls_sha256_init( &image->sha );
+		mbedtls_sha256_starts( &image->sha, 0 );
+	#endif
+	return image;
+}
+
+
+
+bool ota_image_write( ota_image_t* image, const void* data, uint32_t len )
+{
+	if( image->error != NULL ) return false;
+	#ifdef OTA_IMAGE_SHA256
+		mbedtls_sha256_update( &image->sha, data, len );
+	#endif
+	if( image->input == NULL ) return ota_image_raw( image, data, len );
+	return ota_image_decompress( image, data, len );
+}
+
+
+
+bool ota_image_finish( ota_image_t* image, const char** error )
+{
+	uint32_t image_length;
+
+	if( image->error != NULL )
+	{
+		*error = image->error;
+		return false;
+	}
+	if( (image->input != NULL) && (image->state != OTA_LZ4_DONE) )
+	{
+		*error = "Compressed image truncated";
+		return false;
+	}
+	if( rboot_sector_flush(&image->writer) == false )
+	{
+		*error = "Flash write failed";
+		return false;
+	}
+	if( rboot_verify_finish(&image->verify, &image_length, error) == false ) return false;
+	if( image_length != image->received )
+	{
+		*error = "Data after image end";
+		return false;
+	}
+
+	#ifdef OTA_IMAGE_SHA256
+		mbedtls_sha256_finish( &image->sha, image->digest );
+		if( image->has_expected && (memcmp(image->digest, image->expected, OTA_IMAGE_SHA256_LEN) != 0) )
+		{
+			*error = "SHA-256 mismatch";
+			return false;
+		}
+	#endif
+	return true;
+}
+
+
+
+void ota_image_end( ota_image_t* image )
+{
+	#ifdef OTA_IMAGE_SHA256
+		mbedtls_sha256_free( &image->sha );
+	#endif
+	free( image->input );
+	free( image );
+}
+
+
+
+#ifdef OTA_IMAGE_SHA256
+	bool ota_image_expect_sha256( ota_image_t* image, const char* hex )
+	{
+		char byte[3] = { 0 };
+
+		if( strlen(hex) != (OTA_IMAGE_SHA256_LEN * 2) ) return false;
+		for( uint8_t n=0; n<OTA_IMAGE_SHA256_LEN; n++ )
+		{
+			byte[0] = hex[n*2];
+			byte[1] = hex[n*2 + 1];
+			image->expected[n] = strtoul( byte, NULL, 16 );
+		}
+		image->has_expected = true;
+		return true;
+	}
+#endif
+
+
+
+// Raw image data to verifier and flash
+static bool ota_image_raw( ota_image_t* image, const void* data, uint32_t len )
+{
+	if( image->received + len > image->limit )
+	{
+		image->error = "Image too large";
+		return false;
+	}
+	image->received += len;
+	rboot_verify_update( &image->verify, data, len );
+	if( rboot_sector_write(&image->writer, data, len) == false )
+	{
+		image->error = "Flash write failed";
+		return false;
+	}
+	return true;
+}
+
+
+
+static bool ota_image_decompress( ota_image_t* image, const uint8_t* data, uint32_t len )
+{
+	uint32_t chunk;
+
+	while( len > 0 )
+	{
+		if( image->state == OTA_LZ4_DONE )
+		{
+			image->error = "Data after compressed image";
+			return false;
+		}
+
+		chunk = image->input_len - image->input_fill;
+		if( chunk > len ) chunk = len;
+		if( image->state == OTA_LZ4_STORED )
+		{
+			if( ota_image_raw(image, data, chunk) == false ) return false;
+		}
+		else
+		{
+			memcpy( &image->input[image->input_fill], data, chunk );
+		}
+		image->input_fill += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if( (image->input_fill == image->input_len) && (ota_image_state(image) == false) ) return false;
+	}
+	return true;
+}
+
+
+
+// Called when input_len bytes of current state are complete
+static bool ota_image_state( ota_image_t* image )
+{
+	uint16_t header;
+
+	switch( image->state )
+	{
+		case OTA_LZ4_HEADER:
+			if( (image->input[0] | (image->input[1] << 8) | (image->input[2] << 16) | ((uint32_t)image->input[3] << 24)) != OTA_IMAGE_LZ4_MAGIC )
+			{
+				image->error = "Missing compression magic";
+				return false;
+			}
+			image->raw_length = image->input[4] | (image->input[5] << 8) | (image->input[6] << 16) | ((uint32_t)image->input[7] << 24);
+			if( image->raw_length > image->limit )
+			{
+				image->error = "Image too large";
+				return false;
+			}
+			break;
+
+		case OTA_LZ4_BLOCK_HEADER:
+			header = image->input[0] | (image->input[1] << 8);
+			image->input_len = header & ~OTA_IMAGE_LZ4_STORED;
+			image->input_fill = 0;
+			if( (image->input_len == 0) || (image->input_len > OTA_IMAGE_LZ4_BLOCK) )
+			{
+				image->error = "Bad compressed block";
+				return false;
+			}
+			image->state = (header & OTA_IMAGE_LZ4_STORED) ? OTA_LZ4_STORED : OTA_LZ4_BLOCK;
+			return true;
+
+		case OTA_LZ4_BLOCK:
+			if( ota_image_block(image) == false ) return false;
+			break;
+
+		case OTA_LZ4_STORED:
+			break;
+	}
+
+	// Next block header, unless raw image is complete
+	image->input_fill = 0;
+	image->input_len = OTA_LZ4_BLOCK_HEADER_LEN;
+	image->state = (image->received >= image->raw_length) ? OTA_LZ4_DONE : OTA_LZ4_BLOCK_HEADER;
+	return true;
+}
+
+
+
+// Decompress block from input directly into the empty sector buffer.
+// Each block except the last one is a full sector, so the buffer is always empty here.
+static bool ota_image_block( ota_image_t* image )
+{
+	uint8_t* out = (uint8_t*)image->writer.buffer;
+	uint32_t expected = image->raw_length - image->received;
+	int32_t len;
+
+	if( expected > OTA_IMAGE_LZ4_BLOCK ) expected = OTA_IMAGE_LZ4_BLOCK;
+	if( image->writer.fill != 0 )
+	{
+		image->error = "Bad compressed block";
+		return false;
+	}
+
+	len = ota_lz4_decode( image->input, image->input_len, out, OTA_IMAGE_LZ4_BLOCK );
+	if( len != expected )
+	{
+		image->error = "Decompression failed";
+		return false;
+	}
+
+	image->received += len;
+	rboot_verify_update( &image->verify, out, len );
+	if( rboot_sector_filled(&image->writer, len) == false )
+	{
+		image->error = "Flash write failed";
+		return false;
+	}
+	return true;
+}
+
+
+
+// LZ4 block format, every sequence is token, literals, 16 bit offset and match.
+// Returns decompressed length or -1 when data is corrupt.
+static int32_t ota_lz4_decode( const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len )
+{
+	const uint8_t* src_end = src + src_len;
+	const uint8_t* match;
+	uint8_t* out = dst;
+	uint8_t* out_end = dst + dst_len;
+	uint32_t len, offset;
+	uint8_t token, byte;
+
+	while( src < src_end )
+	{
+		token = *src++;
+
+		len = token >> 4;
+		if( len == 15 )
+		{
+			do
+			{
+				if( src >= src_end ) return -1;
+				byte = *src++;
+				len += byte;
+			} while( byte == 255 );
+		}
+		if( (len > (uint32_t)(src_end - src)) || (len > (uint32_t)(out_end - out)) ) return -1;
+		memcpy( out, src, len );
+		out += len;
+		src += len;
+
+		if( src >= src_end ) break;				// Last sequence has literals only
+
+		if( (src_end - src) < 2 ) return -1;
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+		if( (offset == 0) || (offset > (uint32_t)(out - dst)) ) return -1;
+
+		len = token & 0x0f;
+		if( len == 15 )
+		{
+			do
+			{
+				if( src >= src_end ) return -1;
+				byte = *src++;
+				len += byte;
+			} while( byte == 255 );
+		}
+		len += OTA_LZ4_MIN_MATCH;
+		if( len > (uint32_t)(out_end - out) ) return -1;
+
+		// Byte copy, match may overlap output
+		match = out - offset;
+		while( len-- > 0 ) *out++ = *match++;
+	}
+	return out - dst;
+}
@@ -0,0 +1,90 @@
+#ifndef _OTA_IMAGE_H
+#define _OTA_IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rboot-api.h"
+#ifdef OTA_IMAGE_SHA256
+	#include "mbedtls/sha256.h"
+#endif
+
+/* Receive path of an OTA image, independent of the transport.
+ *
+ * Data is written through one sector buffer and verified while it
+ * arrives, so the image is checked without reading it back from flash.
+ *
+ * Compressed images (tools/ota_pack.py) are decompressed on the fly:
+ *   header: uint32 magic "OLZ1", uint32 length of raw image (little endian)
+ *   blocks: uint16 header, data
+ * Each block holds up to 4KB of raw image, LZ4 block format with matches only
+ * inside the block, or stored raw when OTA_IMAGE_LZ4_STORED is set in header.
+ * Blocks are decompressed straight into the sector buffer, so besides it only
+ * one buffer for the compressed block is needed.
+ */
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to also compute SHA-256 of received file. Needs mbedtls component in Makefile.
+//#define OTA_IMAGE_SHA256
+
+#define OTA_IMAGE_SHA256_LEN			32
+
+#define OTA_IMAGE_LZ4_MAGIC				0x315a4c4f		// "OLZ1"
+#define OTA_IMAGE_LZ4_BLOCK				SECTOR_SIZE
+#define OTA_IMAGE_LZ4_STORED			0x8000				// Block header flag, rest is length
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+typedef struct
+{
+	rboot_sector_writer		writer;
+	rboot_verify_ctx			verify;
+	uint32_t							start_addr;
+	uint32_t							limit;					// Max bytes of raw image
+	uint32_t							received;				// Bytes of raw image
+	// Decompression state, input is NULL for raw images
+	uint8_t*							input;					// Compressed block
+	uint16_t							input_len;			// Length of current block or header
+	uint16_t							input_fill;
+	uint8_t								state;
+	uint32_t							raw_length;			// From header of compressed file
+	const char*						error;
+	#ifdef OTA_IMAGE_SHA256
+		mbedtls_sha256_context	sha;
+		bool										has_expected;
+		uint8_t									expected[OTA_IMAGE_SHA256_LEN];
+		uint8_t									digest[OTA_IMAGE_SHA256_LEN];
+	#endif
+} ota_image_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+// Allocates state for one transfer of at most limit bytes into the slot at flash address.
+// Returns NULL if out of memory.
+ota_image_t* ota_image_begin( uint32_t start_addr, uint32_t limit, bool compressed );
+// Data of the file as received, compressed or not
+bool ota_image_write( ota_image_t* image, const void* data, uint32_t len );
+// Flush last sector and check image, error is a static message
+bool ota_image_finish( ota_image_t* image, const char** error );
+void ota_image_end( ota_image_t* image );
+
+#ifdef OTA_IMAGE_SHA256
+	// Digest of file given as 64 hex characters, checked by ota_image_finish()
+	bool ota_image_expect_sha256( ota_image_t* image, const char* hex );
+#endif
+
+
+
+#endif
@@ -7,6 +7,8 @@
  * BSD Licensed as described in the file LICENSE
  */
 #include <FreeRTOS.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -22,7 +24,9 @@
 #include <espressif/esp_system.h>
 
 #include "ota-tftp.h"
+#include "ota-image.h"
 #include "rboot-api.h"
+#include "ota.h"
 #ifdef OTA_TFTP_DEBUG
 	#include "debug.h"
 #endif
@@ -39,11 +43,28 @@
 #define TFTP_OP_OACK 6
 
 #define TFTP_ERR_FILENOTFOUND 1
+#define TFTP_ERR_ACCESS 2
 #define TFTP_ERR_FULL 3
 #define TFTP_ERR_ILLEGAL 4
 #define TFTP_ERR_BADID 5
 
-#define MAX_IMAGE_SIZE 0x100000 /*1MB images max at the moment */
+#define TFTP_DEFAULT_BLKSIZE 512
+#define TFTP_MIN_BLKSIZE 8
+#define TFTP_OACK_LEN 112 /* "blksize\0" "65464\0" "windowsize\0" "65535\0" "sha256\0" <64 hex> "\0" */
+
+/* Options requested by client, only these may be answered in OACK */
+#define TFTP_OPT_BLKSIZE 0x01
+#define TFTP_OPT_WINDOWSIZE 0x02
+#define TFTP_OPT_SHA256 0x04
+
+typedef struct {
+    uint8_t accepted; /* TFTP_OPT_xxx */
+    uint16_t blksize;
+    uint16_t windowsize;
+#ifdef OTA_IMAGE_SHA256
+    char sha256[OTA_IMAGE_SHA256_LEN * 2 + 1]; /* expected digest of file in hex */
+#endif
+} tftp_options_t;
 
 
 //*****************************************************************************
@@ -51,6 +72,7 @@
 //*****************************************************************************
 
 xTaskHandle tftp_task_handle = NULL;
+static uint16_t tftp_retransmits; /* ACKs sent again for lost or out of order blocks */
 
 
 
@@ -61,9 +83,14 @@ xTaskHandle tftp_task_handle = NULL;
 static void ota_tftp_task(void* pvParameters);
 static void ota_tftp_event_callback(struct netconn *nc, enum netconn_evt evt, u16_t len);
 static char *tftp_get_field(int field, struct netbuf *netbuf);
-static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t limit_offs, size_t *received_len, ip_addr_t *peer_addr, int peer_port, tftp_receive_cb receive_cb);
+static void tftp_get_options(struct netbuf *netbuf, tftp_options_t *options);
+static err_t tftp_receive_data(struct netconn *nc, ota_image_t *image, size_t limit_offs, uint16_t blksize, uint16_t windowsize, size_t *received_len, ip_addr_t *peer_addr, int peer_port, tftp_receive_cb receive_cb);
 static err_t tftp_send_ack(struct netconn *nc, int block);
+static err_t tftp_send_oack(struct netconn *nc, const tftp_options_t *options);
 static void tftp_send_error(struct netconn *nc, int err_code, const char *err_msg);
+#ifdef OTA_TFTP_PREERASE
+static void ota_tftp_preerase_task(void *pvParameters);
+#endif
 
 #ifdef OTA_TFTP_DEBUG
 	#define ota_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
@@ -77,15 +104,28 @@ static void tftp_send_error(struct netconn *nc, int err_code, const char *err_ms
 //*****************************************************************************
 
 
+// Also verifies each slot and reports time needed as benchmark for rboot_verify_image().
+// Only with debug output, reading all slots delays boot.
 void ota_print_info( void )
 {
-	rboot_config conf = rboot_get_config();
-	
-	ota_debug_print( "%s: Image addresses in flash:\n", __FUNCTION__ );
-	for( int i = 0; i <conf.count; i++ ) 
-	{
-		ota_debug_print( "  %c%d: offset 0x%08x\n", (i == conf.current_rom ? '*':' '), i, conf.roms[i] );
-	}	
+	#ifdef OTA_TFTP_DEBUG
+		rboot_config conf = rboot_get_config();
+		uint32_t start, us, length;
+		const char* error;
+		bool valid;
+
+		ota_debug_print( "%s: Image addresses in flash:\n", __FUNCTION__ );
+		for( int i = 0; i <conf.count; i++ ) 
+		{
+			error = "";
+			start = sdk_system_get_time();
+			valid = rboot_verify_image( conf.roms[i], &length, &error );
+			us = sdk_system_get_time() - start;
+			ota_debug_print( "  %c%d: offset 0x%08x, %s %s, %u bytes verified in %u ms (%u kB/s)\n",
+			                 (i == conf.current_rom ? '*':' '), i, conf.roms[i], (valid ? "valid" : "invalid"), error,
+			                 length, us / 1000, (us > 0) ? (uint32_t)(((uint64_t)length * 1000) / us) : 0 );
+		}
+	#endif
 }
 
 
@@ -109,13 +149,54 @@ bool ota_tftp_init_server( void )
 	}
 
 	netconn_bind(nc, IP_ADDR_ANY, OTA_TFTP_PORT);
+
+	#ifdef OTA_TFTP_PREERASE
+		// Never while on trial, the other slot holds the image to fall back to
+		if(ota_on_trial() == false)
+		{
+			xTaskCreate(ota_tftp_preerase_task, "preerase", OTA_TFTP_PREERASE_STACK,
+			            (void*)conf.roms[(conf.current_rom + 1) % conf.count], tskIDLE_PRIORITY, NULL);
+		}
+	#endif
 	return true;
 }
 
 
+#ifdef OTA_TFTP_PREERASE
+// Runs at idle priority with a yield per sector, so SML and network tasks keep running.
+// UART interrupt handler is in IRAM and the FIFO holds more than one erase time of meter data.
+// Claims the slot per sector, so it stops as soon as a TFTP or HTTP transfer holds it.
+// Sectors not reached are erased on the way then.
+static void ota_tftp_preerase_task(void *pvParameters)
+{
+	uint32_t addr = (uint32_t)pvParameters;
+	uint32_t start = sdk_system_get_time();
+	uint16_t erased = 0, blank = 0;
+
+	for(uint32_t offs = 0; (offs < OTA_SLOT_SIZE) && ota_slot_claim(0); offs += SECTOR_SIZE)
+	{
+		if(rboot_sector_blank(addr + offs))
+		{
+			blank++;
+		}
+		else
+		{
+			sdk_spi_flash_erase_sector((addr + offs) / SECTOR_SIZE);
+			erased++;
+		}
+		ota_slot_release();
+		vTaskDelay(1);
+	}
+	ota_debug_print( "%s: Slot at 0x%08x, %u sectors erased, %u blank, %u ms\n", __FUNCTION__,
+	                 addr, erased, blank, (sdk_system_get_time() - start) / 1000 );
+	vTaskDelete(NULL);
+}
+#endif
+
+
 static void ota_tftp_event_callback(struct netconn *nc, enum netconn_evt evt, u16_t len)
 {
-	// No action needed if task is already created
+	// Task keeps running once created, a HTTP update in progress is rejected by it
 	if(tftp_task_handle != NULL) return;
 	
 	ota_debug_print( "%s: Creating TFTP server task ... ", __FUNCTION__ );
@@ -165,18 +246,19 @@ static void ota_tftp_task( void *pvParameters )
 				{
 						ota_debug_print( "%s: Invalid opcode 0x%04x didn't match WRQ\n", __FUNCTION__, opcode );
             netbuf_delete(netbuf);
- 						vTaskDelete(NULL);
+            continue;
         }
 
         /* check filename */
         char *filename = tftp_get_field(0, netbuf);
-        if(!filename || strcmp(filename, OTA_TFTP_FIRMWARE_FILE)) 
+        bool compressed = (filename && !strcmp(filename, OTA_TFTP_COMPRESSED_FILE));
+        if(!filename || (strcmp(filename, OTA_TFTP_FIRMWARE_FILE) && !compressed)) 
 				{
-						ota_debug_print( "%s: File must be %s. Deleting task\n", __FUNCTION__, OTA_TFTP_FIRMWARE_FILE );
-            tftp_send_error(nc, TFTP_ERR_FILENOTFOUND, "File must be " OTA_TFTP_FIRMWARE_FILE);
+						ota_debug_print( "%s: File must be %s\n", __FUNCTION__, OTA_TFTP_FIRMWARE_FILE );
+            tftp_send_error(nc, TFTP_ERR_FILENOTFOUND, "File must be " OTA_TFTP_FIRMWARE_FILE " or " OTA_TFTP_COMPRESSED_FILE);
             free(filename);
             netbuf_delete(netbuf);
- 						vTaskDelete(NULL);
+            continue;
         }
         free(filename);
 
@@ -184,14 +266,19 @@ static void ota_tftp_task( void *pvParameters )
         char *mode = tftp_get_field(1, netbuf);
         if(!mode || strcmp(OTA_TFTP_OCTET_MODE, mode)) 
 				{
-						ota_debug_print( "%s: Mode must be binary. Deleting task\n", __FUNCTION__ );
+						ota_debug_print( "%s: Mode must be binary\n", __FUNCTION__ );
             tftp_send_error(nc, TFTP_ERR_ILLEGAL, "Mode must be octet/binary");
             free(mode);
             netbuf_delete(netbuf);
-						vTaskDelete(NULL);
+            continue;
         }
         free(mode);
 
+        /* options are optional, defaults give RFC1350 behaviour */
+        tftp_options_t options;
+        tftp_get_options(netbuf, &options);
+        ota_debug_print( "%s: blksize %u, windowsize %u\n", __FUNCTION__, options.blksize, options.windowsize );
+
         /* establish a connection back to the sender from this netbuf */
         netconn_connect(nc, netbuf_fromaddr(netbuf), netbuf_fromport(netbuf));
         netbuf_delete(netbuf);
@@ -199,38 +286,84 @@ static void ota_tftp_task( void *pvParameters )
         /* Find next free slot - this requires flash unmapping so best done when no packets in flight */
         rboot_config conf;
         conf = rboot_get_config();
+        if(ota_on_trial())
+				{
+            /* New image on trial, configured slot holds the image to fall back to. Server keeps running for after confirmation */
+						ota_debug_print( "%s: Image on trial, upload rejected\n", __FUNCTION__ );
+            tftp_send_error(nc, TFTP_ERR_ACCESS, "Image on trial, not confirmed yet");
+            netconn_disconnect(nc);
+            continue;
+        }
+        if(!ota_slot_claim(OTA_SLOT_WAIT))
+				{
+						ota_debug_print( "%s: Slot in use, upload rejected\n", __FUNCTION__ );
+            tftp_send_error(nc, TFTP_ERR_ACCESS, "Other update in progress");
+            netconn_disconnect(nc);
+            continue;
+        }
+        /* Not on trial, so running slot is the configured one */
         int slot = (conf.current_rom + 1) % conf.count;
 
-        /* ACK the WRQ */
-        int ack_err = tftp_send_ack(nc, 0);
+        /* ACK the WRQ, OACK if options were accepted. Client answers both with data block 1 */
+        int ack_err = options.accepted ? tftp_send_oack(nc, &options) : tftp_send_ack(nc, 0);
         if(ack_err != 0) 
 				{
-						ota_debug_print( "%s: Initial ACK failed. Deleting task\n", __FUNCTION__ );
+						ota_debug_print( "%s: Initial ACK failed\n", __FUNCTION__ );
+            ota_slot_release();
             netconn_disconnect(nc);
-						vTaskDelete(NULL);
+            continue;
         }
 
+        /* One sector buffer and verifier state for the whole transfer */
+        uint32_t heap_free = xPortGetFreeHeapSize();
+        ota_image_t *image = ota_image_begin(conf.roms[slot], OTA_SLOT_SIZE, compressed);
+        if(image == NULL)
+				{
+            tftp_send_error(nc, TFTP_ERR_FULL, "Out of memory");
+            ota_slot_release();
+            netconn_disconnect(nc);
+            continue;
+        }
+#ifdef OTA_IMAGE_SHA256
+        if(options.accepted & TFTP_OPT_SHA256) {
+            ota_image_expect_sha256(image, options.sha256);
+        }
+#endif
+        rboot_sector_writer *writer = &image->writer;
+
         /* Finished WRQ phase, start TFTP data transfer */
         size_t received_len;
+        uint32_t start_us = sdk_system_get_time();
         netconn_set_recvtimeout(nc, 10000);
-        int recv_err = tftp_receive_data(nc, conf.roms[slot], conf.roms[slot]+MAX_IMAGE_SIZE, &received_len, NULL, 0, NULL);
+        int recv_err = tftp_receive_data(nc, image, conf.roms[slot]+OTA_SLOT_SIZE, options.blksize, options.windowsize, &received_len, NULL, 0, NULL);
+        uint32_t total_ms = (sdk_system_get_time() - start_us) / 1000;
 
         netconn_disconnect(nc);
 				ota_debug_print( "%s: Receive data result %d bytes %d\n", __FUNCTION__, recv_err, received_len );
+				ota_debug_print( "%s: %u ms total, flash %u bytes in %u ms (%u kB/s), heap free %u during transfer %u\n", __FUNCTION__,
+				                 total_ms, writer->written, writer->flash_us / 1000,
+				                 (writer->flash_us > 0) ? (uint32_t)(((uint64_t)writer->written * 1000) / writer->flash_us) : 0,
+				                 heap_free, xPortGetFreeHeapSize() );
+				ota_debug_print( "%s: Erase %u ms for %u sectors, %u already blank, %u retransmits\n", __FUNCTION__,
+				                 writer->erase_us / 1000, writer->erased, writer->erase_skipped, tftp_retransmits );
+        ota_image_end(image);
         if(recv_err == ERR_OK) 
 				{
-						ota_debug_print( "%s: Receiving finished. Changing slot to %d\n", __FUNCTION__, slot );
+						ota_debug_print( "%s: Receiving finished. Booting slot %d on trial\n", __FUNCTION__, slot );
+            /* Slot is only made permanent by ota_confirm task of new image, any restart before falls back */
+            ota_trial_mark(slot);
             vPortEnterCritical();
-            if(!rboot_set_current_rom(slot)) 
+            if(!rboot_set_temp_rom(slot)) 
 						{
 								vPortExitCritical();
-								ota_debug_print( "%s: Failed to set new rboot slot. Deleting task\n", __FUNCTION__ );
-								netconn_disconnect(nc);
-								vTaskDelete(NULL);
+								ota_debug_print( "%s: Failed to set new rboot slot\n", __FUNCTION__ );
+								ota_slot_release();
+								continue;
             }
 
             sdk_system_restart();
         }
+        ota_slot_release();
     }
 }
 
@@ -268,17 +401,69 @@ static char *tftp_get_field(int field, struct netbuf *netbuf)
     return result;
 }
 
+/* Parse option/value pairs following the mode field of a WRQ (RFC2347).
+
+   Unknown options are ignored, known ones are limited to what we can handle.
+   Accepted options are flagged with TFTP_OPT_xxx and need an OACK.
+ */
+static void tftp_get_options(struct netbuf *netbuf, tftp_options_t *options)
+{
+    options->accepted = 0;
+    options->blksize = TFTP_DEFAULT_BLKSIZE;
+    options->windowsize = 1;
+
+    for(int field = 2; ; field += 2) {
+        char *name = tftp_get_field(field, netbuf);
+        char *value = tftp_get_field(field + 1, netbuf);
+        if(!name || !value) {
+            free(name);
+            free(value);
+            return;
+        }
+
+        long n = strtol(value, NULL, 10);
+        if(!strcasecmp(name, "blksize") && n >= TFTP_MIN_BLKSIZE) {
+            if(n > OTA_TFTP_MAX_BLKSIZE)
+                n = OTA_TFTP_MAX_BLKSIZE;
+            options->blksize = n & ~3;
+            options->accepted |= TFTP_OPT_BLKSIZE;
+        }
+        else if(!strcasecmp(name, "windowsize") && n >= 1) {
+            if(n > OTA_TFTP_MAX_WINDOW)
+                n = OTA_TFTP_MAX_WINDOW;
+            options->windowsize = n;
+            options->accepted |= TFTP_OPT_WINDOWSIZE;
+        }
+#ifdef OTA_IMAGE_SHA256
+        else if(!strcasecmp(name, "sha256") && strlen(value) == sizeof(options->sha256) - 1) {
+            strcpy(options->sha256, value);
+            options->accepted |= TFTP_OPT_SHA256;
+        }
+#endif
+        free(name);
+        free(value);
+    }
+}
+
 #define TFTP_TIMEOUT_RETRANSMITS 10
 
-static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t limit_offs, size_t *received_len, ip_addr_t *peer_addr, int peer_port, tftp_receive_cb receive_cb)
+/* Receive data blocks of blksize bytes. With windowsize > 1 the client sends that many
+   blocks before waiting for an ACK of the last one (RFC7440). A missing block makes the
+   following ones of the window arrive out of order. They are dropped and the last block
+   received in order is ACKed once, so the client restarts the window from there.
+ */
+static err_t tftp_receive_data(struct netconn *nc, ota_image_t *image, size_t limit_offs, uint16_t blksize, uint16_t windowsize, size_t *received_len, ip_addr_t *peer_addr, int peer_port, tftp_receive_cb receive_cb)
 {
     *received_len = 0;
-    const int DATA_PACKET_SZ = 512 + 4; /*( packet size plus header */
-    uint32_t start_offs = write_offs;
-    int block = 1;
+    const int DATA_PACKET_SZ = blksize + 4; /*( packet size plus header */
+    uint32_t start_offs = image->start_addr;
+    uint16_t block = 1;
+    uint16_t window = 0; /* blocks received since last ACK */
+    bool resync = false; /* ACK for out of order block sent, until next in order block */
 
     struct netbuf *netbuf = 0;
     int retries = TFTP_TIMEOUT_RETRANSMITS;
+    tftp_retransmits = 0;
 
     while(1)
     {
@@ -305,9 +490,12 @@ static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t lim
         if(err == ERR_TIMEOUT) {
             if(retries-- > 0 && block > 1) {
                 /* Retransmit the last ACK, wait for repeat data block.
+                   Also restarts a window, if its tail got lost.
 
                  This doesn't work for the first block, have to time out and start again. */
-                tftp_send_ack(nc, block-1);
+                tftp_send_ack(nc, (uint16_t)(block-1));
+                tftp_retransmits++;
+                window = 0;
                 continue;
             }
             tftp_send_error(nc, TFTP_ERR_ILLEGAL, "Timeout");
@@ -328,65 +516,53 @@ static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t lim
         uint16_t client_block = netbuf_read_u16_n(netbuf, 2);
         if(client_block != block) {
             netbuf_delete(netbuf);
-            if(client_block == block-1) {
-                /* duplicate block, means our ack got lost */
-                tftp_send_ack(nc, block-1);
-                continue;
-            }
-            else {
-                tftp_send_error(nc, TFTP_ERR_ILLEGAL, "Block# out of order");
-                return ERR_VAL;
+            /* duplicate block means our ack got lost, a later one that a block got lost.
+               Either way the client continues after the last block we have. */
+            if(!resync) {
+                if(retries-- <= 0) {
+                    tftp_send_error(nc, TFTP_ERR_ILLEGAL, "Block# out of order");
+                    return ERR_VAL;
+                }
+                tftp_send_ack(nc, (uint16_t)(block-1));
+                tftp_retransmits++;
+                window = 0;
+                resync = true;
             }
+            continue;
         }
 
         /* Reset retry count if we got valid data */
         retries = TFTP_TIMEOUT_RETRANSMITS;
-
-        if(write_offs % SECTOR_SIZE == 0) {
-            sdk_spi_flash_erase_sector(write_offs / SECTOR_SIZE);
-        }
+        resync = false;
 
         /* One UDP packet can be more than one netbuf segment, so iterate all the
-           segments in the netbuf and write them to flash
+           segments in the netbuf and pass them to sector buffer and verifier. Alignment
+           of the payload doesn't matter, flash is written from the buffer only.
         */
-        int offset = 0;
+        int skip = 4; /* TFTP header, might even be split over segments */
         int len = netbuf_len(netbuf);
 
-        if(write_offs + len >= limit_offs) {
+        if(start_offs + *received_len + len - 4 >= limit_offs) {
             tftp_send_error(nc, TFTP_ERR_FULL, "Image too large");
+            netbuf_delete(netbuf);
             return ERR_VAL;
         }
 
-        bool first_chunk = true;
         do
         {
             uint16_t chunk_len;
-            uint32_t *chunk;
+            uint8_t *chunk;
             netbuf_data(netbuf, (void **)&chunk, &chunk_len);
-            if(first_chunk) {
-                chunk++; /* skip the 4 byte TFTP header */
-                chunk_len -= 4; /* assuming this netbuf chunk is at least 4 bytes! */
-                first_chunk = false;
+            if(skip >= chunk_len) {
+                skip -= chunk_len;
+                continue;
             }
-            if(chunk_len && ((uint32_t)chunk % 4)) {
-                /* sdk_spi_flash_write requires a word aligned
-                   buffer, so if the UDP payload is unaligned
-                   (common) then we copy the first word to the stack
-                   and write that to flash, then move the rest of the
-                   buffer internally to sit on an aligned offset.
-
-                   Assuming chunk_len is always a multiple of 4 bytes.
-                */
-                uint32_t first_word;
-                memcpy(&first_word, chunk, 4);
-                sdk_spi_flash_write(write_offs+offset, &first_word, 4);
-                memmove(LWIP_MEM_ALIGN(chunk),&chunk[1],chunk_len-4);
-                chunk = LWIP_MEM_ALIGN(chunk);
-                offset += 4;
-                chunk_len -= 4;
+            if(!ota_image_write(image, chunk + skip, chunk_len - skip)) {
+                tftp_send_error(nc, TFTP_ERR_FULL, "Flash write failed");
+                netbuf_delete(netbuf);
+                return ERR_VAL;
             }
-            sdk_spi_flash_write(write_offs+offset, chunk, chunk_len);
-            offset += chunk_len;
+            skip = 0;
         } while(netbuf_next(netbuf) >= 0);
 
         netbuf_delete(netbuf);
@@ -397,21 +573,24 @@ static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t lim
 				{
             /* This was the last block, but verify the image before we ACK
                it so the client gets an indication if things were successful.
+               Image was checked while receiving, so there is no flash read back.
             */
             const char *err = "Unknown validation error";
-            uint32_t image_length;
-            if(!rboot_verify_image(start_offs, &image_length, &err)
-               || image_length != *received_len) {
+            if(!ota_image_finish(image, &err)) {
                 tftp_send_error(nc, TFTP_ERR_ILLEGAL, err);
                 return ERR_VAL;
             }
         }
 
-        err_t ack_err = tftp_send_ack(nc, block);
-        if(ack_err != ERR_OK) 
-				{
-						ota_debug_print( "%s: Failed to send ACK\n", __FUNCTION__ );
-            return ack_err;
+        /* Only last block of a window and last block of file are ACKed */
+        window++;
+        if(window >= windowsize || len < DATA_PACKET_SZ) {
+            err_t ack_err = tftp_send_ack(nc, block);
+            if(ack_err != ERR_OK) {
+                ota_debug_print( "%s: Failed to send ACK\n", __FUNCTION__ );
+                return ack_err;
+            }
+            window = 0;
         }
 
         // Make sure ack was successful before calling callback.
@@ -424,7 +603,6 @@ static err_t tftp_receive_data(struct netconn *nc, size_t write_offs, size_t lim
         }
 
         block++;
-        write_offs += 512;
     }
 }
 
@@ -440,6 +618,31 @@ static err_t tftp_send_ack(struct netconn *nc, int block)
     return ack_err;
 }
 
+static err_t tftp_send_oack(struct netconn *nc, const tftp_options_t *options)
+{
+    /* Send OACK with accepted values of requested options, each as "name\0value\0" */
+    char oack[TFTP_OACK_LEN];
+    int len = 0;
+    if(options->accepted & TFTP_OPT_BLKSIZE) {
+        len += snprintf(&oack[len], sizeof(oack) - len, "blksize%c%u", 0, options->blksize) + 1;
+    }
+    if(options->accepted & TFTP_OPT_WINDOWSIZE) {
+        len += snprintf(&oack[len], sizeof(oack) - len, "windowsize%c%u", 0, options->windowsize) + 1;
+    }
+#ifdef OTA_IMAGE_SHA256
+    if(options->accepted & TFTP_OPT_SHA256) {
+        len += snprintf(&oack[len], sizeof(oack) - len, "sha256%c%s", 0, options->sha256) + 1;
+    }
+#endif
+    struct netbuf *resp = netbuf_new();
+    uint16_t *oack_buf = (uint16_t *)netbuf_alloc(resp, 2+len);
+    oack_buf[0] = htons(TFTP_OP_OACK);
+    memcpy(&oack_buf[1], oack, len);
+    err_t oack_err = netconn_send(nc, resp);
+    netbuf_delete(resp);
+    return oack_err;
+}
+
 static void tftp_send_error(struct netconn *nc, int err_code, const char *err_msg)
 {
 		ota_debug_print( "%s: Error: %s\n", __FUNCTION__, err_msg );
@@ -11,16 +11,23 @@ typedef void (*tftp_receive_cb)(size_t bytes_received);
  * and keep it running until a valid image is sent.
  *
  * The server expects to see a valid image sent with filename "filename.bin"
- * and will switch "slots" and reboot if a valid image is received.
+ * and will reboot into the new "slot" if a valid image is received. The slot
+ * is booted once only, it needs to be confirmed by the new firmware (ota.h).
  *
  * Note that the server will allow you to flash an "OTA" update that doesn't
  * support OTA itself, and possibly brick the esp requiring serial upload.
  *
  * Example client comment:
  * tftp -m octet ESP_IP -c put firmware/myprogram.bin firmware.bin
+ * Compressed image, about 2/3 of bytes on air:
+ * make ota-pack && tftp -m octet ESP_IP -c put firmware/main.lz4 main.lz4
  *
  * TFTP protocol implemented as per RFC1350:
  * https://tools.ietf.org/html/rfc1350
+ * with option negotiation (RFC2347) for block size (RFC2348) and window size (RFC7440).
+ * Clients not sending options get plain 512 byte lock-step transfer:
+ * atftp --option "blksize 1468" --option "windowsize 4" -p -l firmware/main.bin -r main.bin ESP_IP
+ * With OTA_IMAGE_SHA256 the option "sha256 <hex digest of file>" is checked before switching slot.
  *
  * IMPORTANT: TFTP is not a secure protocol.
  * Only allow TFTP OTA updates on trusted networks.
@@ -35,14 +42,27 @@ typedef void (*tftp_receive_cb)(size_t bytes_received);
 //*****************************************************************************
 
 #define OTA_TFTP_PORT 						69
-#define OTA_TFTP_MAX_IMAGE_SIZE 	0x80000 // We use 512kb, 1MB images are max at the moment
 #define OTA_TFTP_FIRMWARE_FILE 		"main.bin"
+#define OTA_TFTP_COMPRESSED_FILE	"main.lz4"		// Packed by 'make ota-pack', see ota-image.h
 #define OTA_TFTP_OCTET_MODE 			"octet" /* non-case-sensitive */
 
+// Largest block fitting into one ethernet frame (1500 - IP - UDP - TFTP header).
+// Multiple of 4, so every block but the last one keeps flash writes word aligned.
+#define OTA_TFTP_MAX_BLKSIZE			1468
+// Blocks sent by client before one ACK. Each block in flight occupies a pbuf until
+// the task reads it, so this is limited by free heap.
+#define OTA_TFTP_MAX_WINDOW				4
+
+// Uncomment to erase the slot for next update in background after a standard boot.
+// Saves the erase time (about 1/3 of transfer) during an update, but the previous image
+// is lost as fallback for rboot. The receive path skips sectors already blank anyway.
+//#define OTA_TFTP_PREERASE
+
 // Uncomment to enable debug output
 //#define OTA_TFTP_DEBUG
 
 #define OTA_TFTP_TASK_STACK		500
+#define OTA_TFTP_PREERASE_STACK	256
 
 
 //*****************************************************************************
@@ -57,6 +77,7 @@ extern xTaskHandle tftp_task_handle;
 //*****************************************************************************
 
 
+// Prints slots with result and duration of image verification
 void ota_print_info( void );
 
 // Create an connection handler for TFTP
@@ -111,55 +111,51 @@ rboot_write_status ICACHE_FLASH_ATTR rboot_write_init(uint32 start_addr) {
 
 // function to do the actual writing to flash
 // call repeatedly with more data (max len per write is the flash sector size (4k))
+// data is passed through a small aligned stack buffer, so no heap is used
+#define RBOOT_WRITE_CHUNK 256
 bool ICACHE_FLASH_ATTR rboot_write_flash(rboot_write_status *status, uint8 *data, uint16 len) {
 	
-	bool ret = false;
-	uint8 *buffer;
+	uint32 buffer[RBOOT_WRITE_CHUNK / 4];
+	uint16 chunk;
 	int32 lastsect;
 	
 	if (data == NULL || len == 0) {
 		return true;
 	}
 	
-	// get a buffer
-	buffer = (uint8 *)os_malloc(len + status->extra_count);
-	if (!buffer) {
-		//os_printf("No ram!\r\n");
-		return false;
-	}
-
-	// copy in any remaining bytes from last chunk
-	memcpy(buffer, status->extra_bytes, status->extra_count);
-	// copy in new data
-	memcpy(buffer + status->extra_count, data, len);
-
-	// calculate length, must be multiple of 4
-	// save any remaining bytes for next go
-	len += status->extra_count;
-	status->extra_count = len % 4;
-	len -= status->extra_count;
-	memcpy(status->extra_bytes, buffer + len, status->extra_count);
-
-	// check data will fit
-	//if (status->start_addr + len < (status->start_sector + status->max_sector_count) * SECTOR_SIZE) {
+	while (len > 0) {
+		// copy in any remaining bytes from last chunk, then new data
+		memcpy(buffer, status->extra_bytes, status->extra_count);
+		chunk = RBOOT_WRITE_CHUNK - status->extra_count;
+		if (chunk > len) chunk = len;
+		memcpy((uint8*)buffer + status->extra_count, data, chunk);
+		data += chunk;
+		len -= chunk;
+
+		// calculate length, must be multiple of 4
+		// save any remaining bytes for next go
+		chunk += status->extra_count;
+		status->extra_count = chunk % 4;
+		chunk -= status->extra_count;
+		memcpy(status->extra_bytes, (uint8*)buffer + chunk, status->extra_count);
+		if (chunk == 0) continue;
 
 		// erase any additional sectors needed by this chunk
-		lastsect = ((status->start_addr + len) - 1) / SECTOR_SIZE;
+		lastsect = ((status->start_addr + chunk) - 1) / SECTOR_SIZE;
 		while (lastsect > status->last_sector_erased) {
 			status->last_sector_erased++;
 			spi_flash_erase_sector(status->last_sector_erased);
 		}
 
 		// write current chunk
-		//os_printf("write addr: 0x%08x, len: 0x%04x\r\n", status->start_addr, len);
-		if (spi_flash_write(status->start_addr, (uint32 *)((void*)buffer), len) == SPI_FLASH_RESULT_OK) {
-			ret = true;
-			status->start_addr += len;
+		//os_printf("write addr: 0x%08x, len: 0x%04x\r\n", status->start_addr, chunk);
+		if (spi_flash_write(status->start_addr, buffer, chunk) != SPI_FLASH_RESULT_OK) {
+			return false;
 		}
-	//}
+		status->start_addr += chunk;
+	}
 
-	os_free(buffer);
-	return ret;
+	return true;
 }
 
 #ifdef BOOT_RTC_ENABLED
@@ -236,123 +232,228 @@ typedef struct __attribute__((packed)) {
 #define ROM_MAGIC_OLD 0xe9
 #define ROM_MAGIC_NEW 0xea
 
-bool rboot_verify_image(uint32_t initial_offset, uint32_t *image_length, const char **error_message)
+/* States of incremental verification, each collects bytes up to ctx->next */
+enum {
+    VERIFY_IMAGE_HEADER,
+    VERIFY_SECTION_HEADER,
+    VERIFY_SECTION_DATA,
+    VERIFY_PADDING,             /* up to the second header of a new style image */
+    VERIFY_CHECKSUM_PADDING,    /* up to the checksum byte */
+    VERIFY_CHECKSUM,
+    VERIFY_DONE
+};
+
+/* XOR of all bytes, the aligned middle part a word at a time */
+static uint8_t rboot_xor_bytes(uint8_t checksum, const uint8_t *data, uint32_t len)
 {
-    uint32_t offset = initial_offset;
-    const char *error = NULL;
-    RBOOT_DEBUG("rboot_verify_image: verifying image at 0x%08x\n", initial_offset);
-    if(offset % 4) {
-        error = "Unaligned flash offset";
-        goto fail;
-    }
+    uint32_t word = 0;
 
-    /* sanity limit on how far we can read */
-    uint32_t end_limit = offset + 0x100000;
-    image_header_t image_header __attribute__((aligned(4)));
-    if(sdk_spi_flash_read(offset, (uint32_t *)&image_header, sizeof(image_header_t))) {
-        error = "Flash fail";
-        goto fail;
+    while(len > 0 && ((uint32_t)data & 3)) {
+        checksum ^= *data++;
+        len--;
     }
-
-    offset += sizeof(image_header_t);
-
-    if(image_header.magic != ROM_MAGIC_OLD && image_header.magic != ROM_MAGIC_NEW) {
-        error = "Missing initial magic";
-        goto fail;
+    for(const uint32_t *p = (const uint32_t *)data; len >= 4; len -= 4) {
+        word ^= *p++;
+        data += 4;
+    }
+    while(len > 0) {
+        checksum ^= *data++;
+        len--;
     }
+    word ^= word >> 16;
+    word ^= word >> 8;
+    return checksum ^ (uint8_t)word;
+}
 
-    bool is_new_header = (image_header.magic == ROM_MAGIC_NEW); /* a v1.2/rboot header, so expect a v1.1 header after the initial section */
+void rboot_verify_init(rboot_verify_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(rboot_verify_ctx));
+    ctx->state = VERIFY_IMAGE_HEADER;
+    ctx->next = sizeof(image_header_t);
+    ctx->checksum = CHKSUM_INIT;
+}
 
-    int remaining_sections = image_header.section_count;
+/* Checksum byte sits at the end of the image padded to 16 bytes */
+static void rboot_verify_sections_done(rboot_verify_ctx *ctx)
+{
+    ctx->state = VERIFY_CHECKSUM_PADDING;
+    ctx->next = ((ctx->offset + 1 + 15) & ~15) - 1;
+    if(ctx->next == ctx->offset) {
+        ctx->state = VERIFY_CHECKSUM;
+        ctx->next = ctx->offset + 1;
+    }
+}
 
-    uint8_t checksum = CHKSUM_INIT;
+static void rboot_verify_next_section(rboot_verify_ctx *ctx)
+{
+    if(ctx->remaining_sections > 0) {
+        ctx->state = VERIFY_SECTION_HEADER;
+        ctx->next = ctx->offset + sizeof(section_header_t);
+    } else {
+        rboot_verify_sections_done(ctx);
+    }
+}
 
-    while(remaining_sections > 0 && offset < end_limit)
-    {
-        /* read section header */
-        section_header_t header __attribute__((aligned(4)));
-        if(sdk_spi_flash_read(offset, (uint32_t *)&header, sizeof(section_header_t))) {
-            error = "Flash fail";
-            goto fail;
+/* Called when all bytes of the current state are consumed */
+static void rboot_verify_step(rboot_verify_ctx *ctx)
+{
+    image_header_t *image_header = (image_header_t *)ctx->header;
+    section_header_t *section_header = (section_header_t *)ctx->header;
+
+    switch(ctx->state) {
+    case VERIFY_IMAGE_HEADER:
+        if(ctx->is_new_header) {
+            /* second header, after the initial section of a v1.2/rboot image */
+            if(image_header->magic != ROM_MAGIC_OLD) {
+                ctx->error = "Bad second magic";
+                return;
+            }
+            ctx->is_new_header = false;
+        } else if(image_header->magic != ROM_MAGIC_OLD && image_header->magic != ROM_MAGIC_NEW) {
+            ctx->error = "Missing initial magic";
+            return;
+        } else {
+            /* a v1.2/rboot header, so expect a v1.1 header after the initial section */
+            ctx->is_new_header = (image_header->magic == ROM_MAGIC_NEW);
         }
-
-        RBOOT_DEBUG("Found section @ 0x%08x (abs 0x%08x) length %d load 0x%08x\n", offset-initial_offset, offset, header.length, header.load_addr);
-        offset += sizeof(section_header_t);
-
-        if(header.length+offset > end_limit) {
-            break; /* sanity check: will reading section take us off end of expected flashregion? */
+        ctx->remaining_sections = image_header->section_count;
+        rboot_verify_next_section(ctx);
+        break;
+
+    case VERIFY_SECTION_HEADER:
+        RBOOT_DEBUG("Found section @ 0x%08x length %d load 0x%08x\n", ctx->offset - sizeof(section_header_t), section_header->length, section_header->load_addr);
+        if(section_header->length % 4) {
+            ctx->error = "Header length not modulo 4";
+            return;
         }
-
-        if(header.length % 4) {
-            error = "Header length not modulo 4";
-            goto fail;
+        if(ctx->offset + section_header->length > 0x100000) {
+            ctx->error = "Image truncated";
+            return;
         }
-
-        if(!is_new_header) {
-            /* Add individual data of the section to the checksum. */
-            char chunk[16] __attribute__((aligned(4)));
-            for(int i = 0; i < header.length; i++) {
-                if(i % sizeof(chunk) == 0)
-                    sdk_spi_flash_read(offset+i, (uint32_t *)chunk, sizeof(chunk));
-                checksum ^= chunk[i % sizeof(chunk)];
+        ctx->state = VERIFY_SECTION_DATA;
+        ctx->next = ctx->offset + section_header->length;
+        if(section_header->length > 0)
+            break;
+        /* fall through for empty section */
+
+    case VERIFY_SECTION_DATA:
+        ctx->remaining_sections--;
+        if(ctx->is_new_header) {
+            /* pad to a 16 byte offset, then expect a v1.1 header at start of "real" sections */
+            ctx->state = VERIFY_PADDING;
+            ctx->next = (ctx->offset + 15) & ~15;
+            if(ctx->next == ctx->offset) {
+                ctx->state = VERIFY_IMAGE_HEADER;
+                ctx->next = ctx->offset + sizeof(image_header_t);
             }
+        } else {
+            rboot_verify_next_section(ctx);
         }
-
-        offset += header.length;
-        /* pad section to 4 byte align */
-        offset = (offset+3) & ~3;
-
-        remaining_sections--;
-
-        if(is_new_header) {
-            /* pad to a 16 byte offset */
-            offset = (offset+15) & ~15;
-
-            /* expect a v1.1 header here at start of "real" sections */
-            sdk_spi_flash_read(offset, (uint32_t *)&image_header, sizeof(image_header_t));
-            offset += sizeof(image_header_t);
-            if(image_header.magic != ROM_MAGIC_OLD) {
-                error = "Bad second magic";
-                goto fail;
-            }
-            remaining_sections = image_header.section_count;
-            is_new_header = false;
+        break;
+
+    case VERIFY_PADDING:
+        ctx->state = VERIFY_IMAGE_HEADER;
+        ctx->next = ctx->offset + sizeof(image_header_t);
+        break;
+
+    case VERIFY_CHECKSUM_PADDING:
+        ctx->state = VERIFY_CHECKSUM;
+        ctx->next = ctx->offset + 1;
+        break;
+
+    case VERIFY_CHECKSUM:
+        if(ctx->header[0] != ctx->checksum) {
+            ctx->error = "Invalid checksum";
+            return;
         }
+        ctx->state = VERIFY_DONE;
+        break;
     }
+}
 
-    if(remaining_sections > 0) {
-        error = "Image truncated";
-        goto fail;
+void rboot_verify_update(rboot_verify_ctx *ctx, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+
+    while(len > 0 && ctx->error == NULL && ctx->state != VERIFY_DONE) {
+        uint32_t chunk = ctx->next - ctx->offset;
+        if(chunk > len)
+            chunk = len;
+
+        switch(ctx->state) {
+        case VERIFY_IMAGE_HEADER:
+        case VERIFY_SECTION_HEADER:
+            memcpy(&ctx->header[sizeof(image_header_t) - (ctx->next - ctx->offset)], src, chunk);
+            break;
+        case VERIFY_SECTION_DATA:
+            /* second stage sections only, the first section of a new style image isn't checksummed */
+            if(!ctx->is_new_header)
+                ctx->checksum = rboot_xor_bytes(ctx->checksum, src, chunk);
+            break;
+        case VERIFY_CHECKSUM:
+            ctx->header[0] = *src;
+            break;
+        }
+
+        ctx->offset += chunk;
+        src += chunk;
+        len -= chunk;
+        if(ctx->offset == ctx->next)
+            rboot_verify_step(ctx);
     }
+}
+
+bool rboot_verify_finish(rboot_verify_ctx *ctx, uint32_t *image_length, const char **error_message)
+{
+    if(ctx->error == NULL && ctx->state != VERIFY_DONE)
+        ctx->error = "Image truncated";
+    if(image_length)
+        *image_length = ctx->offset;
+    if(error_message && ctx->error)
+        *error_message = ctx->error;
+    return (ctx->error == NULL);
+}
 
-    /* add a byte for the image checksum (actually comes after the padding) */
-    offset++;
-    /* pad the image length to a 16 byte boundary */
-    offset = (offset+15) & ~15;
+/* Reads the image in large aligned blocks into the incremental verifier,
+   which needs far fewer flash accesses than reading each header separately */
+bool rboot_verify_image(uint32_t initial_offset, uint32_t *image_length, const char **error_message)
+{
+    rboot_verify_ctx ctx;
+    uint32_t offset = initial_offset;
+    /* sanity limit on how far we can read */
+    uint32_t end_limit = offset + 0x100000;
+    uint32_t *buf;
 
-    uint32_t read_checksum;
-    sdk_spi_flash_read(offset-1, &read_checksum, 1);
-    if((uint8_t)read_checksum != checksum) {
-        error = "Invalid checksum";
-        goto fail;
+    RBOOT_DEBUG("rboot_verify_image: verifying image at 0x%08x\n", initial_offset);
+    rboot_verify_init(&ctx);
+    if(offset % 4) {
+        ctx.error = "Unaligned flash offset";
+        goto done;
     }
 
-    RBOOT_DEBUG("rboot_verify_image: verified expected 0x%08x bytes.\n", offset - initial_offset);
-
-    if(image_length)
-        *image_length = offset - initial_offset;
+    buf = os_malloc(RBOOT_VERIFY_BLOCK);
+    if(!buf) {
+        ctx.error = "Out of memory";
+        goto done;
+    }
 
-    return true;
+    while(offset < end_limit && ctx.error == NULL && ctx.state != VERIFY_DONE) {
+        if(sdk_spi_flash_read(offset, buf, RBOOT_VERIFY_BLOCK)) {
+            ctx.error = "Flash fail";
+            break;
+        }
+        rboot_verify_update(&ctx, buf, RBOOT_VERIFY_BLOCK);
+        offset += RBOOT_VERIFY_BLOCK;
+    }
+    os_free(buf);
 
- fail:
-    if(error_message)
-        *error_message = error;
-    if(error) {
-        printf("%s: %s\n", __func__, error);
+ done:
+    if(!rboot_verify_finish(&ctx, image_length, error_message)) {
+        printf("%s: %s\n", __func__, ctx.error);
+        return false;
     }
-    if(image_length)
-        *image_length = offset - initial_offset;
-    return false;
+    RBOOT_DEBUG("rboot_verify_image: verified expected 0x%08x bytes.\n", ctx.offset);
+    return true;
 }
 
 bool rboot_digest_image(uint32_t offset, uint32_t image_length, rboot_digest_update_fn update_fn, void *update_ctx)
@@ -369,6 +470,92 @@ bool rboot_digest_image(uint32_t offset, uint32_t image_length, rboot_digest_upd
     return true;
 }
 
+void rboot_sector_init(rboot_sector_writer *writer, uint32_t start_addr)
+{
+    writer->sector_addr = start_addr & ~(SECTOR_SIZE - 1);
+    writer->fill = 0;
+    writer->written = 0;
+    writer->flash_us = 0;
+    writer->erase_us = 0;
+    writer->erased = 0;
+    writer->erase_skipped = 0;
+}
+
+bool rboot_sector_blank(uint32_t sector_addr)
+{
+    uint32_t buf[RBOOT_WRITE_CHUNK / 4];
+
+    for(uint32_t offs = 0; offs < SECTOR_SIZE; offs += sizeof(buf)) {
+        if(sdk_spi_flash_read(sector_addr + offs, buf, sizeof(buf)) != SPI_FLASH_RESULT_OK)
+            return false;
+        for(int i = 0; i < sizeof(buf) / 4; i++) {
+            if(buf[i] != 0xffffffff)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Erase sector if not blank and write len bytes of buffer to it, buffer is empty afterwards */
+static bool rboot_sector_commit(rboot_sector_writer *writer, uint32_t len)
+{
+    uint32_t start = sdk_system_get_time();
+    bool ok = true;
+    if(rboot_sector_blank(writer->sector_addr)) {
+        writer->erase_skipped++;
+    } else {
+        ok = (sdk_spi_flash_erase_sector(writer->sector_addr / SECTOR_SIZE) == SPI_FLASH_RESULT_OK);
+        writer->erased++;
+        writer->erase_us += sdk_system_get_time() - start;
+    }
+    ok = ok && (sdk_spi_flash_write(writer->sector_addr, writer->buffer, len) == SPI_FLASH_RESULT_OK);
+    writer->flash_us += sdk_system_get_time() - start;
+    if(!ok)
+        return false;
+
+    writer->sector_addr += SECTOR_SIZE;
+    writer->written += len;
+    writer->fill = 0;
+    return true;
+}
+
+bool rboot_sector_write(rboot_sector_writer *writer, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+    while(len > 0) {
+        uint32_t chunk = SECTOR_SIZE - writer->fill;
+        if(chunk > len)
+            chunk = len;
+        memcpy((uint8_t *)writer->buffer + writer->fill, src, chunk);
+        writer->fill += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if(writer->fill == SECTOR_SIZE && !rboot_sector_commit(writer, SECTOR_SIZE))
+            return false;
+    }
+    return true;
+}
+
+bool rboot_sector_filled(rboot_sector_writer *writer, uint32_t len)
+{
+    if(writer->fill != 0 || len > SECTOR_SIZE)
+        return false;
+    writer->fill = len;
+    if(len == SECTOR_SIZE)
+        return rboot_sector_commit(writer, SECTOR_SIZE);
+    return true;
+}
+
+bool rboot_sector_flush(rboot_sector_writer *writer)
+{
+    if(writer->fill == 0)
+        return true;
+    uint32_t len = (writer->fill + 3) & ~3;
+    memset((uint8_t *)writer->buffer + writer->fill, 0xff, len - writer->fill);
+    return rboot_sector_commit(writer, len);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -135,6 +135,9 @@ bool ICACHE_FLASH_ATTR rboot_get_last_boot_mode(uint8 *mode);
  */
 uint32_t rboot_get_slot_offset(uint8_t slot);
 
+/* Flash is read in blocks of this size (allocated for the duration of the check) */
+#define RBOOT_VERIFY_BLOCK 1024
+
 /** @description Verify basic image parameters - headers, CRC8 checksum.
 
     @param Offset of image to verify. Can use rboot_get_slot_offset() to find.
@@ -146,6 +149,34 @@ uint32_t rboot_get_slot_offset(uint8_t slot);
 bool rboot_verify_image(uint32_t offset, uint32_t *image_length, const char **error_message);
 
 
+/* @description Incremental image verification.
+
+   Same checks as rboot_verify_image, but the image is fed in pieces of any
+   size as it arrives, so no flash read back is needed after writing.
+*/
+typedef struct {
+    uint32_t offset;            /* bytes of image consumed */
+    uint32_t next;              /* offset where current state ends */
+    uint8_t state;
+    uint8_t checksum;
+    uint8_t remaining_sections;
+    bool is_new_header;         /* in initial section of a v1.2/rboot image, second header follows */
+    uint8_t header[8] __attribute__((aligned(4)));
+    const char *error;          /* set on first failure, further data is ignored */
+} rboot_verify_ctx;
+
+void rboot_verify_init(rboot_verify_ctx *ctx);
+
+void rboot_verify_update(rboot_verify_ctx *ctx, const void *data, uint32_t len);
+
+/** @description Check that a complete image with valid checksum was seen.
+
+    @param Optional pointer will return the total valid length of the image.
+    @param Optional pointer to a static human-readable error message if fails.
+**/
+bool rboot_verify_finish(rboot_verify_ctx *ctx, uint32_t *image_length, const char **error_message);
+
+
 /* @description Digest callback prototype, designed to be compatible with
    mbedtls digest functions (SHA, MD5, etc.)
 
@@ -172,6 +203,50 @@ typedef void (*rboot_digest_update_fn)(void * ctx, void *data, size_t data_len);
 **/
 bool rboot_digest_image(uint32_t offset, uint32_t image_length, rboot_digest_update_fn update_fn, void *update_ctx);
 
+/* @description Sector buffered flash writer.
+
+   Data of any length and alignment is collected in one word aligned RAM
+   buffer. Each full sector is erased and written with a single flash
+   operation, so the network buffers never need to be aligned or copied
+   around in place. The structure holds the 4KB buffer, allocate it once
+   per transfer.
+*/
+typedef struct {
+    uint32_t buffer[SECTOR_SIZE / 4];
+    uint32_t sector_addr;   /* flash address of the sector in buffer */
+    uint16_t fill;          /* bytes in buffer */
+    uint32_t written;       /* bytes written to flash */
+    uint32_t flash_us;      /* time spent in erase and write */
+    uint32_t erase_us;      /* part of flash_us spent erasing */
+    uint16_t erased;        /* sectors erased */
+    uint16_t erase_skipped; /* sectors already blank, e.g. erased in advance */
+} rboot_sector_writer;
+
+/** @description Check if a sector reads as all 0xff, so it needs no erase.
+    Reading stops at first programmed word, which is much faster than an erase.
+**/
+bool rboot_sector_blank(uint32_t sector_addr);
+
+/** @description Start writing at a sector aligned flash address
+**/
+void rboot_sector_init(rboot_sector_writer *writer, uint32_t start_addr);
+
+/** @description Append data, full sectors are erased and written to flash
+    @return False if flash operation failed
+**/
+bool rboot_sector_write(rboot_sector_writer *writer, const void *data, uint32_t len);
+
+/** @description Take len bytes placed directly into the empty buffer, e.g. by a decompressor.
+    A full sector is erased and written to flash.
+    @return False if flash operation failed or buffer wasn't empty
+**/
+bool rboot_sector_filled(rboot_sector_writer *writer, uint32_t len);
+
+/** @description Write remaining partial sector, padded with 0xff to a multiple of 4 bytes
+    @return False if flash operation failed
+**/
+bool rboot_sector_flush(rboot_sector_writer *writer);
+
 #ifdef __cplusplus
 }
 #endif
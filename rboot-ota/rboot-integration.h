@@ -38,5 +38,8 @@
 */
 #define BOOT_CONFIG_CHKSUM
 
+/* Temporary boot of a new OTA image, needs bootloader built with same option */
+#define BOOT_RTC_ENABLED
+
 
 #endif // __RBOOT_INTEGRATION_H__
@@ -0,0 +1,230 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <string.h>
+#include "espressif/esp_common.h"
+
+#include "sleep.h"
+#include "sml_server.h"
+#include "probe.h"
+#include "mqtt.h"
+#ifdef SLEEP_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+// Counters collected while a mode was active, summed up over all its windows
+typedef struct
+{
+	uint32_t	windows;
+	uint32_t	frames;
+	uint32_t	lost;
+	uint32_t	overflows;
+	uint32_t	framing_errors;
+	uint32_t	latency_count;
+	uint64_t	latency_sum;				// Cycles
+	uint32_t	retry;							// Windows to wait after next failure
+	uint32_t	blocked_until;			// Window number this mode may be tried again
+} sleep_mode_stats_t;
+
+
+static const enum sdk_sleep_type sleep_sdk_type[SLEEP_COUNT] =
+{
+	[SLEEP_LIGHT]		= WIFI_SLEEP_LIGHT,
+	[SLEEP_MODEM]		= WIFI_SLEEP_MODEM,
+	[SLEEP_NONE]		= WIFI_SLEEP_NONE
+};
+
+static const char* const sleep_level_str[SLEEP_COUNT] =
+{
+	[SLEEP_LIGHT]		= "light",
+	[SLEEP_MODEM]		= "modem",
+	[SLEEP_NONE]		= "none"
+};
+
+xTaskHandle sleep_task_handle = NULL;
+static sleep_mode_stats_t sleep_stats[SLEEP_COUNT];
+static sleep_level_t sleep_level = SLEEP_LIGHT;
+static uint32_t sleep_window = 0;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void sleep_task( void *pvParameters );
+static bool sleep_set( sleep_level_t level );
+static void sleep_latency( uint32_t* count, uint64_t* sum );
+static void sleep_pub( uint32_t frames, uint32_t lost, uint32_t permille );
+
+#ifdef SLEEP_DEBUG
+	#define sleep_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define sleep_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Needs to be called after station is connected, sleep modes are only available in station mode
+bool sleep_init( void )
+{
+	if( sleep_task_handle != NULL ) return false;
+
+	memset( sleep_stats, 0x00, sizeof(sleep_stats) );
+	for( uint8_t n=0; n<SLEEP_COUNT; n++ ) sleep_stats[n].retry = SLEEP_RETRY;
+
+	xTaskCreate( sleep_task, "sleep", SLEEP_TASK_STACK, NULL, SLEEP_TASK_PRIORITY, &sleep_task_handle );
+	if( sleep_task_handle == NULL )
+	{
+		sleep_debug_print( "%s: Error creating task\n", __FUNCTION__ );
+		return false;
+	}
+	return true;
+}
+
+
+
+// Starts with lowest power mode. After each window the loss rate of the active mode is checked:
+// Too many lost frames switch to next higher power mode and block the failed one for some windows.
+// When a lower mode is not blocked anymore it is tried again, so a mode is only kept as long as needed.
+static void sleep_task( void *pvParameters )
+{
+	TickType_t wake = xTaskGetTickCount();
+	sml_stats_t last, now;
+	uint32_t latency_last_count = 0, latency_count;
+	uint64_t latency_last_sum = 0, latency_sum;
+	sleep_mode_stats_t* mode;
+	uint32_t frames, lost, permille;
+
+	sleep_set( sleep_level );
+	sml_server_stats( &last );
+	sleep_latency( &latency_last_count, &latency_last_sum );
+
+	while (true)
+	{
+		vTaskDelayUntil( &wake, ((int32_t)SLEEP_WINDOW * 1000) / portTICK_RATE_MS );
+		sleep_window++;
+
+		// Overflows lose bytes, which might destroy a start sequence, so the frame is never seen as CRC error.
+		// They are counted as lost frame too, this gives an upper bound of loss.
+		sml_server_stats( &now );
+		frames = now.frames - last.frames;
+		lost = (now.crc_errors - last.crc_errors) + (now.aborted - last.aborted) + (now.overflows - last.overflows);
+
+		mode = &sleep_stats[sleep_level];
+		mode->windows++;
+		mode->frames += frames;
+		mode->lost += lost;
+		mode->overflows += now.overflows - last.overflows;
+		mode->framing_errors += now.framing_errors - last.framing_errors;
+		last = now;
+
+		// Probe histograms might be reset remotely, start over then
+		sleep_latency( &latency_count, &latency_sum );
+		if( latency_count < latency_last_count )
+		{
+			latency_last_count = 0;
+			latency_last_sum = 0;
+		}
+		mode->latency_count += latency_count - latency_last_count;
+		mode->latency_sum += latency_sum - latency_last_sum;
+		latency_last_count = latency_count;
+		latency_last_sum = latency_sum;
+
+		permille = ((frames + lost) > 0) ? ((lost * 1000) / (frames + lost)) : 0;
+		sleep_debug_print( "%s: %s, frames %u, lost %u (%u permille)\n", __FUNCTION__,
+		                   sleep_level_str[sleep_level], frames, lost, permille );
+		sleep_pub( frames, lost, permille );
+
+		if( (frames + lost) < SLEEP_MIN_FRAMES ) continue;
+
+		if( (permille > SLEEP_LOSS_MAX) && (sleep_level < SLEEP_NONE) )
+		{
+			mode->blocked_until = sleep_window + mode->retry;
+			mode->retry *= 2;
+			if( mode->retry > SLEEP_RETRY_MAX ) mode->retry = SLEEP_RETRY_MAX;
+			sleep_set( sleep_level + 1 );
+		}
+		else if( (sleep_level > SLEEP_LIGHT) && (sleep_window >= sleep_stats[sleep_level - 1].blocked_until) )
+		{
+			sleep_set( sleep_level - 1 );
+		}
+	}
+}
+
+
+
+static bool sleep_set( sleep_level_t level )
+{
+	bool ret;
+
+	sleep_debug_print( "%s: Setting sleep mode %s\n", __FUNCTION__, sleep_level_str[level] );
+	if( sdk_wifi_get_opmode() != STATION_MODE ) return false;
+
+	ret = sdk_wifi_set_sleep_type( sleep_sdk_type[level] );
+	if( ret == false )
+	{
+		sleep_debug_print( "%s: Failed to set sleep mode\n", __FUNCTION__ );
+		return false;
+	}
+	sleep_level = level;
+	return true;
+}
+
+
+
+// Publish latency is time in mqtt queue plus time on the wire
+static void sleep_latency( uint32_t* count, uint64_t* sum )
+{
+	uint32_t n;
+	uint64_t cycles;
+
+	probe_get( PROBE_QUEUE, count, sum );
+	probe_get( PROBE_SEND, &n, &cycles );
+	*sum += cycles;
+}
+
+
+
+// Current window and counters of all modes since boot, latency in us:
+// {"mode":"light","frames":60,"lost":1,"loss":16,"modes":[{"mode":"light","win":3,...},...]}
+static void sleep_pub( uint32_t frames, uint32_t lost, uint32_t permille )
+{
+	static char payload[MQTT_BUF_SIZE / 2];			// Not on the stack of sleep task, which is the only caller
+	sleep_mode_stats_t* mode;
+	uint32_t latency;
+	size_t len;
+	int ret;
+
+	// Failed formatting counts as too long
+	ret = snprintf( payload, sizeof(payload), "{\"mode\":\"%s\",\"frames\":%u,\"lost\":%u,\"loss\":%u,\"modes\":[",
+	                sleep_level_str[sleep_level], frames, lost, permille );
+	len = (ret < 0) ? sizeof(payload) : (size_t)ret;
+	for( uint8_t n=0; (n < SLEEP_COUNT) && (len < sizeof(payload)); n++ )
+	{
+		mode = &sleep_stats[n];
+		latency = (mode->latency_count > 0) ? (uint32_t)(mode->latency_sum / mode->latency_count) / PROBE_CYCLES_PER_US : 0;
+		ret = snprintf( &payload[len], sizeof(payload) - len,
+		                "%s{\"mode\":\"%s\",\"win\":%u,\"frames\":%u,\"lost\":%u,\"ovf\":%u,\"frm\":%u,\"latency\":%u}",
+		                (n == 0) ? "" : ",", sleep_level_str[n], mode->windows, mode->frames, mode->lost,
+		                mode->overflows, mode->framing_errors, latency );
+		len = (ret < 0) ? sizeof(payload) : (len + ret);
+	}
+	if( len >= (sizeof(payload) - 2) )
+	{
+		mqtt_pub( "Sleep", "{\"error\":\"Too long\"}" );
+		return;
+	}
+	strcpy( &payload[len], "]}" );
+	mqtt_pub( "Sleep", "%s", payload );
+}
@@ -0,0 +1,51 @@
+#ifndef SLEEP_H_
+#define SLEEP_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stdbool.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define SLEEP_DEBUG
+
+#define SLEEP_TASK_PRIORITY						1
+#define SLEEP_TASK_STACK							272		// Payload buffer is static
+
+#define SLEEP_WINDOW									300		// s, measurement interval per decision
+#define SLEEP_MIN_FRAMES							20		// Fewer frames in window give no decision (meter silent)
+#define SLEEP_LOSS_MAX								5			// permille of frames lost before a higher power mode is used
+#define SLEEP_RETRY										24		// Windows before a failed mode is tried again, doubled on each failure
+#define SLEEP_RETRY_MAX								288		// Limit of doubled retry windows, one day
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+// Ordered by power consumption, lowest first
+typedef enum
+{
+	SLEEP_LIGHT,
+	SLEEP_MODEM,
+	SLEEP_NONE,
+	SLEEP_COUNT
+} sleep_level_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+bool sleep_init( void );
+
+
+
+#endif // SLEEP_H_
@@ -3,16 +3,20 @@
 #include <semphr.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <espressif/sdk_private.h>
 #include <math.h>
 
 #include <sml/sml_file.h>
 #include <sml/sml_value.h>
+#include <sml/sml_crc16.h>
 #include <libsml/examples/unit.h>
 
 #include "sml_server.h"
+#include "sml_uart.h"
 #include "mqtt.h"
 #include "buffer.h"
+#include "probe.h"
+#include "trace.h"
+#include "boot.h"
 #ifdef SML_DEBUG
 	#include "debug.h"
 #endif
@@ -22,29 +26,30 @@
 // Definitions coppied from sml_transport.c
 //*****************************************************************************
 
-#define MC_SML_BUFFER_LEN 8096
-
 unsigned char esc_seq[] = {0x1b, 0x1b, 0x1b, 0x1b};
 unsigned char start_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01};
 unsigned char end_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x1a};
 
+// Current power in full resolution, value groups A to E
+static const unsigned char obis_extended[] = {1, 0, 16, 7, 0};
+
 
 //*****************************************************************************
 // Local variables and definitions
 //*****************************************************************************
 
 xTaskHandle uart_task_handle = NULL;
-static xSemaphoreHandle uart_sem = NULL;
-	
-#define UART0 						0
-#define UART0_RX_SIZE  		128 // ESP8266 UART HW FIFO size
+static volatile sml_stats_t sml_stats;
 
-unsigned char rx_buffer[MC_SML_BUFFER_LEN];
+unsigned char rx_buffer[SML_BUFFER_LEN];
 #ifdef SML_DEBUG
 	char hex_buffer[DEBUG_STRING_LEN];
 #else	
 #endif
 
+_Static_assert( (sizeof(rx_buffer) + (UART_TASK_STACK * sizeof(StackType_t))) <= SML_RAM_BUDGET,
+                "Frame buffer and uart task stack exceed SML_RAM_BUDGET" );
+
 
 
 //*****************************************************************************
@@ -52,7 +57,8 @@ unsigned char rx_buffer[MC_SML_BUFFER_LEN];
 //*****************************************************************************
 
 static void uart_task( void *pvParameters );
-static void uart_rx_init( void );
+static bool sml_transport_crc_ok( unsigned char *buffer, size_t buffer_len );
+static unsigned int sml_transport_find_start( unsigned char *buffer, unsigned int len );
 #ifdef SML_DEBUG
 	#define sml_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
 #else	
@@ -67,15 +73,37 @@ static void uart_rx_init( void );
 
 bool sml_server_init( void )
 {
+	if (sml_uart_init() == false) return false;
+
 	xTaskCreate( uart_task, 
 	             "uart_task", 
 							 UART_TASK_STACK, 
 							 NULL, 
 							 UART_TASK_PRIORITY, 
 							 &uart_task_handle );
-	
-	uart_rx_init();
-	return true;
+	return (uart_task_handle != NULL);
+}
+
+
+
+void sml_server_stats( sml_stats_t* stats )
+{
+	taskENTER_CRITICAL();
+	*stats = *(sml_stats_t*)&sml_stats;
+	sml_uart_errors( &stats->overflows, &stats->framing_errors );
+	taskEXIT_CRITICAL();
+}
+
+
+
+// Last two bytes of end sequence hold CRC16 over complete frame before them
+static bool sml_transport_crc_ok( unsigned char *buffer, size_t buffer_len )
+{
+	uint16_t crc;
+
+	if (buffer_len < 16) return false;
+	crc = ((uint16_t)buffer[buffer_len-2] << 8) | buffer[buffer_len-1];
+	return (sml_crc16_calculate(buffer, buffer_len - 2) == crc);
 }
 
 
@@ -87,7 +115,10 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 	int i, n;
 	char* value_str;
 	const char *unit_str = NULL;
-	char obis_str[20];
+	char obis_str[24];		// Up to "255-255:255.255.255*255"
+	uint32_t parse_start;
+	bool extended = false;
+	bool published = false;
 
 	#ifdef SML_DEBUG
 		sml_debug_print("%s: File:\n", __FUNCTION__);
@@ -108,7 +139,14 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 	sml_debug_print("%s: Parsing %d bytes  ... \n", __FUNCTION__, buffer_len);
 	// the buffer contains the whole message, with transport escape sequences.
 	// these escape sequences are stripped here.
+	parse_start = probe_now();
 	file = sml_file_parse(buffer + 8, buffer_len - 16);
+	probe_record(PROBE_PARSE, parse_start);
+	if (file == NULL)
+	{
+		sml_debug_print("%s: Parsing failed\n", __FUNCTION__);
+		return;
+	}
 	// the sml file is parsed now
 	sml_debug_print("%s: %d messages found\n", __FUNCTION__, file->messages_len);
 	
@@ -120,13 +158,23 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 	for (i = 0; i < file->messages_len; i++)
 	{
 		sml_message *message = file->messages[i];
+		// Broken frames with valid CRC can leave parts out
+		if ((message == NULL) || (message->message_body == NULL) ||
+		    (message->message_body->tag == NULL) || (message->message_body->data == NULL))
+		{
+			sml_debug_print("%s: Message %d incomplete, skipped\n", __FUNCTION__, i);
+			continue;
+		}
 		sml_debug_print("Message %d: tag=%d\n", i, *message->message_body->tag);
 
 		if (*message->message_body->tag == SML_MESSAGE_OPEN_RESPONSE)
 		{
 			sml_open_response* open = (sml_open_response*) message->message_body->data;
 		
-			sml_debug_print("time %d, verison %d\n", open->ref_time->data.timestamp, open->sml_version);
+			// Both are optional
+			sml_debug_print("time %u, version %u\n",
+				((open->ref_time != NULL) && (open->ref_time->data.timestamp != NULL)) ? *open->ref_time->data.timestamp : 0,
+				(open->sml_version != NULL) ? *open->sml_version : 0);
 			
 		}
 		else if (*message->message_body->tag == SML_MESSAGE_GET_LIST_RESPONSE)
@@ -141,26 +189,37 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 					sml_debug_print( "%s: Error in data stream. entry->value should not be NULL. Skipping this.\n", __FUNCTION__);
 					continue;
 				}
+				if ((entry->obj_name == NULL) || (entry->obj_name->len < 6))
+				{
+					sml_debug_print("%s: OBIS name missing or too short, skipped\n", __FUNCTION__);
+					continue;
+				}
+				unit_str = NULL;
 				
 				snprintf(obis_str, sizeof(obis_str), "%d-%d:%d.%d.%d*%d",
 					entry->obj_name->str[0], entry->obj_name->str[1],
 					entry->obj_name->str[2], entry->obj_name->str[3],
 					entry->obj_name->str[4], entry->obj_name->str[5]);
 				obis_str[sizeof(obis_str)-1] = '\0';		// Ensure string termination when snprintf fails
+				if ((entry->obj_name->len >= sizeof(obis_extended)) &&
+				    (memcmp(entry->obj_name->str, obis_extended, sizeof(obis_extended)) == 0))
+				{
+					extended = true;
+				}
 
 				if (entry->value->type == SML_TYPE_OCTET_STRING)
 				{
 					sml_value_to_strhex(entry->value, &value_str, true);
 
 					sml_debug_print("%s <str> %s\n", obis_str, value_str);
-					mqtt_pub(obis_str, "{\"value\":\"%s\"}", value_str);
+					published |= mqtt_pub(obis_str, "{\"value\":\"%s\"}", value_str);
 					
 					free(value_str);
 				}
 				else if (entry->value->type == SML_TYPE_BOOLEAN)
 				{
 					sml_debug_print("%s <bool> %s\n", obis_str, (entry->value->data.boolean?"true":"false"));
-					mqtt_pub(obis_str, "{\"value\":%s}", (entry->value->data.boolean?"true":"false"));
+					published |= mqtt_pub(obis_str, "{\"value\":%s}", (entry->value->data.boolean?"true":"false"));
 				}
 				else if (((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_INTEGER) ||
 				         ((entry->value->type & SML_TYPE_FIELD) == SML_TYPE_UNSIGNED))
@@ -177,7 +236,7 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 					}
 	
 					sml_debug_print("%s <value> %.*f %s\n", obis_str, prec, value, unit_str?unit_str:"");
-					mqtt_pub(obis_str, "{\"value\":%.*f,\"unit\":\"%s\"}", prec, value, unit_str?unit_str:"");
+					published |= mqtt_pub(obis_str, "{\"value\":%.*f,\"unit\":\"%s\"}", prec, value, unit_str?unit_str:"");
 				}
 				else
 				{
@@ -187,52 +246,38 @@ void sml_transport_receiver(unsigned char *buffer, size_t buffer_len)
 		}
 	}
 
+	if (extended) sml_stats.extended++;
+	if (published) boot_mark( BOOT_VALUE );
+
 	// free the malloc'd memory
 	sml_file_free(file);
 }
 
 
-size_t sml_read(unsigned char *buffer, size_t len)
+// Offset of a start sequence which ends in the last 4 bytes of buffer, 0 if there is none
+static unsigned int sml_transport_find_start( unsigned char *buffer, unsigned int len )
 {
-	size_t n;
-	unsigned char byte;
-	#ifdef SML_DEBUG
-		char debug_str[10];
-		char debug_buf[sizeof(debug_str)*3];
-	#endif
-	
-	for (n=0; n<len; n++)
+	unsigned int end;
+
+	for (end = len - 3; end <= len; end++)
 	{
-		if (!(UART(UART0).STATUS & (UART_STATUS_RXFIFO_COUNT_M << UART_STATUS_RXFIFO_COUNT_S))) 
-		{
-			_xt_isr_unmask(1 << INUM_UART);
-			if (!xSemaphoreTake(uart_sem, portMAX_DELAY)) 
-			{
-				sml_debug_print("%s: Failed to get semaphore! Exiting uart task\n", __FUNCTION__);
-				vTaskDelete(NULL);
-			}
-		}
-		byte = UART(UART0).FIFO & (UART_FIFO_DATA_M << UART_FIFO_DATA_S);
-		buffer[n] = byte;
-		#ifdef SML_DEBUG
-			if (n < (sizeof(debug_str)-1))
-			{
-				sprintf(&debug_str[n], "%c", ((byte>31)?byte:' '));				
-				sprintf(&debug_buf[n*3], "%02x ", byte);
-			}
-		#endif
+		if ((buffer[end-1] == 0x01) && (memcmp(&buffer[end-8], start_seq, sizeof(start_seq)) == 0)) return end - 8;
 	}
-	
-//	sml_debug_print("%s: Received '%s' %s\n", __FUNCTION__, debug_str, debug_buf);
-	return n;
+	return 0;
 }
 
 
 
 // Adopted from sml_transport.c
+// Lost bytes shift the frame against its 4 byte grid, so its end sequence is not found.
+// A start sequence inside a frame, aligned or not, breaks it off and reading starts over
+// with the new frame, so only the broken frame is lost.
 size_t sml_transport_read(unsigned char *buf, size_t max_len) 
 {
 	unsigned int len = 0;
+	unsigned int start;
+	unsigned int escapes;
+	uint32_t frame_start;
 
 	memset(buf, 0, max_len);
 
@@ -243,7 +288,7 @@ size_t sml_transport_read(unsigned char *buf, size_t max_len)
 	}
 
 	while (len < 8) {
-		if (sml_read(&buf[len], 1) == 0)
+		if (sml_uart_read(&buf[len], 1) == 0)
 		{
 			sml_debug_print("%s: Read failed\n", __FUNCTION__);
 			return 0;
@@ -251,17 +296,24 @@ size_t sml_transport_read(unsigned char *buf, size_t max_len)
 
 		if ((buf[len] == 0x1b && len < 4) || (buf[len] == 0x01 && len >= 4)) {
 			len++;
+		} else if (buf[len] == 0x1b) {
+			// Escape might start the real sequence, keep last 4 of a longer run
+			sml_stats.skipped += (len == 4) ? 1 : len;
+			len = (len == 4) ? 4 : 1;
+			buf[0] = 0x1b;
 		} else {
+			sml_stats.skipped += len + 1;
 			len = 0;
 		}
 	}
 
 	sml_debug_print("%s: Found start sequence\n", __FUNCTION__);
+	frame_start = probe_now();
 	
 	// found start sequence
 	while ((len + 8) < max_len)
 	{
-		if (sml_read(&buf[len], 4) == 0)
+		if (sml_uart_read(&buf[len], 4) == 0)
 		{
 			sml_debug_print("%s: Read failed\n", __FUNCTION__);
 			return 0;
@@ -269,100 +321,108 @@ size_t sml_transport_read(unsigned char *buf, size_t max_len)
 
 		if (memcmp(&buf[len], esc_seq, 4) == 0)
 		{
-			// found esc sequence
-			len += 4;
-			if (sml_read(&buf[len], 4) == 0)
+			// found esc sequence, another one might start next frame after end sequence was lost.
+			// Pairs are escaped 1b1b1b1b of data, only an odd count is followed by a control word.
+			escapes = 0;
+			do
 			{
-				sml_debug_print("%s: Failed to read\n", __FUNCTION__);
-				return 0;
-			}
+				escapes++;
+				len += 4;
+				if (sml_uart_read(&buf[len], 4) == 0)
+				{
+					sml_debug_print("%s: Failed to read\n", __FUNCTION__);
+					return 0;
+				}
+			} while (((len + 8) < max_len) && (memcmp(&buf[len], esc_seq, 4) == 0));
 
-			if (buf[len] == 0x1a)
+			if ((escapes % 2) == 0)
+			{
+				// Word after escaped data is data too
+				len += 4;
+				continue;
+			}
+			// Byte after 0x1a counts padding, 0 to 3
+			if ((buf[len] == 0x1a) && (buf[len+1] < 4))
 			{
 				sml_debug_print("%s: Found end sequence\n", __FUNCTION__);
 				// found end sequence
 				len += 4;
+				probe_record(PROBE_FRAME, frame_start);
 				return len;
+			} else if (memcmp(&buf[len], &start_seq[4], 4) == 0) {
+				sml_debug_print("%s: Start sequence inside frame, starting over\n", __FUNCTION__);
+				sml_stats.aborted++;
+				memcpy(buf, start_seq, sizeof(start_seq));
+				len = sizeof(start_seq);
+				frame_start = probe_now();
+				continue;
 			} else {
-				// don't read other escaped sequences yet
+				// Escaped data or broken end sequence, taken as data. CRC check decides
+				// about the frame, and a start sequence which follows is still found.
 				sml_debug_print("%s: Unrecognized sequence\n", __FUNCTION__);
-				return 0;
+				len += 4;
+				continue;
+			}
+		}
+
+		start = sml_transport_find_start(buf, len + 4);
+		if (start > 0)
+		{
+			// Not aligned, so read up to 4 byte grid of new frame
+			sml_debug_print("%s: Start sequence inside frame, starting over\n", __FUNCTION__);
+			sml_stats.aborted++;
+			len = len + 4 - start;
+			memmove(buf, &buf[start], len);
+			if ((len % 4) != 0)
+			{
+				if (sml_uart_read(&buf[len], 4 - (len % 4)) == 0)
+				{
+					sml_debug_print("%s: Read failed\n", __FUNCTION__);
+					return 0;
+				}
+				len += 4 - (len % 4);
 			}
+			frame_start = probe_now();
+			continue;
 		}
 		len += 4;
 	}
 
 	sml_debug_print("%s: Message to long for buffer (%d)\n", __FUNCTION__, max_len);
+	sml_stats.aborted++;
 	return 0;
 }
 
 
 
-// Adopted from sml_transport.c, function sml_transport_listen()
-static void uart_task( void *pvParameters )
+// Reads next frame from UART and publishes its values.
+// Returns false when no valid frame was read. Also used by host benchmark.
+bool sml_server_poll( void )
 {
 	size_t bytes;
 
-	while (true)
+	bytes = sml_transport_read(rx_buffer, SML_BUFFER_LEN);
+	if (bytes == 0) return false;
+
+	if (sml_transport_crc_ok(rx_buffer, bytes) == false)
 	{
-		bytes = sml_transport_read(rx_buffer, MC_SML_BUFFER_LEN);
-		if (bytes > 0)
-		{	
-			sml_transport_receiver(rx_buffer, bytes);
-		}
+		sml_debug_print("%s: CRC error, frame dropped\n", __FUNCTION__);
+		sml_stats.crc_errors++;
+		return false;
 	}
+	sml_stats.frames++;
+	boot_mark( BOOT_FRAME );
+	sml_transport_receiver(rx_buffer, bytes);
+	return true;
 }
 
 
 
-// Following code is copied from 'extras/stdin_uart_interrupt/stdin_uart_interrupt.c'.
-// It needs to be copied here for faster implementation. Using functions from there is not possible because of inaccessible static variables 
-// Extra component is not needed therfore anymore.
-
-IRAM void uart0_rx_handler(void *arg)
+// Adopted from sml_transport.c, function sml_transport_listen()
+static void uart_task( void *pvParameters )
 {
-	if (!UART(UART0).INT_STATUS & UART_INT_STATUS_RXFIFO_FULL) 
-	{
-			return;
-	}
-	if (UART(UART0).INT_STATUS & UART_INT_STATUS_RXFIFO_FULL) 
-	{
-		UART(UART0).INT_CLEAR = UART_INT_CLEAR_RXFIFO_FULL;
-		if (UART(UART0).STATUS & (UART_STATUS_RXFIFO_COUNT_M << UART_STATUS_RXFIFO_COUNT_S)) 
-		{
-			long int xHigherPriorityTaskWoken;
-			_xt_isr_mask(1 << INUM_UART);
-			_xt_clear_ints(1<<INUM_UART);
-			xSemaphoreGiveFromISR(uart_sem, &xHigherPriorityTaskWoken);
-			if(xHigherPriorityTaskWoken) portYIELD();
-		}
-	} 
-	else 
+	while (true)
 	{
-		sml_debug_print("%s: Unexpected uart irq, INT_STATUS 0x%02x\n", __FUNCTION__, UART(UART0).INT_STATUS);
+		sml_server_poll();
 	}
 }
-
-
-static void uart_rx_init(void)
-{
-	int trig_lvl = 1;
-	uart_sem = xSemaphoreCreateCounting(UART0_RX_SIZE, 0);
-
-	_xt_isr_attach(INUM_UART, uart0_rx_handler, NULL);
-	_xt_isr_unmask(1 << INUM_UART);
-
-	// reset the rx fifo
-	uint32_t conf = UART(UART0).CONF0;
-	UART(UART0).CONF0 = conf | UART_CONF0_RXFIFO_RESET;
-	UART(UART0).CONF0 = conf & ~UART_CONF0_RXFIFO_RESET;
-
-	// set rx fifo trigger
-	UART(UART0).CONF1 |= (trig_lvl & UART_CONF1_RXFIFO_FULL_THRESHOLD_M) << UART_CONF1_RXFIFO_FULL_THRESHOLD_S;
-
-	// clear all interrupts
-	UART(UART0).INT_CLEAR = 0x1ff;
-
-	// enable rx_interrupt
-	UART(UART0).INT_ENABLE = UART_INT_ENABLE_RXFIFO_FULL;
-}
@@ -2,6 +2,8 @@
 #define SML_SERVER_H_
 
 #include "stdbool.h"
+#include "stdint.h"
+#include "stddef.h"
 
 
 
@@ -13,8 +15,12 @@
 #define SML_DEBUG
 
 #define UART_TASK_PRIORITY     	2
-#define UART_TASK_STACK					5000
+#define UART_TASK_STACK					1280		// Words, host use is 3.7 KB. Confirm with free words in Diag/Task/uart on the device
 #define UART_BUFFER_LEN					512
+#define SML_BUFFER_LEN					8096		// Longest frame, like sml_transport.c of libsml
+
+// Bytes of frame buffer and task stack, checked at compile time
+#define SML_RAM_BUDGET					(16 * 1024)
 
 
 
@@ -22,6 +28,18 @@
 // Data structures
 //*****************************************************************************
 
+// Counters since boot, only increasing. Users build differences over their interval.
+typedef struct
+{
+	uint32_t	frames;						// Complete frames with valid CRC
+	uint32_t	crc_errors;				// Complete frames with wrong CRC, dropped
+	uint32_t	overflows;				// UART RX FIFO overflows
+	uint32_t	framing_errors;		// UART framing errors
+	uint32_t	extended;					// Frames with 1-0:16.7.0, only sent by meter after PIN entry
+	uint32_t	aborted;					// Frames broken off by a new start sequence, or too long for buffer
+	uint32_t	skipped;					// Bytes dropped while searching start sequence
+} sml_stats_t;
+
 
 
 //*****************************************************************************
@@ -29,6 +47,9 @@
 //*****************************************************************************
 
 bool sml_server_init( void );
+void sml_server_stats( sml_stats_t* stats );
+bool sml_server_poll( void );
+void sml_transport_receiver( unsigned char *buffer, size_t buffer_len );
 
 
 
@@ -0,0 +1,144 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <semphr.h>
+#include <espressif/sdk_private.h>
+
+#include "sml_uart.h"
+#include "sml_server.h"
+#include "probe.h"
+#include "trace.h"
+#ifdef SML_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define UART0 						0
+#define UART0_RX_SIZE  		128 // ESP8266 UART HW FIFO size
+
+static xSemaphoreHandle uart_sem = NULL;
+static volatile uint32_t uart_isr_ccount = 0;
+static volatile uint32_t uart_overflows = 0;
+static volatile uint32_t uart_framing_errors = 0;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+#ifdef SML_DEBUG
+	#define sml_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else	
+	#define sml_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Following code is copied from 'extras/stdin_uart_interrupt/stdin_uart_interrupt.c'.
+// It needs to be copied here for faster implementation. Using functions from there is not possible because of inaccessible static variables 
+// Extra component is not needed therfore anymore.
+
+IRAM void uart0_rx_handler(void *arg)
+{
+	uint32_t status = UART(UART0).INT_STATUS;
+
+	uart_isr_ccount = probe_now();
+	trace_isr(TRACE_IRQ_UART);
+	if (!status) 
+	{
+			return;
+	}
+	// Error counters for sleep policy. Bytes of an overflow are lost, so the frame fails CRC later.
+	if (status & (UART_INT_STATUS_RXFIFO_OVERFLOW | UART_INT_STATUS_FRAMING_ERR))
+	{
+		if (status & UART_INT_STATUS_RXFIFO_OVERFLOW) uart_overflows++;
+		if (status & UART_INT_STATUS_FRAMING_ERR) uart_framing_errors++;
+		UART(UART0).INT_CLEAR = UART_INT_CLEAR_RXFIFO_OVERFLOW | UART_INT_CLEAR_FRAMING_ERR;
+		if (!(status & UART_INT_STATUS_RXFIFO_FULL)) return;
+	}
+	if (status & UART_INT_STATUS_RXFIFO_FULL) 
+	{
+		UART(UART0).INT_CLEAR = UART_INT_CLEAR_RXFIFO_FULL;
+		if (UART(UART0).STATUS & (UART_STATUS_RXFIFO_COUNT_M << UART_STATUS_RXFIFO_COUNT_S)) 
+		{
+			long int xHigherPriorityTaskWoken;
+			_xt_isr_mask(1 << INUM_UART);
+			_xt_clear_ints(1<<INUM_UART);
+			xSemaphoreGiveFromISR(uart_sem, &xHigherPriorityTaskWoken);
+			if(xHigherPriorityTaskWoken) portYIELD();
+		}
+	} 
+	else 
+	{
+		sml_debug_print("%s: Unexpected uart irq, INT_STATUS 0x%02x\n", __FUNCTION__, UART(UART0).INT_STATUS);
+	}
+}
+
+
+
+bool sml_uart_init( void )
+{
+	int trig_lvl = 1;
+	uart_sem = xSemaphoreCreateCounting(UART0_RX_SIZE, 0);
+	if (uart_sem == NULL) return false;
+
+	_xt_isr_attach(INUM_UART, uart0_rx_handler, NULL);
+	_xt_isr_unmask(1 << INUM_UART);
+
+	// reset the rx fifo
+	uint32_t conf = UART(UART0).CONF0;
+	UART(UART0).CONF0 = conf | UART_CONF0_RXFIFO_RESET;
+	UART(UART0).CONF0 = conf & ~UART_CONF0_RXFIFO_RESET;
+
+	// set rx fifo trigger
+	UART(UART0).CONF1 |= (trig_lvl & UART_CONF1_RXFIFO_FULL_THRESHOLD_M) << UART_CONF1_RXFIFO_FULL_THRESHOLD_S;
+
+	// clear all interrupts
+	UART(UART0).INT_CLEAR = 0x1ff;
+
+	// enable rx_interrupt, errors are only counted
+	UART(UART0).INT_ENABLE = UART_INT_ENABLE_RXFIFO_FULL | UART_INT_ENABLE_RXFIFO_OVERFLOW | UART_INT_ENABLE_FRAMING_ERR;
+	return true;
+}
+
+
+
+// Blocks until len bytes are received, returns 0 on failure
+size_t sml_uart_read( unsigned char *buffer, size_t len )
+{
+	size_t n;
+
+	for (n=0; n<len; n++)
+	{
+		if (!(UART(UART0).STATUS & (UART_STATUS_RXFIFO_COUNT_M << UART_STATUS_RXFIFO_COUNT_S))) 
+		{
+			_xt_isr_unmask(1 << INUM_UART);
+			if (!xSemaphoreTake(uart_sem, portMAX_DELAY)) 
+			{
+				sml_debug_print("%s: Failed to get semaphore! Exiting uart task\n", __FUNCTION__);
+				vTaskDelete(NULL);
+			}
+			probe_record(PROBE_UART_WAKEUP, uart_isr_ccount);
+		}
+		buffer[n] = UART(UART0).FIFO & (UART_FIFO_DATA_M << UART_FIFO_DATA_S);
+	}
+	return n;
+}
+
+
+
+// Counters since boot
+void sml_uart_errors( uint32_t* overflows, uint32_t* framing_errors )
+{
+	*overflows = uart_overflows;
+	*framing_errors = uart_framing_errors;
+}
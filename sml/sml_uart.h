@@ -0,0 +1,22 @@
+#ifndef SML_UART_H_
+#define SML_UART_H_
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "stddef.h"
+
+
+
+//*****************************************************************************
+// Hardware access of SML receiver.
+// Transport and parser in sml_server.c only use these functions, so they can
+// be built for host with another implementation, see tools/host.
+//*****************************************************************************
+
+bool sml_uart_init( void );
+size_t sml_uart_read( unsigned char *buffer, size_t len );
+void sml_uart_errors( uint32_t* overflows, uint32_t* framing_errors );
+
+
+
+#endif // SML_UART_H_
@@ -0,0 +1,258 @@
+// Host check and benchmark of ring buffer in buffer.h
+//
+//	cc -O2 -I. tools/buffer_bench.c -o buffer_bench -lpthread && ./buffer_bench
+//
+// Compares random operations with a simple model, runs producer and consumer
+// in two threads like interrupt and task, then measures throughput.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "buffer.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define BENCH_SIZE										1024
+#define BENCH_BYTES										(256UL * 1024 * 1024)
+#define BENCH_CHUNK										64
+
+static int errors = 0;
+
+#define check( cond )		do { if( !(cond) ) { printf( "%s:%d: %s\n", __FILE__, __LINE__, #cond ); errors++; } } while( 0 )
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+static void check_init( void )
+{
+	uint8_t data[64];
+	buffer_t buf;
+
+	check( buffer_init(data, 48, &buf) == false );
+	check( buffer_init(data, 0, &buf) == false );
+	check( buffer_init(data, 64, &buf) == true );
+	check( buffer_used(&buf) == 0 );
+	check( buffer_free(&buf) == 64 );
+	check( buffer_get_byte(&buf) == 0x00 );
+}
+
+
+
+// Random sequence of all operations, compared with a linear model of content
+static void check_model( void )
+{
+	static uint8_t data[16], model[1 << 16], out[32];
+	uint32_t model_head = 0, model_tail = 0;
+	uint8_t next = 0, tmp[32], *ptr;
+	uint16_t len, n;
+	buffer_t buf;
+
+	buffer_init( data, sizeof(data), &buf );
+	srand( 1 );
+	for( uint32_t step=0; step<200000; step++ )
+	{
+		// Indices wrap every 65536 bytes, model is reset when empty
+		if( model_head == model_tail ) model_head = model_tail = 0;
+		len = rand() % 20;
+		switch( rand() % 6 )
+		{
+			case 0:
+				for( n=0; n<len; n++ ) tmp[n] = next++;
+				if( buffer_put_data(tmp, len, &buf) )
+				{
+					memcpy( &model[model_head], tmp, len );
+					model_head += len;
+				}
+				else
+				{
+					check( len > 16 - (model_head - model_tail) );
+					next -= len;
+				}
+				break;
+
+			case 1:
+				if( buffer_put_byte(next, &buf) ) model[model_head++] = next++;
+				else check( model_head - model_tail == 16 );
+				break;
+
+			case 2:
+				n = buffer_get_data( out, len, &buf );
+				check( n == ((len < model_head - model_tail) ? len : model_head - model_tail) );
+				check( memcmp(out, &model[model_tail], n) == 0 );
+				model_tail += n;
+				break;
+
+			case 3:
+				if( model_head != model_tail ) check( buffer_get_byte(&buf) == model[model_tail++] );
+				break;
+
+			case 4:
+				n = buffer_write_span( &buf, &ptr );
+				check( n <= 16 - (model_head - model_tail) );
+				check( n > 0 || model_head - model_tail == 16 );
+				if( n > len ) n = len;
+				for( uint16_t i=0; i<n; i++ ) ptr[i] = model[model_head++] = next++;
+				buffer_commit( &buf, n );
+				break;
+
+			default:
+				n = buffer_read_span( &buf, &ptr );
+				check( n <= model_head - model_tail );
+				check( n > 0 || model_head == model_tail );
+				if( n > len ) n = len;
+				check( memcmp(ptr, &model[model_tail], n) == 0 );
+				model_tail += n;
+				buffer_consume( &buf, n );
+				break;
+		}
+		check( buffer_used(&buf) == model_head - model_tail );
+	}
+}
+
+
+
+static void check_format( void )
+{
+	uint8_t data[16];
+	char out[17];
+	buffer_t buf;
+	uint16_t n;
+
+	buffer_init( data, sizeof(data), &buf );
+	check( buffer_put_format(&buf, "%d-%s", 12, "abc") == true );
+	check( buffer_used(&buf) == 6 );
+	check( buffer_get_data(out, 6, &buf) == 6 );
+
+	// Wraps at end of data, so it is copied in two parts
+	check( buffer_put_format(&buf, "%s", "0123456789") == true );
+	n = buffer_get_data( out, sizeof(out) - 1, &buf );
+	out[n] = '\0';
+	check( strcmp(out, "0123456789") == 0 );
+
+	// Exactly full, and one more does not fit
+	check( buffer_put_format(&buf, "%s", "0123456789abcdef") == true );
+	check( buffer_free(&buf) == 0 );
+	check( buffer_put_format(&buf, "x") == false );
+	n = buffer_get_data( out, sizeof(out) - 1, &buf );
+	out[n] = '\0';
+	check( strcmp(out, "0123456789abcdef") == 0 );
+}
+
+
+
+//*****************************************************************************
+// Producer and consumer threads
+//*****************************************************************************
+
+static buffer_t spsc;
+static uint8_t spsc_data[BENCH_SIZE];
+
+static void* producer( void* arg )
+{
+	uint64_t total = *(uint64_t*)arg;
+	uint8_t* ptr;
+	uint16_t n;
+	uint8_t next = 0;
+
+	for( uint64_t sent=0; sent<total; sent+=n )
+	{
+		n = buffer_write_span( &spsc, &ptr );
+		if( n == 0 ) sched_yield();
+		if( n > total - sent ) n = total - sent;
+		for( uint16_t i=0; i<n; i++ ) ptr[i] = next++;
+		buffer_commit( &spsc, n );
+	}
+	return NULL;
+}
+
+static void check_spsc( uint64_t total )
+{
+	pthread_t thread;
+	uint8_t* ptr;
+	uint16_t n;
+	uint8_t next = 0;
+	uint64_t wrong = 0;
+	double start = now();
+
+	buffer_init( spsc_data, sizeof(spsc_data), &spsc );
+	pthread_create( &thread, NULL, producer, &total );
+	for( uint64_t received=0; received<total; received+=n )
+	{
+		n = buffer_read_span( &spsc, &ptr );
+		if( n == 0 ) sched_yield();
+		for( uint16_t i=0; i<n; i++ ) wrong += (ptr[i] != next++);
+		buffer_consume( &spsc, n );
+	}
+	pthread_join( thread, NULL );
+	check( wrong == 0 );
+	printf( "two threads, spans: %.0f MB/s\n", total / (now() - start) / 1e6 );
+}
+
+
+
+static void bench( void )
+{
+	static uint8_t data[BENCH_SIZE], chunk[BENCH_CHUNK];
+	buffer_t buf;
+	double start;
+	uint32_t sum = 0;
+
+	buffer_init( data, sizeof(data), &buf );
+	start = now();
+	for( uint64_t n=0; n<BENCH_BYTES / 8; n++ )
+	{
+		buffer_put_byte( (char)n, &buf );
+		sum += buffer_get_byte( &buf );
+	}
+	printf( "byte put/get: %.0f MB/s\n", (BENCH_BYTES / 8) / (now() - start) / 1e6 );
+
+	start = now();
+	for( uint64_t n=0; n<BENCH_BYTES; n+=BENCH_CHUNK )
+	{
+		buffer_put_data( chunk, sizeof(chunk), &buf );
+		buffer_get_data( chunk, sizeof(chunk), &buf );
+		sum += chunk[0];
+	}
+	printf( "%u byte put/get data: %.0f MB/s\n", BENCH_CHUNK, BENCH_BYTES / (now() - start) / 1e6 );
+
+	start = now();
+	for( uint64_t n=0; n<BENCH_BYTES / 64; n++ )
+	{
+		buffer_put_format( &buf, "%u,", (unsigned)n );
+		buffer_clear( &buf );
+	}
+	printf( "put format: %.1f M/s\n", (BENCH_BYTES / 64) / (now() - start) / 1e6 );
+	if( sum == 1 ) printf( "\n" );				// Keep loops from being removed
+}
+
+
+
+int main( void )
+{
+	check_init();
+	check_model();
+	check_format();
+	check_spsc( 64UL * 1024 * 1024 );
+	bench();
+
+	printf( "%s\n", errors ? "FAILED" : "OK" );
+	return errors ? 1 : 0;
+}
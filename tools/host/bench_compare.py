@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Compares two results of sml_bench (JSON), e.g. stored baseline and current run:
+	make bench-save
+	... change hot path ...
+	make bench-compare
+
+Times and memory are lower is better. A rise above the tolerance is a
+regression, as is a change of frames, values or CRC errors per capture, which
+means the pipeline behaves differently. Exit code is 1 on regression.
+"""
+
+import argparse
+import json
+import sys
+
+TIME = ('ns_per_byte',)
+MEMORY = ('allocs_per_frame', 'alloc_bytes_per_frame', 'heap_peak', 'bytes_per_value')
+EXACT = ('frames', 'values', 'crc_errors')
+
+
+def load(path):
+	with open(path) as f:
+		result = json.load(f)
+	return {c['name']: c for c in result['captures']}, result['total']
+
+
+def change(old, new):
+	if old == 0:
+		return 0.0 if new == 0 else float('inf')
+	return (new - old) * 100.0 / old
+
+
+def compare(name, old, new, args, lines):
+	failed = False
+	for key in EXACT:
+		if old[key] != new[key]:
+			lines.append('%-40s %-22s %12s %12s  changed' % (name, key, old[key], new[key]))
+			failed = True
+	for keys, tolerance in ((TIME, args.time), (MEMORY, args.memory)):
+		for key in keys:
+			percent = change(old[key], new[key])
+			if percent > tolerance:
+				mark = 'REGRESSION'
+				failed = True
+			elif percent < -tolerance:
+				mark = 'better'
+			elif args.verbose:
+				mark = ''
+			else:
+				continue
+			lines.append('%-40s %-22s %12g %12g %+7.1f%% %s' % (name, key, old[key], new[key], percent, mark))
+	return failed
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('baseline')
+	parser.add_argument('current')
+	parser.add_argument('--time', type=float, default=10, help='tolerance of times in percent, default 10')
+	parser.add_argument('--memory', type=float, default=2, help='tolerance of heap and output in percent, default 2')
+	parser.add_argument('-v', '--verbose', action='store_true', help='also list metrics within tolerance')
+	args = parser.parse_args()
+
+	old, old_total = load(args.baseline)
+	new, new_total = load(args.current)
+	lines = []
+	failed = False
+	for name in sorted(old.keys() & new.keys()):
+		failed |= compare(name, old[name], new[name], args, lines)
+	failed |= compare('total', old_total, new_total, args, lines)
+	for name in sorted(old.keys() - new.keys()):
+		lines.append('%-40s missing in current run' % name)
+	for name in sorted(new.keys() - old.keys()):
+		lines.append('%-40s not in baseline' % name)
+
+	for line in lines:
+		print(line)
+	print('%d captures compared: %s' % (len(old.keys() & new.keys()), 'REGRESSION' if failed else 'OK'))
+	sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+	main()
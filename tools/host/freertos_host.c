@@ -0,0 +1,588 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "timers.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define HOST_TIMER_QUEUE_LEN					10
+#define HOST_TASKS_MAX								16
+#define HOST_STACK_SIZE								(256 * 1024)	// Host frames and glibc need more than firmware
+#define HOST_STACK_FILL								0xa5					// Like FreeRTOS, untouched stack keeps it
+
+// Stack is painted before start, used depth is measured from entry of task code
+struct host_task
+{
+	pthread_t				thread;
+	TaskFunction_t	code;
+	void*						param;
+	char						name[16];
+	uint16_t				stack_words;	// Given to xTaskCreate()
+	uint8_t*				stack;
+	uintptr_t				entry;				// Stack pointer at entry of task code
+};
+
+// Ring of item copies. Semaphores have item size 0 and only count.
+struct host_queue
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+	UBaseType_t			length;
+	UBaseType_t			item_size;
+	UBaseType_t			count;
+	UBaseType_t			head;
+	uint8_t					items[];
+};
+
+typedef struct
+{
+	PendedFunction_t	function;
+	void*							param1;
+	uint32_t					param2;
+} host_pended_t;
+
+typedef struct
+{
+	size_t	size;
+	size_t	pad;									// Keeps payload aligned like malloc
+} host_alloc_t;
+
+static pthread_mutex_t host_critical_lock;
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t host_task_lock = PTHREAD_MUTEX_INITIALIZER;	// Not host_lock, output allocates
+static pthread_cond_t host_queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+static host_heap_t host_heap;
+static uint32_t host_items = 0;					// In all queues with item data
+static bool host_block = false;
+static QueueHandle_t host_timer_queue = NULL;
+static struct host_task* host_tasks[HOST_TASKS_MAX];
+static uint32_t host_task_count = 0;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void host_init( void );
+static void* host_task_start( void* arg );
+static void host_timer_task( void* param );
+static void host_deadline( struct timespec* ts, TickType_t ticks );
+static bool host_wait( QueueHandle_t queue, TickType_t ticks, const struct timespec* deadline );
+static uint64_t host_ms( void );
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static void host_init( void )
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( &host_critical_lock, &attr );
+	pthread_mutexattr_destroy( &attr );
+
+	host_timer_queue = xQueueCreate( HOST_TIMER_QUEUE_LEN, sizeof(host_pended_t) );
+	xTaskCreate( host_timer_task, "Tmr Svc", 0, NULL, 0, NULL );
+}
+
+
+
+// Recursive, like nested critical sections
+void host_critical( bool enter )
+{
+	pthread_once( &host_once, host_init );
+	if( enter == true ) pthread_mutex_lock( &host_critical_lock );
+	else pthread_mutex_unlock( &host_critical_lock );
+}
+
+
+
+static uint64_t host_ms( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+
+static void host_deadline( struct timespec* ts, TickType_t ticks )
+{
+	uint64_t ns;
+
+	clock_gettime( CLOCK_REALTIME, ts );
+	ns = (uint64_t)ts->tv_nsec + (uint64_t)ticks * portTICK_RATE_MS * 1000000;
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+
+
+void host_sleep_ms( uint32_t ms )
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	while( nanosleep(&ts, &ts) != 0 && errno == EINTR );
+}
+
+
+
+//*****************************************************************************
+// Heap
+// On ESP8266 pvPortMalloc() and malloc() of libsml share one heap. Calls of
+// malloc() family are redirected here by linker option --wrap, so both count.
+//*****************************************************************************
+
+#ifdef HOST_HEAP_WRAP
+void* __real_malloc( size_t size );
+void* __real_realloc( void* ptr, size_t size );
+void __real_free( void* ptr );
+
+static void host_heap_add( size_t size )
+{
+	pthread_mutex_lock( &host_lock );
+	host_heap.allocs++;
+	host_heap.bytes += size;
+	host_heap.used += size;
+	if( host_heap.used > host_heap.peak ) host_heap.peak = host_heap.used;
+	pthread_mutex_unlock( &host_lock );
+}
+
+void* __wrap_malloc( size_t size )
+{
+	host_alloc_t* alloc = __real_malloc( sizeof(host_alloc_t) + size );
+
+	if( alloc == NULL ) return NULL;
+	alloc->size = size;
+	host_heap_add( size );
+	return alloc + 1;
+}
+
+void* __wrap_calloc( size_t count, size_t size )
+{
+	void* ptr;
+
+	if( (size != 0) && (count > SIZE_MAX / size) ) return NULL;
+	ptr = __wrap_malloc( count * size );
+	if( ptr != NULL ) memset( ptr, 0, count * size );
+	return ptr;
+}
+
+void __wrap_free( void* ptr )
+{
+	host_alloc_t* alloc;
+
+	if( ptr == NULL ) return;
+	alloc = (host_alloc_t*)ptr - 1;
+	pthread_mutex_lock( &host_lock );
+	host_heap.used -= alloc->size;
+	pthread_mutex_unlock( &host_lock );
+	__real_free( alloc );
+}
+
+// Counted like free and malloc, as heap of SDK does it
+void* __wrap_realloc( void* ptr, size_t size )
+{
+	host_alloc_t* alloc;
+	size_t old;
+
+	if( ptr == NULL ) return __wrap_malloc( size );
+	alloc = (host_alloc_t*)ptr - 1;
+	old = alloc->size;
+	alloc = __real_realloc( alloc, sizeof(host_alloc_t) + size );
+	if( alloc == NULL ) return NULL;
+	alloc->size = size;
+	pthread_mutex_lock( &host_lock );
+	host_heap.used -= old;
+	pthread_mutex_unlock( &host_lock );
+	host_heap_add( size );
+	return alloc + 1;
+}
+#endif
+
+void* pvPortMalloc( size_t size )
+{
+	return malloc( size );
+}
+
+void vPortFree( void* ptr )
+{
+	free( ptr );
+}
+
+// ESP8266 has about 80KB for heap
+size_t xPortGetFreeHeapSize( void )
+{
+	return (host_heap.used < 80 * 1024) ? (80 * 1024 - host_heap.used) : 0;
+}
+
+void host_heap_stats( host_heap_t* heap )
+{
+	pthread_mutex_lock( &host_lock );
+	*heap = host_heap;
+	pthread_mutex_unlock( &host_lock );
+}
+
+// Peak starts again from current use
+void host_heap_reset_peak( void )
+{
+	pthread_mutex_lock( &host_lock );
+	host_heap.peak = host_heap.used;
+	pthread_mutex_unlock( &host_lock );
+}
+
+
+
+//*****************************************************************************
+// Tasks
+//*****************************************************************************
+
+static void* host_task_start( void* arg )
+{
+	struct host_task* task = arg;
+
+	task->entry = (uintptr_t)__builtin_frame_address( 0 );
+	task->code( task->param );
+	return NULL;
+}
+
+// Priority is ignored. Stacks are HOST_STACK_SIZE, not in heap statistics, and
+// painted to measure their use, see host_task_stack_used().
+BaseType_t xTaskCreate( TaskFunction_t code, const char* name, uint16_t stack, void* param, UBaseType_t priority, TaskHandle_t* handle )
+{
+	struct host_task* task = calloc( 1, sizeof(struct host_task) );
+	pthread_attr_t attr;
+	int ret;
+
+	if( task == NULL ) return pdFAIL;
+	task->code = code;
+	task->param = param;
+	task->stack_words = stack;
+	strncpy( task->name, name, sizeof(task->name) - 1 );
+	task->stack = mmap( NULL, HOST_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0 );
+	if( task->stack == MAP_FAILED )
+	{
+		free( task );
+		return pdFAIL;
+	}
+	memset( task->stack, HOST_STACK_FILL, HOST_STACK_SIZE );
+
+	pthread_attr_init( &attr );
+	pthread_attr_setstack( &attr, task->stack, HOST_STACK_SIZE );
+	ret = pthread_create( &task->thread, &attr, host_task_start, task );
+	pthread_attr_destroy( &attr );
+	if( ret != 0 )
+	{
+		munmap( task->stack, HOST_STACK_SIZE );
+		free( task );
+		return pdFAIL;
+	}
+	pthread_detach( task->thread );
+
+	pthread_mutex_lock( &host_task_lock );
+	if( host_task_count < HOST_TASKS_MAX ) host_tasks[host_task_count++] = task;
+	pthread_mutex_unlock( &host_task_lock );
+	if( handle != NULL ) *handle = task;
+	return pdPASS;
+}
+
+
+
+// Deepest use since start in bytes, below entry of task code. Frames of glibc
+// start and thread data at top of stack are not counted.
+static size_t host_task_stack_used( struct host_task* task )
+{
+	uint8_t* ptr = task->stack;
+
+	if( task->entry == 0 ) return 0;
+	while( (ptr < task->stack + HOST_STACK_SIZE) && (*ptr == HOST_STACK_FILL) ) ptr++;
+	return ((uintptr_t)ptr < task->entry) ? (task->entry - (uintptr_t)ptr) : 0;
+}
+
+// Words left of stack given to xTaskCreate(), if host use would be the same on target
+UBaseType_t uxTaskGetStackHighWaterMark( TaskHandle_t task )
+{
+	size_t used = host_task_stack_used( task );
+	size_t size = (size_t)task->stack_words * sizeof(StackType_t);
+
+	return (used < size) ? (UBaseType_t)((size - used) / sizeof(StackType_t)) : 0;
+}
+
+// JSON of all tasks with stack, for tools/ram_report.py
+void host_task_report( FILE* file )
+{
+	struct host_task* task;
+
+	pthread_mutex_lock( &host_task_lock );
+	fprintf( file, "{\"tasks\":[\n" );
+	for( uint32_t n=0; n<host_task_count; n++ )
+	{
+		task = host_tasks[n];
+		fprintf( file, "  {\"name\":\"%s\",\"stack_words\":%u,\"used_bytes\":%zu,\"free_words\":%u}%s\n",
+		         task->name, task->stack_words, host_task_stack_used(task), uxTaskGetStackHighWaterMark(task),
+		         (n + 1 < host_task_count) ? "," : "" );
+	}
+	fprintf( file, "]}\n" );
+	pthread_mutex_unlock( &host_task_lock );
+}
+
+// Only the calling task can delete itself
+void vTaskDelete( TaskHandle_t task )
+{
+	if( task == NULL ) pthread_exit( NULL );
+}
+
+void vTaskDelay( TickType_t ticks )
+{
+	host_sleep_ms( ticks * portTICK_RATE_MS );
+}
+
+void vTaskDelayUntil( TickType_t* wake, TickType_t ticks )
+{
+	TickType_t now = xTaskGetTickCount();
+
+	*wake += ticks;
+	if( (int32_t)(*wake - now) > 0 ) vTaskDelay( *wake - now );
+}
+
+TickType_t xTaskGetTickCount( void )
+{
+	return (TickType_t)(host_ms() / portTICK_RATE_MS);
+}
+
+
+
+//*****************************************************************************
+// Queues and semaphores
+//*****************************************************************************
+
+QueueHandle_t xQueueCreate( UBaseType_t length, UBaseType_t item_size )
+{
+	QueueHandle_t queue = calloc( 1, sizeof(struct host_queue) + length * item_size );
+
+	if( queue == NULL ) return NULL;
+	pthread_mutex_init( &queue->lock, NULL );
+	pthread_cond_init( &queue->changed, NULL );
+	queue->length = length;
+	queue->item_size = item_size;
+	return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting( UBaseType_t max, UBaseType_t initial )
+{
+	QueueHandle_t queue = xQueueCreate( max, 0 );
+
+	if( queue != NULL ) queue->count = initial;
+	return queue;
+}
+
+// Not recursive and without priority inheritance, like firmware uses it
+SemaphoreHandle_t xSemaphoreCreateMutex( void )
+{
+	return xSemaphoreCreateCounting( 1, 1 );
+}
+
+// Called with queue locked, false on timeout
+static bool host_wait( QueueHandle_t queue, TickType_t ticks, const struct timespec* deadline )
+{
+	if( ticks == 0 ) return false;
+	if( ticks == portMAX_DELAY ) return (pthread_cond_wait(&queue->changed, &queue->lock) == 0);
+	return (pthread_cond_timedwait(&queue->changed, &queue->lock, deadline) != ETIMEDOUT);
+}
+
+// NULL item is queued as zeros, mqtt_reconnect() relies on that
+BaseType_t xQueueSend( QueueHandle_t queue, const void* item, TickType_t ticks )
+{
+	struct timespec deadline;
+	uint8_t* slot;
+
+	// Lossless replay waits also when caller doesn't, see host_queue_block()
+	if( (host_block == true) && (queue->item_size > 0) && (queue != host_timer_queue) ) ticks = portMAX_DELAY;
+	host_deadline( &deadline, ticks );
+
+	pthread_mutex_lock( &queue->lock );
+	while( queue->count >= queue->length )
+	{
+		if( host_wait(queue, ticks, &deadline) == false )
+		{
+			pthread_mutex_unlock( &queue->lock );
+			return pdFALSE;
+		}
+	}
+
+	if( queue->item_size > 0 )
+	{
+		slot = &queue->items[((queue->head + queue->count) % queue->length) * queue->item_size];
+		if( item != NULL ) memcpy( slot, item, queue->item_size );
+		else memset( slot, 0x00, queue->item_size );
+	}
+	queue->count++;
+	pthread_cond_broadcast( &queue->changed );
+	pthread_mutex_unlock( &queue->lock );
+
+	if( queue->item_size > 0 )
+	{
+		pthread_mutex_lock( &host_lock );
+		host_items++;
+		pthread_cond_broadcast( &host_queued_cond );
+		pthread_mutex_unlock( &host_lock );
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive( QueueHandle_t queue, void* item, TickType_t ticks )
+{
+	struct timespec deadline;
+
+	host_deadline( &deadline, ticks );
+	pthread_mutex_lock( &queue->lock );
+	while( queue->count == 0 )
+	{
+		if( host_wait(queue, ticks, &deadline) == false )
+		{
+			pthread_mutex_unlock( &queue->lock );
+			return pdFALSE;
+		}
+	}
+
+	if( queue->item_size > 0 )
+	{
+		memcpy( item, &queue->items[queue->head * queue->item_size], queue->item_size );
+		queue->head = (queue->head + 1) % queue->length;
+	}
+	queue->count--;
+	pthread_cond_broadcast( &queue->changed );
+	pthread_mutex_unlock( &queue->lock );
+
+	if( queue->item_size > 0 )
+	{
+		pthread_mutex_lock( &host_lock );
+		host_items--;
+		pthread_mutex_unlock( &host_lock );
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReset( QueueHandle_t queue )
+{
+	UBaseType_t count;
+
+	pthread_mutex_lock( &queue->lock );
+	count = queue->count;
+	queue->count = 0;
+	queue->head = 0;
+	pthread_cond_broadcast( &queue->changed );
+	pthread_mutex_unlock( &queue->lock );
+
+	if( queue->item_size > 0 )
+	{
+		pthread_mutex_lock( &host_lock );
+		host_items -= count;
+		pthread_mutex_unlock( &host_lock );
+	}
+	return pdPASS;
+}
+
+// mqtt_pub() checks for space before sending, so it waits here as well when blocking
+UBaseType_t uxQueueSpacesAvailable( QueueHandle_t queue )
+{
+	UBaseType_t spaces;
+
+	pthread_mutex_lock( &queue->lock );
+	if( (host_block == true) && (queue->item_size > 0) && (queue != host_timer_queue) )
+	{
+		while( queue->count == queue->length ) pthread_cond_wait( &queue->changed, &queue->lock );
+	}
+	spaces = queue->length - queue->count;
+	pthread_mutex_unlock( &queue->lock );
+	return spaces;
+}
+
+UBaseType_t uxQueueMessagesWaiting( QueueHandle_t queue )
+{
+	UBaseType_t count;
+
+	pthread_mutex_lock( &queue->lock );
+	count = queue->count;
+	pthread_mutex_unlock( &queue->lock );
+	return count;
+}
+
+
+
+// Items in all queues, semaphores not counted
+uint32_t host_queued( void )
+{
+	uint32_t items;
+
+	pthread_mutex_lock( &host_lock );
+	items = host_items;
+	pthread_mutex_unlock( &host_lock );
+	return items;
+}
+
+// Waits until any queue holds an item, returns false on timeout
+bool host_wait_queued( uint32_t ms )
+{
+	struct timespec deadline;
+	bool queued;
+
+	host_deadline( &deadline, (ms + portTICK_RATE_MS - 1) / portTICK_RATE_MS );
+	pthread_mutex_lock( &host_lock );
+	while( host_items == 0 )
+	{
+		if( pthread_cond_timedwait(&host_queued_cond, &host_lock, &deadline) == ETIMEDOUT ) break;
+	}
+	queued = (host_items > 0);
+	pthread_mutex_unlock( &host_lock );
+	return queued;
+}
+
+// Full queues block sender instead of dropping, so fast replay loses nothing
+void host_queue_block( bool block )
+{
+	host_block = block;
+}
+
+
+
+//*****************************************************************************
+// Timer task
+//*****************************************************************************
+
+BaseType_t xTimerPendFunctionCall( PendedFunction_t function, void* param1, uint32_t param2, TickType_t ticks )
+{
+	host_pended_t pended = { function, param1, param2 };
+
+	pthread_once( &host_once, host_init );
+	return xQueueSend( host_timer_queue, &pended, ticks );
+}
+
+static void host_timer_task( void* param )
+{
+	host_pended_t pended;
+
+	while( true )
+	{
+		if( xQueueReceive(host_timer_queue, &pended, portMAX_DELAY) == pdTRUE )
+		{
+			pended.function( pended.param1, pended.param2 );
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+//*****************************************************************************
+// Settings of host build, set by command line in sml_host.c
+//*****************************************************************************
+
+typedef struct
+{
+	const char*	input;						// SML bytes, file, pty or '-' for stdin
+	uint32_t		baud;							// Pace input like meter, 0 as fast as possible
+	FILE*				capture;					// 'topic payload' lines instead of broker
+	const char*	broker;						// Host of MQTT broker
+	int					port;
+} host_config_t;
+
+extern host_config_t host_config;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+bool host_uart_done( void );
+
+void host_uart_mem( const unsigned char* data, size_t len );
+size_t host_uart_mem_pos( void );
+bool host_replay_init( void );
+void host_replay_drain( void );
+
+void host_mqtt_stats( uint32_t* published, uint64_t* payload_bytes, bool* busy );
+
+
+
+#endif // HOST_H_
@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lwip/tcp.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+// Listening pcb accepts stderr as the only client right away
+struct tcp_pcb
+{
+	int	listening;
+};
+
+static struct tcp_pcb host_listen;
+static struct tcp_pcb host_client;
+static pthread_mutex_t host_tcpip;
+static pthread_once_t host_tcpip_once = PTHREAD_ONCE_INIT;
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static void host_tcpip_init( void )
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( &host_tcpip, &attr );
+	pthread_mutexattr_destroy( &attr );
+}
+
+void host_tcpip_lock( int lock )
+{
+	pthread_once( &host_tcpip_once, host_tcpip_init );
+	if( lock ) pthread_mutex_lock( &host_tcpip );
+	else pthread_mutex_unlock( &host_tcpip );
+}
+
+struct tcp_pcb* tcp_new( void )
+{
+	return &host_listen;
+}
+
+err_t tcp_bind( struct tcp_pcb* pcb, const void* ipaddr, uint16_t port )
+{
+	return ERR_OK;
+}
+
+struct tcp_pcb* tcp_listen( struct tcp_pcb* pcb )
+{
+	pcb->listening = 1;
+	return pcb;
+}
+
+void tcp_accept( struct tcp_pcb* pcb, tcp_accept_fn accept )
+{
+	accept( NULL, &host_client, ERR_OK );
+}
+
+void tcp_recv( struct tcp_pcb* pcb, tcp_recv_fn recv )
+{
+}
+
+void tcp_setprio( struct tcp_pcb* pcb, uint8_t prio )
+{
+}
+
+err_t tcp_write( struct tcp_pcb* pcb, const void* data, uint16_t len, uint8_t flags )
+{
+	if( pcb != &host_client ) return ERR_MEM;
+	fwrite( data, 1, len, stderr );
+	return ERR_OK;
+}
+
+err_t tcp_output( struct tcp_pcb* pcb )
+{
+	fflush( stderr );
+	return ERR_OK;
+}
+
+uint16_t tcp_sndbuf( struct tcp_pcb* pcb )
+{
+	return 0xffff;
+}
+
+void tcp_recved( struct tcp_pcb* pcb, uint16_t len )
+{
+}
+
+err_t tcp_close( struct tcp_pcb* pcb )
+{
+	return ERR_OK;
+}
+
+uint16_t pbuf_copy_partial( const struct pbuf* p, void* data, uint16_t len, uint16_t offset )
+{
+	if( offset >= p->len ) return 0;
+	if( len > p->len - offset ) len = p->len - offset;
+	memcpy( data, (const uint8_t*)p->payload + offset, len );
+	return len;
+}
+
+uint8_t pbuf_free( struct pbuf* p )
+{
+	return 1;
+}
@@ -0,0 +1,409 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "FreeRTOS.h"
+#include "paho_mqtt_c/MQTTClient.h"
+#include "host.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define MQTT_CONNECT									0x10
+#define MQTT_CONNACK									0x20
+#define MQTT_PUBLISH									0x30
+#define MQTT_PUBACK										0x40
+#define MQTT_SUBSCRIBE								0x82
+#define MQTT_SUBACK										0x90
+#define MQTT_PINGREQ									0xc0
+#define MQTT_PINGRESP									0xd0
+#define MQTT_DISCONNECT								0xe0
+
+static pthread_mutex_t host_mqtt_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t host_published = 0;
+static uint64_t host_payload_bytes = 0;
+static bool host_publishing = false;
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static size_t mqtt_put_string( unsigned char* buf, const char* str, size_t len );
+static int mqtt_send( mqtt_client_t* c, unsigned char type, const unsigned char* body, size_t len );
+static int mqtt_read_packet( mqtt_client_t* c, int timeout_ms, unsigned char* type, size_t* len );
+static int mqtt_wait_for( mqtt_client_t* c, unsigned char type, unsigned short id );
+static void mqtt_deliver( mqtt_client_t* c, unsigned char type, size_t len );
+static unsigned int mqtt_now( void );
+
+
+
+//*****************************************************************************
+// Network
+//*****************************************************************************
+
+void mqtt_network_new( mqtt_network_t* n )
+{
+	n->my_socket = -1;
+}
+
+// Capture file replaces broker, host and port of firmware are replaced by command line
+int mqtt_network_connect( mqtt_network_t* n, const char* host, int port )
+{
+	struct addrinfo hints, *res, *ai;
+	char service[8];
+
+	n->my_socket = -1;
+	if( host_config.capture != NULL ) return 0;
+
+	memset( &hints, 0x00, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf( service, sizeof(service), "%d", host_config.port );
+	if( getaddrinfo(host_config.broker, service, &hints, &res) != 0 ) return -1;
+	for( ai=res; ai!=NULL; ai=ai->ai_next )
+	{
+		n->my_socket = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if( n->my_socket < 0 ) continue;
+		if( connect(n->my_socket, ai->ai_addr, ai->ai_addrlen) == 0 ) break;
+		close( n->my_socket );
+		n->my_socket = -1;
+	}
+	freeaddrinfo( res );
+	return (n->my_socket < 0) ? -1 : 0;
+}
+
+int mqtt_network_disconnect( mqtt_network_t* n )
+{
+	if( n->my_socket >= 0 ) close( n->my_socket );
+	n->my_socket = -1;
+	return 0;
+}
+
+
+
+//*****************************************************************************
+// Client
+//*****************************************************************************
+
+void mqtt_client_new( mqtt_client_t* c, mqtt_network_t* n, unsigned int command_timeout_ms,
+                      unsigned char* buf, size_t buf_size, unsigned char* readbuf, size_t readbuf_size )
+{
+	memset( c, 0x00, sizeof(mqtt_client_t) );
+	c->ipstack = n;
+	c->command_timeout_ms = command_timeout_ms;
+	c->buf = buf;
+	c->buf_size = buf_size;
+	c->readbuf = readbuf;
+	c->readbuf_size = readbuf_size;
+	c->next_packetid = 1;
+}
+
+int mqtt_connect( mqtt_client_t* c, mqtt_packet_connect_data_t* options )
+{
+	unsigned char* p = c->buf;
+	unsigned char flags = 0;
+
+	c->keepAliveInterval = options->keepAliveInterval;
+	if( c->ipstack->my_socket < 0 )
+	{
+		c->isconnected = 1;
+		return MQTT_SUCCESS;
+	}
+
+	if( options->MQTTVersion == 3 ) p += mqtt_put_string( p, "MQIsdp", 6 );
+	else p += mqtt_put_string( p, "MQTT", 4 );
+	*p++ = options->MQTTVersion;
+	if( options->cleansession ) flags |= 0x02;
+	if( options->willFlag ) flags |= 0x04 | ((options->will.qos & 3) << 3) | (options->will.retained ? 0x20 : 0);
+	if( options->username.cstring != NULL ) flags |= 0x80;
+	if( options->password.cstring != NULL ) flags |= 0x40;
+	*p++ = flags;
+	*p++ = options->keepAliveInterval >> 8;
+	*p++ = options->keepAliveInterval & 0xff;
+	p += mqtt_put_string( p, options->clientID.cstring, strlen(options->clientID.cstring) );
+	if( options->willFlag )
+	{
+		p += mqtt_put_string( p, options->will.topicName.cstring, strlen(options->will.topicName.cstring) );
+		p += mqtt_put_string( p, options->will.message.cstring, strlen(options->will.message.cstring) );
+	}
+	if( options->username.cstring != NULL ) p += mqtt_put_string( p, options->username.cstring, strlen(options->username.cstring) );
+	if( options->password.cstring != NULL ) p += mqtt_put_string( p, options->password.cstring, strlen(options->password.cstring) );
+
+	if( mqtt_send(c, MQTT_CONNECT, c->buf, p - c->buf) != MQTT_SUCCESS ) return MQTT_FAILURE;
+	if( mqtt_wait_for(c, MQTT_CONNACK, 0) != MQTT_SUCCESS ) return MQTT_FAILURE;
+	if( c->readbuf[1] != 0 ) return c->readbuf[1];			// Return code of broker
+	c->isconnected = 1;
+	return MQTT_SUCCESS;
+}
+
+int mqtt_subscribe( mqtt_client_t* c, const char* topic, enum mqtt_qos qos, mqtt_message_handler_t handler )
+{
+	unsigned char* p = c->buf;
+	unsigned short id = c->next_packetid++;
+	int n;
+
+	for( n=0; (n < MAX_MESSAGE_HANDLERS) && (c->messageHandlers[n].topic != NULL); n++ );
+	if( n == MAX_MESSAGE_HANDLERS ) return MQTT_FAILURE;
+	c->messageHandlers[n].topic = topic;
+	c->messageHandlers[n].handler = handler;
+	if( c->ipstack->my_socket < 0 ) return MQTT_SUCCESS;
+
+	*p++ = id >> 8;
+	*p++ = id & 0xff;
+	p += mqtt_put_string( p, topic, strlen(topic) );
+	*p++ = qos;
+	if( mqtt_send(c, MQTT_SUBSCRIBE, c->buf, p - c->buf) != MQTT_SUCCESS ) return MQTT_FAILURE;
+	return mqtt_wait_for( c, MQTT_SUBACK, id );
+}
+
+// QoS 1 waits for acknowledge like paho, so probe of send stage sees the round trip
+int mqtt_publish( mqtt_client_t* c, const char* topic, mqtt_message_t* message )
+{
+	unsigned char* p = c->buf;
+	unsigned short id = 0;
+	size_t topic_len = strlen( topic );
+	int ret = MQTT_SUCCESS;
+
+	pthread_mutex_lock( &host_mqtt_lock );
+	host_publishing = true;
+	pthread_mutex_unlock( &host_mqtt_lock );
+
+	if( c->ipstack->my_socket < 0 )
+	{
+		fprintf( host_config.capture, "%s %.*s\n", topic, (int)message->payloadlen, (char*)message->payload );
+		fflush( host_config.capture );
+	}
+	else if( 2 + topic_len + 2 + message->payloadlen > c->buf_size )
+	{
+		ret = MQTT_BUFFER_OVERFLOW;
+	}
+	else
+	{
+		p += mqtt_put_string( p, topic, topic_len );
+		if( message->qos > MQTT_QOS0 )
+		{
+			id = c->next_packetid++;
+			*p++ = id >> 8;
+			*p++ = id & 0xff;
+		}
+		memcpy( p, message->payload, message->payloadlen );
+		p += message->payloadlen;
+		ret = mqtt_send( c, MQTT_PUBLISH | (message->qos << 1) | (message->retained ? 1 : 0), c->buf, p - c->buf );
+		if( (ret == MQTT_SUCCESS) && (message->qos > MQTT_QOS0) ) ret = mqtt_wait_for( c, MQTT_PUBACK, id );
+	}
+
+	pthread_mutex_lock( &host_mqtt_lock );
+	if( ret == MQTT_SUCCESS )
+	{
+		host_published++;
+		host_payload_bytes += message->payloadlen;
+	}
+	host_publishing = false;
+	pthread_mutex_unlock( &host_mqtt_lock );
+	return ret;
+}
+
+// Without broker it returns as soon as something is queued, so capture isn't delayed by timeout
+int mqtt_yield( mqtt_client_t* c, int timeout_ms )
+{
+	unsigned int end = mqtt_now() + timeout_ms;
+	unsigned char type;
+	size_t len;
+	int ret;
+
+	if( c->ipstack->my_socket < 0 )
+	{
+		host_wait_queued( timeout_ms );
+		return MQTT_SUCCESS;
+	}
+
+	do
+	{
+		if( (c->keepAliveInterval > 0) && (mqtt_now() - c->last_sent >= c->keepAliveInterval * 1000 / 2) )
+		{
+			if( mqtt_send(c, MQTT_PINGREQ, NULL, 0) != MQTT_SUCCESS ) return MQTT_DISCONNECTED;
+		}
+		ret = mqtt_read_packet( c, end - mqtt_now(), &type, &len );
+		if( ret == MQTT_DISCONNECTED ) return ret;
+		if( ret == MQTT_SUCCESS ) mqtt_deliver( c, type, len );
+	}
+	while( (int)(end - mqtt_now()) > 0 );
+	return MQTT_SUCCESS;
+}
+
+int mqtt_disconnect( mqtt_client_t* c )
+{
+	c->isconnected = 0;
+	if( c->ipstack->my_socket < 0 ) return MQTT_SUCCESS;
+	return mqtt_send( c, MQTT_DISCONNECT, NULL, 0 );
+}
+
+
+
+//*****************************************************************************
+// Packets
+//*****************************************************************************
+
+static unsigned int mqtt_now( void )
+{
+	return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+static size_t mqtt_put_string( unsigned char* buf, const char* str, size_t len )
+{
+	buf[0] = len >> 8;
+	buf[1] = len & 0xff;
+	memcpy( &buf[2], str, len );
+	return len + 2;
+}
+
+static int mqtt_send( mqtt_client_t* c, unsigned char type, const unsigned char* body, size_t len )
+{
+	unsigned char header[5];
+	size_t n = 0;
+	size_t rest = len;
+
+	header[n++] = type;
+	do
+	{
+		header[n] = rest & 0x7f;
+		rest >>= 7;
+		if( rest > 0 ) header[n] |= 0x80;
+		n++;
+	}
+	while( rest > 0 );
+
+	if( send(c->ipstack->my_socket, header, n, MSG_NOSIGNAL) != n ) return MQTT_DISCONNECTED;
+	if( (len > 0) && (send(c->ipstack->my_socket, body, len, MSG_NOSIGNAL) != len) ) return MQTT_DISCONNECTED;
+	c->last_sent = mqtt_now();
+	return MQTT_SUCCESS;
+}
+
+static int mqtt_read_all( mqtt_client_t* c, unsigned char* buf, size_t len )
+{
+	ssize_t n;
+
+	while( len > 0 )
+	{
+		n = recv( c->ipstack->my_socket, buf, len, 0 );
+		if( n <= 0 ) return MQTT_DISCONNECTED;
+		buf += n;
+		len -= n;
+	}
+	return MQTT_SUCCESS;
+}
+
+// Body goes to readbuf, longer packets are read and dropped
+static int mqtt_read_packet( mqtt_client_t* c, int timeout_ms, unsigned char* type, size_t* len )
+{
+	struct pollfd pfd = { c->ipstack->my_socket, POLLIN, 0 };
+	unsigned char byte;
+	size_t rest;
+	int shift = 0;
+
+	if( poll(&pfd, 1, (timeout_ms > 0) ? timeout_ms : 0) <= 0 ) return MQTT_FAILURE;
+	if( mqtt_read_all(c, type, 1) != MQTT_SUCCESS ) return MQTT_DISCONNECTED;
+	*len = 0;
+	do
+	{
+		if( mqtt_read_all(c, &byte, 1) != MQTT_SUCCESS ) return MQTT_DISCONNECTED;
+		*len |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	}
+	while( byte & 0x80 );
+
+	rest = *len;
+	if( rest > c->readbuf_size ) rest = c->readbuf_size;
+	if( mqtt_read_all(c, c->readbuf, rest) != MQTT_SUCCESS ) return MQTT_DISCONNECTED;
+	for( size_t n=rest; n<*len; n++ )
+	{
+		if( mqtt_read_all(c, &byte, 1) != MQTT_SUCCESS ) return MQTT_DISCONNECTED;
+	}
+	if( *len > c->readbuf_size ) return MQTT_BUFFER_OVERFLOW;
+	return MQTT_SUCCESS;
+}
+
+static int mqtt_wait_for( mqtt_client_t* c, unsigned char type, unsigned short id )
+{
+	unsigned int end = mqtt_now() + c->command_timeout_ms;
+	unsigned char got;
+	size_t len;
+	int ret;
+
+	while( (int)(end - mqtt_now()) > 0 )
+	{
+		ret = mqtt_read_packet( c, end - mqtt_now(), &got, &len );
+		if( ret == MQTT_DISCONNECTED ) return ret;
+		if( ret != MQTT_SUCCESS ) continue;
+		if( ((got & 0xf0) == (type & 0xf0)) &&
+		    ((id == 0) || ((len >= 2) && (((c->readbuf[0] << 8) | c->readbuf[1]) == id))) )
+		{
+			return MQTT_SUCCESS;
+		}
+		mqtt_deliver( c, got, len );
+	}
+	return MQTT_FAILURE;
+}
+
+// Incoming publish to handler of same topic, QoS 1 is acknowledged
+static void mqtt_deliver( mqtt_client_t* c, unsigned char type, size_t len )
+{
+	mqtt_message_t message;
+	mqtt_message_data_t data;
+	mqtt_string_t topic;
+	unsigned char ack[2];
+	size_t topic_len, offs;
+
+	if( (type & 0xf0) != MQTT_PUBLISH || (len < 2) ) return;
+	topic_len = (c->readbuf[0] << 8) | c->readbuf[1];
+	offs = 2 + topic_len;
+	memset( &message, 0x00, sizeof(message) );
+	message.qos = (type >> 1) & 3;
+	if( message.qos > MQTT_QOS0 )
+	{
+		if( offs + 2 > len ) return;
+		message.id = (c->readbuf[offs] << 8) | c->readbuf[offs + 1];
+		offs += 2;
+		ack[0] = message.id >> 8;
+		ack[1] = message.id & 0xff;
+		mqtt_send( c, MQTT_PUBACK, ack, 2 );
+	}
+	if( offs > len ) return;
+	message.payload = &c->readbuf[offs];
+	message.payloadlen = len - offs;
+	topic.cstring = NULL;
+	topic.lenstring.len = topic_len;
+	topic.lenstring.data = (char*)&c->readbuf[2];
+	data.message = &message;
+	data.topic = &topic;
+
+	for( int n=0; n<MAX_MESSAGE_HANDLERS; n++ )
+	{
+		if( (c->messageHandlers[n].topic != NULL) && (strlen(c->messageHandlers[n].topic) == topic_len) &&
+		    (memcmp(c->messageHandlers[n].topic, topic.lenstring.data, topic_len) == 0) )
+		{
+			c->messageHandlers[n].handler( &data );
+		}
+	}
+}
+
+
+
+// Counters of successful publishes, busy while one is on the way
+void host_mqtt_stats( uint32_t* published, uint64_t* payload_bytes, bool* busy )
+{
+	pthread_mutex_lock( &host_mqtt_lock );
+	*published = host_published;
+	*payload_bytes = host_payload_bytes;
+	*busy = host_publishing;
+	pthread_mutex_unlock( &host_mqtt_lock );
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "sml_uart.h"
+#include "debug.h"
+#include "probe.h"
+#include "mqtt.h"
+#include "host.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+// Replay of SML bytes from memory for sml_bench and sml_fault. They call
+// sml_server_poll() themselves instead of running uart task.
+//*****************************************************************************
+
+#define HOST_REPLAY_TIMEOUT						5000	// ms, until mqtt task is connected
+#define HOST_REPLAY_POLL							1			// ms
+
+static const unsigned char* host_mem_data = NULL;
+static size_t host_mem_len = 0;
+static size_t host_mem_pos = 0;
+
+
+
+//*****************************************************************************
+// UART, reads from memory
+//*****************************************************************************
+
+bool sml_uart_init( void )
+{
+	return true;
+}
+
+// Nothing at end of data, so sml_transport_read() returns 0
+size_t sml_uart_read( unsigned char *buffer, size_t len )
+{
+	if( host_mem_len - host_mem_pos < len )
+	{
+		host_mem_pos = host_mem_len;
+		return 0;
+	}
+	memcpy( buffer, &host_mem_data[host_mem_pos], len );
+	host_mem_pos += len;
+	return len;
+}
+
+void sml_uart_errors( uint32_t* overflows, uint32_t* framing_errors )
+{
+	*overflows = 0;
+	*framing_errors = 0;
+}
+
+
+
+// Starts reading from begin of data
+void host_uart_mem( const unsigned char* data, size_t len )
+{
+	host_mem_data = data;
+	host_mem_len = len;
+	host_mem_pos = 0;
+}
+
+// Bytes read so far
+size_t host_uart_mem_pos( void )
+{
+	return host_mem_pos;
+}
+
+
+
+//*****************************************************************************
+// Pipeline
+//*****************************************************************************
+
+// Like user_init() without uart task. Values go to null capture, and nothing
+// may be dropped, so queue blocks when mqtt task is behind.
+bool host_replay_init( void )
+{
+	host_config.capture = fopen( "/dev/null", "w" );
+	if( host_config.capture == NULL ) return false;
+	host_queue_block( true );
+	debug_init();
+	probe_init();
+	if( mqtt_init() == false ) return false;
+
+	for( uint32_t ms=0; mqtt_is_connected() == false; ms += HOST_REPLAY_POLL )
+	{
+		if( ms >= HOST_REPLAY_TIMEOUT )
+		{
+			fprintf( stderr, "No connection of mqtt task\n" );
+			return false;
+		}
+		host_sleep_ms( HOST_REPLAY_POLL );
+	}
+	host_replay_drain();
+	return true;
+}
+
+// Until mqtt task published everything which was queued
+void host_replay_drain( void )
+{
+	uint32_t published, last = UINT32_MAX;
+	uint64_t payload_bytes;
+	bool busy;
+
+	while( true )
+	{
+		host_mqtt_stats( &published, &payload_bytes, &busy );
+		if( (host_queued() == 0) && (busy == false) && (published == last) ) return;
+		last = published;
+		host_sleep_ms( HOST_REPLAY_POLL );
+	}
+}
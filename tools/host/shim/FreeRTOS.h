@@ -0,0 +1,105 @@
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+// FreeRTOS API used by firmware, on POSIX threads, see freertos_host.c.
+// Tasks are threads without priorities, ticks are 10ms like firmware (XT_TICK_PER_SEC).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sched.h>
+
+
+
+//*****************************************************************************
+// Definitions
+//*****************************************************************************
+
+#define configTICK_RATE_HZ						100
+#define portTICK_RATE_MS							(1000 / configTICK_RATE_HZ)
+#define portTICK_PERIOD_MS						portTICK_RATE_MS
+#define portMAX_DELAY									((TickType_t)0xffffffffUL)
+
+#define pdFALSE												0
+#define pdTRUE												1
+#define pdFAIL												pdFALSE
+#define pdPASS												pdTRUE
+
+#define IRAM
+#define taskENTER_CRITICAL()					host_critical( true )
+#define taskEXIT_CRITICAL()						host_critical( false )
+#define taskYIELD()										sched_yield()
+#define portYIELD()										sched_yield()
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef BaseType_t portBASE_TYPE;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;						// Unit of task stack sizes
+typedef void (*TaskFunction_t)( void* );
+typedef void (*PendedFunction_t)( void*, uint32_t );
+
+typedef struct host_task* TaskHandle_t;
+typedef TaskHandle_t xTaskHandle;
+typedef struct host_queue* QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+typedef uint32_t EventBits_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+void host_critical( bool enter );
+
+void* pvPortMalloc( size_t size );
+void vPortFree( void* ptr );
+size_t xPortGetFreeHeapSize( void );
+
+BaseType_t xTaskCreate( TaskFunction_t code, const char* name, uint16_t stack, void* param, UBaseType_t priority, TaskHandle_t* handle );
+void vTaskDelete( TaskHandle_t task );
+void vTaskDelay( TickType_t ticks );
+void vTaskDelayUntil( TickType_t* wake, TickType_t ticks );
+TickType_t xTaskGetTickCount( void );
+UBaseType_t uxTaskGetStackHighWaterMark( TaskHandle_t task );
+
+QueueHandle_t xQueueCreate( UBaseType_t length, UBaseType_t item_size );
+BaseType_t xQueueSend( QueueHandle_t queue, const void* item, TickType_t ticks );
+BaseType_t xQueueReceive( QueueHandle_t queue, void* item, TickType_t ticks );
+BaseType_t xQueueReset( QueueHandle_t queue );
+UBaseType_t uxQueueSpacesAvailable( QueueHandle_t queue );
+UBaseType_t uxQueueMessagesWaiting( QueueHandle_t queue );
+
+#define xQueueSendToBack( queue, item, ticks )					xQueueSend( queue, item, ticks )
+#define xQueueSendFromISR( queue, item, woken )					(*(woken) = pdFALSE, xQueueSend( queue, item, 0 ))
+#define xQueueReceiveFromISR( queue, item, woken )			(*(woken) = pdFALSE, xQueueReceive( queue, item, 0 ))
+
+
+
+//*****************************************************************************
+// Host control, used by sml_host.c and shims
+//*****************************************************************************
+
+typedef struct
+{
+	uint32_t	allocs;						// pvPortMalloc() and malloc() calls
+	uint64_t	bytes;						// Sum of all allocations
+	size_t		used;							// Bytes allocated now
+	size_t		peak;							// Most bytes allocated at once
+} host_heap_t;
+
+void host_heap_stats( host_heap_t* heap );
+void host_heap_reset_peak( void );
+uint32_t host_queued( void );
+bool host_wait_queued( uint32_t ms );
+void host_queue_block( bool block );
+void host_sleep_ms( uint32_t ms );
+void host_task_report( FILE* file );
+
+
+
+#endif // HOST_FREERTOS_H_
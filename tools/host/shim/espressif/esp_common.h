@@ -0,0 +1,18 @@
+#ifndef HOST_ESP_COMMON_H_
+#define HOST_ESP_COMMON_H_
+
+// SDK functions used by firmware parts of host build, see stubs_host.c
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STATION_IF										0
+#define MAC2STR( a )									(a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define MACSTR												"%02x:%02x:%02x:%02x:%02x:%02x"
+
+uint32_t sdk_system_get_time( void );
+uint32_t sdk_system_get_free_heap_size( void );
+bool sdk_wifi_get_macaddr( uint8_t if_index, uint8_t* macaddr );
+
+#endif // HOST_ESP_COMMON_H_
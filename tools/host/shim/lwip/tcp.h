@@ -0,0 +1,49 @@
+#ifndef HOST_LWIP_TCP_H_
+#define HOST_LWIP_TCP_H_
+
+// lwIP raw API used by debug.c. Listening socket accepts one client at once,
+// which writes to stderr, see lwip_host.c.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ERR_OK												0
+#define ERR_MEM												-1
+#define TCP_MSS												1460
+#define TCP_WRITE_FLAG_COPY						0x01
+#define TCP_PRIO_MIN									1
+#define IP_ADDR_ANY										NULL
+
+#define LOCK_TCPIP_CORE()							host_tcpip_lock( 1 )
+#define UNLOCK_TCPIP_CORE()						host_tcpip_lock( 0 )
+#define LWIP_UNUSED_ARG( x )					(void)(x)
+
+typedef int8_t err_t;
+struct tcp_pcb;
+struct pbuf
+{
+	void*			payload;
+	uint16_t	tot_len;
+	uint16_t	len;
+};
+
+typedef err_t (*tcp_accept_fn)( void* arg, struct tcp_pcb* pcb, err_t err );
+typedef err_t (*tcp_recv_fn)( void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err );
+
+void host_tcpip_lock( int lock );
+
+struct tcp_pcb* tcp_new( void );
+err_t tcp_bind( struct tcp_pcb* pcb, const void* ipaddr, uint16_t port );
+struct tcp_pcb* tcp_listen( struct tcp_pcb* pcb );
+void tcp_accept( struct tcp_pcb* pcb, tcp_accept_fn accept );
+void tcp_recv( struct tcp_pcb* pcb, tcp_recv_fn recv );
+void tcp_setprio( struct tcp_pcb* pcb, uint8_t prio );
+err_t tcp_write( struct tcp_pcb* pcb, const void* data, uint16_t len, uint8_t flags );
+err_t tcp_output( struct tcp_pcb* pcb );
+uint16_t tcp_sndbuf( struct tcp_pcb* pcb );
+void tcp_recved( struct tcp_pcb* pcb, uint16_t len );
+err_t tcp_close( struct tcp_pcb* pcb );
+uint16_t pbuf_copy_partial( const struct pbuf* p, void* data, uint16_t len, uint16_t offset );
+uint8_t pbuf_free( struct pbuf* p );
+
+#endif // HOST_LWIP_TCP_H_
@@ -0,0 +1,95 @@
+#ifndef HOST_MQTTCLIENT_H_
+#define HOST_MQTTCLIENT_H_
+
+// Subset of paho embedded client API of esp-open-rtos, used by mqtt.c.
+// MQTT 3.1/3.1.1 with QoS 0 and 1 on POSIX sockets, or lines of
+// 'topic payload' to a capture file, see paho_host.c.
+
+#include <stddef.h>
+#include "MQTTESP8266.h"
+
+#define MAX_MESSAGE_HANDLERS					5
+
+enum mqtt_qos { MQTT_QOS0, MQTT_QOS1, MQTT_QOS2 };
+enum mqtt_return { MQTT_DISCONNECTED = -3, MQTT_BUFFER_OVERFLOW = -2, MQTT_FAILURE = -1, MQTT_SUCCESS = 0 };
+
+typedef struct
+{
+	char* cstring;
+	struct
+	{
+		int len;
+		char* data;
+	} lenstring;
+} mqtt_string_t;
+
+typedef struct
+{
+	enum mqtt_qos qos;
+	char retained;
+	char dup;
+	unsigned short id;
+	void* payload;
+	size_t payloadlen;
+} mqtt_message_t;
+
+typedef struct
+{
+	mqtt_message_t* message;
+	mqtt_string_t* topic;
+} mqtt_message_data_t;
+
+typedef void (*mqtt_message_handler_t)( mqtt_message_data_t* );
+
+typedef struct
+{
+	mqtt_string_t topicName;
+	mqtt_string_t message;
+	unsigned char retained;
+	char qos;
+} mqtt_will_options_t;
+
+typedef struct
+{
+	unsigned char MQTTVersion;
+	mqtt_string_t clientID;
+	unsigned short keepAliveInterval;
+	unsigned char cleansession;
+	unsigned char willFlag;
+	mqtt_will_options_t will;
+	mqtt_string_t username;
+	mqtt_string_t password;
+} mqtt_packet_connect_data_t;
+
+#define mqtt_packet_connect_data_initializer		{ 4, {NULL, {0, NULL}}, 60, 1, 0, {{NULL, {0, NULL}}, {NULL, {0, NULL}}, 0, 0}, {NULL, {0, NULL}}, {NULL, {0, NULL}} }
+
+typedef struct
+{
+	const char* topic;
+	mqtt_message_handler_t handler;
+} mqtt_handler_entry_t;
+
+typedef struct mqtt_client
+{
+	unsigned int next_packetid;
+	unsigned int command_timeout_ms;
+	unsigned char* buf;
+	size_t buf_size;
+	unsigned char* readbuf;
+	size_t readbuf_size;
+	unsigned int keepAliveInterval;
+	unsigned int last_sent;					// ms, for keep alive
+	int isconnected;
+	mqtt_handler_entry_t messageHandlers[MAX_MESSAGE_HANDLERS];
+	mqtt_network_t* ipstack;
+} mqtt_client_t;
+
+void mqtt_client_new( mqtt_client_t* c, mqtt_network_t* n, unsigned int command_timeout_ms,
+                      unsigned char* buf, size_t buf_size, unsigned char* readbuf, size_t readbuf_size );
+int mqtt_connect( mqtt_client_t* c, mqtt_packet_connect_data_t* options );
+int mqtt_subscribe( mqtt_client_t* c, const char* topic, enum mqtt_qos qos, mqtt_message_handler_t handler );
+int mqtt_publish( mqtt_client_t* c, const char* topic, mqtt_message_t* message );
+int mqtt_yield( mqtt_client_t* c, int timeout_ms );
+int mqtt_disconnect( mqtt_client_t* c );
+
+#endif // HOST_MQTTCLIENT_H_
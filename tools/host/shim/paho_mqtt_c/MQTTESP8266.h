@@ -0,0 +1,17 @@
+#ifndef HOST_MQTTESP8266_H_
+#define HOST_MQTTESP8266_H_
+
+// Network of paho client on POSIX sockets, see paho_host.c
+
+struct mqtt_network
+{
+	int my_socket;							// < 0 writes to capture file instead of broker
+};
+
+typedef struct mqtt_network mqtt_network_t;
+
+void mqtt_network_new( mqtt_network_t* n );
+int mqtt_network_connect( mqtt_network_t* n, const char* host, int port );
+int mqtt_network_disconnect( mqtt_network_t* n );
+
+#endif // HOST_MQTTESP8266_H_
@@ -0,0 +1,14 @@
+#ifndef HOST_SEMPHR_H_
+#define HOST_SEMPHR_H_
+
+#include "FreeRTOS.h"
+
+// Semaphores are queues without item data, like in FreeRTOS
+SemaphoreHandle_t xSemaphoreCreateMutex( void );
+SemaphoreHandle_t xSemaphoreCreateCounting( UBaseType_t max, UBaseType_t initial );
+#define xSemaphoreCreateBinary()								xSemaphoreCreateCounting( 1, 0 )
+#define xSemaphoreTake( sem, ticks )						xQueueReceive( sem, NULL, ticks )
+#define xSemaphoreGive( sem )										xQueueSend( sem, NULL, 0 )
+#define xSemaphoreGiveFromISR( sem, woken )			(*(woken) = pdFALSE, xQueueSend( sem, NULL, 0 ))
+
+#endif // HOST_SEMPHR_H_
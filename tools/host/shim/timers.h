@@ -0,0 +1,9 @@
+#ifndef HOST_TIMERS_H_
+#define HOST_TIMERS_H_
+
+#include "FreeRTOS.h"
+
+// Runs function in timer task thread
+BaseType_t xTimerPendFunctionCall( PendedFunction_t function, void* param1, uint32_t param2, TickType_t ticks );
+
+#endif // HOST_TIMERS_H_
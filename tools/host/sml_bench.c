@@ -0,0 +1,273 @@
+// Benchmark of SML pipeline over captures, e.g. the sml/libsml-testing corpus.
+// Each capture is replayed from memory through sml_server_poll(): frame assembly
+// in sml_transport_read(), parsing in sml_transport_receiver() and payload
+// formatting in mqtt_pub(). Results are written as JSON to stdout.
+//
+//	sml_bench [-n repeat] <capture|directory> ...
+//
+// Times are CPU time of the replaying thread, so publishing to the null capture
+// by mqtt task is not included. Heap counts pvPortMalloc() and malloc() of
+// libsml, see freertos_host.c. bench_compare.py checks against a baseline.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "host.h"
+#include "sml_server.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define BENCH_REPEAT									10
+#define BENCH_CAPTURES								256
+
+typedef struct
+{
+	uint64_t	bytes;						// Replayed, all repetitions
+	uint32_t	frames;
+	uint32_t	crc_errors;
+	uint32_t	values;						// Published
+	uint64_t	payload_bytes;
+	uint32_t	allocs;
+	uint64_t	alloc_bytes;
+	size_t		heap_peak;
+	double		cpu;							// s
+} bench_result_t;
+
+host_config_t host_config =
+{
+	.input = NULL,
+	.baud = 0,
+	.capture = NULL,
+	.broker = NULL,
+	.port = 1883
+};
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static void usage( const char* name )
+{
+	fprintf( stderr,
+	         "Usage: %s [-n repeat] <capture|directory> ...\n"
+	         "  -n  Replays of each capture, default %u\n"
+	         "  Directories are searched for *.bin\n", name, BENCH_REPEAT );
+	exit( 2 );
+}
+
+
+
+static double bench_cpu( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+static int bench_compare( const void* a, const void* b )
+{
+	return strcmp( *(char* const*)a, *(char* const*)b );
+}
+
+// Files are taken as they are, directories add their *.bin sorted by name.
+// Memory of libc is not given to free(), which is wrapped, see freertos_host.c.
+static uint32_t bench_collect( char* path, char** list, uint32_t count )
+{
+	struct dirent* entry;
+	struct stat st;
+	uint32_t first = count;
+	size_t len;
+	DIR* dir;
+
+	if( stat(path, &st) != 0 )
+	{
+		perror( path );
+		exit( 1 );
+	}
+	if( S_ISDIR(st.st_mode) == false )
+	{
+		if( count < BENCH_CAPTURES ) list[count++] = path;
+		return count;
+	}
+
+	dir = opendir( path );
+	while( (dir != NULL) && ((entry = readdir(dir)) != NULL) && (count < BENCH_CAPTURES) )
+	{
+		len = strlen( entry->d_name );
+		if( (len <= 4) || (strcmp(&entry->d_name[len - 4], ".bin") != 0) ) continue;
+		list[count] = malloc( strlen(path) + len + 2 );
+		if( list[count] == NULL ) break;
+		sprintf( list[count++], "%s/%s", path, entry->d_name );
+	}
+	if( dir != NULL ) closedir( dir );
+	qsort( &list[first], count - first, sizeof(char*), bench_compare );
+	return count;
+}
+
+
+
+static unsigned char* bench_load( const char* path, size_t* len )
+{
+	unsigned char* data;
+	FILE* file = fopen( path, "rb" );
+	struct stat st;
+
+	if( (file == NULL) || (fstat(fileno(file), &st) != 0) )
+	{
+		perror( path );
+		exit( 1 );
+	}
+	data = malloc( st.st_size + 1 );
+	if( (data == NULL) || (fread(data, 1, st.st_size, file) != (size_t)st.st_size) )
+	{
+		fprintf( stderr, "%s: Read failed\n", path );
+		exit( 1 );
+	}
+	fclose( file );
+	*len = st.st_size;
+	return data;
+}
+
+
+
+static void bench_run( const unsigned char* data, size_t len, uint32_t repeat, bench_result_t* result )
+{
+	sml_stats_t stats_start, stats_end;
+	host_heap_t heap_start, heap_end;
+	uint32_t published_start, published_end;
+	uint64_t payload_start, payload_end;
+	double cpu;
+	bool busy;
+
+	// Warm up, also takes one time publishes like boot phases out of measurement
+	host_uart_mem( data, len );
+	while( host_uart_mem_pos() < len ) sml_server_poll();
+	host_replay_drain();
+
+	sml_server_stats( &stats_start );
+	host_heap_stats( &heap_start );
+	host_heap_reset_peak();
+	host_mqtt_stats( &published_start, &payload_start, &busy );
+
+	cpu = bench_cpu();
+	for( uint32_t n=0; n<repeat; n++ )
+	{
+		host_uart_mem( data, len );
+		while( host_uart_mem_pos() < len ) sml_server_poll();
+	}
+	cpu = bench_cpu() - cpu;
+	host_replay_drain();
+
+	sml_server_stats( &stats_end );
+	host_heap_stats( &heap_end );
+	host_mqtt_stats( &published_end, &payload_end, &busy );
+
+	result->bytes = (uint64_t)len * repeat;
+	result->frames = stats_end.frames - stats_start.frames;
+	result->crc_errors = stats_end.crc_errors - stats_start.crc_errors;
+	result->values = published_end - published_start;
+	result->payload_bytes = payload_end - payload_start;
+	result->allocs = heap_end.allocs - heap_start.allocs;
+	result->alloc_bytes = heap_end.bytes - heap_start.bytes;
+	result->heap_peak = heap_end.peak - heap_start.used;
+	result->cpu = cpu;
+}
+
+
+
+static double bench_div( double value, double by )
+{
+	return (by > 0) ? (value / by) : 0;
+}
+
+// Counts are per replay, rates per frame or value
+static void bench_print( const char* name, const bench_result_t* result, uint32_t repeat )
+{
+	printf( "{\"name\":\"" );
+	for( const char* c=name; *c != '\0'; c++ )
+	{
+		if( (*c == '"') || (*c == '\\') ) putchar( '\\' );
+		putchar( *c );
+	}
+	printf( "\",\"bytes\":%llu,\"frames\":%u,\"crc_errors\":%u,\"values\":%u,",
+	        (unsigned long long)(result->bytes / repeat), result->frames / repeat,
+	        result->crc_errors / repeat, result->values / repeat );
+	printf( "\"frames_per_s\":%.1f,\"ns_per_byte\":%.2f,",
+	        bench_div(result->frames, result->cpu), bench_div(result->cpu * 1e9, result->bytes) );
+	printf( "\"allocs_per_frame\":%.2f,\"alloc_bytes_per_frame\":%.1f,\"heap_peak\":%zu,",
+	        bench_div(result->allocs, result->frames), bench_div(result->alloc_bytes, result->frames), result->heap_peak );
+	printf( "\"bytes_per_value\":%.2f}", bench_div(result->payload_bytes, result->values) );
+}
+
+
+
+int main( int argc, char* argv[] )
+{
+	static char* captures[BENCH_CAPTURES];
+	uint32_t repeat = BENCH_REPEAT;
+	uint32_t count = 0;
+	bench_result_t result, total;
+	unsigned char* data;
+	size_t len;
+	int opt;
+
+	while( (opt = getopt(argc, argv, "n:")) != -1 )
+	{
+		switch( opt )
+		{
+			case 'n': repeat = strtoul( optarg, NULL, 10 ); break;
+			default: usage( argv[0] );
+		}
+	}
+	if( (optind >= argc) || (repeat == 0) ) usage( argv[0] );
+	for( int i=optind; i<argc; i++ ) count = bench_collect( argv[i], captures, count );
+	if( count == 0 )
+	{
+		fprintf( stderr, "No captures found\n" );
+		return 1;
+	}
+
+	if( host_replay_init() == false ) return 1;
+
+	memset( &total, 0, sizeof(total) );
+	printf( "{\"repeat\":%u,\"captures\":[\n", repeat );
+	for( uint32_t i=0; i<count; i++ )
+	{
+		data = bench_load( captures[i], &len );
+		bench_run( data, len, repeat, &result );
+		free( data );
+
+		printf( "  " );
+		bench_print( basename(captures[i]), &result, repeat );
+		printf( "%s\n", (i + 1 < count) ? "," : "" );
+
+		total.bytes += result.bytes;
+		total.frames += result.frames;
+		total.crc_errors += result.crc_errors;
+		total.values += result.values;
+		total.payload_bytes += result.payload_bytes;
+		total.allocs += result.allocs;
+		total.alloc_bytes += result.alloc_bytes;
+		if( result.heap_peak > total.heap_peak ) total.heap_peak = result.heap_peak;
+		total.cpu += result.cpu;
+	}
+	printf( "],\n\"total\":" );
+	bench_print( "total", &total, repeat );
+	printf( "}\n" );
+	return 0;
+}
@@ -0,0 +1,436 @@
+// Deterministic fault injection into SML captures, like bad IR alignment.
+// Frames of the captures get faults at random positions, the stream is
+// replayed from memory through sml_server_poll() and the result written as
+// JSON to stdout, one entry per kind of fault:
+//
+//	sml_fault [-s seed] [-r rate] [-f flip,drop,insert,truncate,escape,literal] <capture|directory> ...
+//
+// 'literal' is no fault but valid escaping, the frame keeps a correct CRC and
+// must be received. Its lost_faulted is expected to be 0.
+//
+// Resync latency is the count of bytes from a fault to start of the next frame
+// which is received again. Excess is the part beyond the start of next frame
+// without fault, it is not 0 when the fault also takes following clean frames.
+// Same seed gives the same faults, so runs are comparable. Build with
+// 'make SANITIZE=1' to check memory access as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "host.h"
+#include "sml_server.h"
+#include <sml/sml_crc16.h>
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define FAULT_RATE										0.2		// Share of frames with a fault
+#define FAULT_SEED										1
+#define FAULT_MAX_BYTES								4			// Dropped or inserted at once
+#define FAULT_ESCAPE_MIN							4			// Run of 0x1b
+#define FAULT_ESCAPE_MAX							12
+
+typedef enum
+{
+	FAULT_FLIP,								// One bit inverted
+	FAULT_DROP,								// 1 to 4 bytes lost
+	FAULT_INSERT,							// 1 to 4 random bytes added
+	FAULT_TRUNCATE,						// Rest of frame lost
+	FAULT_ESCAPE,							// Run of 0x1b added
+	FAULT_LITERAL,						// Escaped 1b1b1b1b and data like an end sequence, CRC fixed
+	FAULT_COUNT
+} fault_kind_t;
+
+static const char* const fault_str[FAULT_COUNT] =
+{
+	[FAULT_FLIP]				= "flip",
+	[FAULT_DROP]				= "drop",
+	[FAULT_INSERT]			= "insert",
+	[FAULT_TRUNCATE]		= "truncate",
+	[FAULT_ESCAPE]			= "escape",
+	[FAULT_LITERAL]			= "literal"
+};
+
+static const unsigned char fault_start_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01};
+static const unsigned char fault_end_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x1a};
+// Escaped literal 1b1b1b1b, then data which would end the frame without escape counting
+static const unsigned char fault_literal[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1a, 0x01, 0x00, 0x00};
+_Static_assert( sizeof(fault_literal) <= FAULT_ESCAPE_MAX, "Stream has room for FAULT_ESCAPE_MAX bytes per fault" );
+
+// Frame in stream with faults
+typedef struct
+{
+	size_t		start;
+	size_t		fault;						// Position of fault in stream
+	bool			faulted;
+	bool			received;
+} fault_frame_t;
+
+typedef struct
+{
+	unsigned char*	data;
+	size_t					len;
+	fault_frame_t*	frames;
+	uint32_t				count;
+} fault_stream_t;
+
+host_config_t host_config =
+{
+	.input = NULL,
+	.baud = 0,
+	.capture = NULL,
+	.broker = NULL,
+	.port = 1883
+};
+
+static uint64_t fault_random_state;
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static void usage( const char* name )
+{
+	fprintf( stderr,
+	         "Usage: %s [-s seed] [-r rate] [-f kinds] <capture|directory> ...\n"
+	         "  -s  Seed of faults, default %u\n"
+	         "  -r  Share of frames with a fault, default %.1f\n"
+	         "  -f  Comma separated kinds, default all: flip,drop,insert,truncate,escape,literal\n"
+	         "  Directories are searched for *.bin\n", name, FAULT_SEED, FAULT_RATE );
+	exit( 2 );
+}
+
+
+
+// Same sequence on every system, unlike rand(). 31 bits.
+static uint32_t fault_random( void )
+{
+	fault_random_state = fault_random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t)(fault_random_state >> 33);
+}
+
+static uint32_t fault_random_range( uint32_t min, uint32_t max )
+{
+	return min + fault_random() % (max - min + 1);
+}
+
+
+
+static double fault_cpu( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+// Appends file, or *.bin of directory. Memory of libc is not given to free(),
+// which is wrapped, see freertos_host.c.
+static void fault_load( const char* path, unsigned char** data, size_t* len )
+{
+	struct dirent* entry;
+	struct stat st;
+	char name[512];
+	FILE* file;
+	DIR* dir;
+
+	if( stat(path, &st) != 0 )
+	{
+		perror( path );
+		exit( 1 );
+	}
+	if( S_ISDIR(st.st_mode) == true )
+	{
+		dir = opendir( path );
+		while( (dir != NULL) && ((entry = readdir(dir)) != NULL) )
+		{
+			size_t n = strlen( entry->d_name );
+			if( (n <= 4) || (strcmp(&entry->d_name[n - 4], ".bin") != 0) ) continue;
+			snprintf( name, sizeof(name), "%s/%s", path, entry->d_name );
+			fault_load( name, data, len );
+		}
+		if( dir != NULL ) closedir( dir );
+		return;
+	}
+
+	file = fopen( path, "rb" );
+	*data = realloc( *data, *len + st.st_size );
+	if( (file == NULL) || (*data == NULL) || (fread(&(*data)[*len], 1, st.st_size, file) != (size_t)st.st_size) )
+	{
+		fprintf( stderr, "%s: Read failed\n", path );
+		exit( 1 );
+	}
+	fclose( file );
+	*len += st.st_size;
+}
+
+
+
+// Frames start at start sequence, bytes before first one are dropped
+static uint32_t fault_split( const unsigned char* data, size_t len, size_t* starts )
+{
+	uint32_t count = 0;
+
+	for( size_t n=0; n + sizeof(fault_start_seq) <= len; n++ )
+	{
+		if( memcmp(&data[n], fault_start_seq, sizeof(fault_start_seq)) != 0 ) continue;
+		if( starts != NULL ) starts[count] = n;
+		count++;
+		n += sizeof(fault_start_seq) - 1;
+	}
+	return count;
+}
+
+
+
+// Copies frames with a fault of kind in rate of them
+static void fault_inject( const unsigned char* data, const size_t* starts, uint32_t count, size_t end,
+                          fault_kind_t kind, double rate, fault_stream_t* stream )
+{
+	size_t len, pos, cut, add, at;
+	unsigned char* out;
+	uint16_t crc;
+
+	// Each fault adds at most FAULT_ESCAPE_MAX bytes, like a literal
+	stream->data = malloc( end + (size_t)count * FAULT_ESCAPE_MAX );
+	stream->frames = calloc( count, sizeof(fault_frame_t) );
+	stream->count = count;
+	stream->len = 0;
+	if( (stream->data == NULL) || (stream->frames == NULL) )
+	{
+		fprintf( stderr, "Out of memory\n" );
+		exit( 1 );
+	}
+
+	for( uint32_t i=0; i<count; i++ )
+	{
+		len = ((i + 1 < count) ? starts[i + 1] : end) - starts[i];
+		out = &stream->data[stream->len];
+		memcpy( out, &data[starts[i]], len );
+		stream->frames[i].start = stream->len;
+
+		if( fault_random() < rate * 2147483648.0 )
+		{
+			pos = fault_random_range( 0, len - 1 );
+			stream->frames[i].faulted = true;
+			stream->frames[i].fault = stream->len + pos;
+			switch( kind )
+			{
+				case FAULT_FLIP:
+					out[pos] ^= 1 << fault_random_range( 0, 7 );
+					break;
+
+				case FAULT_DROP:
+					cut = fault_random_range( 1, FAULT_MAX_BYTES );
+					if( cut > len - pos ) cut = len - pos;
+					memmove( &out[pos], &out[pos + cut], len - pos - cut );
+					len -= cut;
+					break;
+
+				case FAULT_INSERT:
+				case FAULT_ESCAPE:
+					if( kind == FAULT_INSERT ) add = fault_random_range( 1, FAULT_MAX_BYTES );
+					else add = fault_random_range( FAULT_ESCAPE_MIN, FAULT_ESCAPE_MAX );
+					memmove( &out[pos + add], &out[pos], len - pos );
+					for( size_t n=0; n<add; n++ ) out[pos + n] = (kind == FAULT_ESCAPE) ? 0x1b : fault_random();
+					len += add;
+					break;
+
+				case FAULT_LITERAL:
+					// In front of end sequence, so 4 byte grid and padding stay
+					for( at = (len >= 16) ? len - 8 : 0; (at > 8) && (memcmp(&out[at], fault_end_seq, sizeof(fault_end_seq)) != 0); at-- );
+					if( at <= 8 )
+					{
+						stream->frames[i].faulted = false;
+						break;
+					}
+					memmove( &out[at + sizeof(fault_literal)], &out[at], len - at );
+					memcpy( &out[at], fault_literal, sizeof(fault_literal) );
+					len += sizeof(fault_literal);
+					at += sizeof(fault_literal);
+					crc = sml_crc16_calculate( out, at + 6 );
+					out[at + 6] = crc >> 8;
+					out[at + 7] = crc & 0xff;
+					stream->frames[i].fault = stream->len + at - sizeof(fault_literal);
+					break;
+
+				default:
+					len = pos;
+					break;
+			}
+		}
+		stream->len += len;
+	}
+}
+
+
+
+// Frame which holds byte at pos
+static fault_frame_t* fault_frame_at( fault_stream_t* stream, size_t pos )
+{
+	uint32_t low = 0, high = stream->count;
+
+	while( high - low > 1 )
+	{
+		uint32_t mid = (low + high) / 2;
+		if( stream->frames[mid].start <= pos ) low = mid;
+		else high = mid;
+	}
+	return &stream->frames[low];
+}
+
+
+
+static void fault_run( fault_kind_t kind, const unsigned char* data, const size_t* starts, uint32_t count,
+                       size_t end, double rate, double clean_ns, bool first )
+{
+	fault_stream_t stream;
+	sml_stats_t stats_start, stats_end;
+	host_heap_t heap_start, heap_end;
+	uint32_t faults = 0, lost_clean = 0, lost_faulted = 0, resyncs = 0;
+	uint64_t latency_sum = 0, latency_max = 0, excess_sum = 0, excess_max = 0;
+	uint64_t latency, excess;
+	uint32_t clean;
+	double cpu;
+
+	fault_inject( data, starts, count, end, kind, rate, &stream );
+
+	host_replay_drain();
+	sml_server_stats( &stats_start );
+	host_heap_stats( &heap_start );
+
+	cpu = fault_cpu();
+	host_uart_mem( stream.data, stream.len );
+	while( host_uart_mem_pos() < stream.len )
+	{
+		// Frame ends at last byte read
+		if( sml_server_poll() == true ) fault_frame_at( &stream, host_uart_mem_pos() - 1 )->received = true;
+	}
+	cpu = fault_cpu() - cpu;
+
+	host_replay_drain();
+	sml_server_stats( &stats_end );
+	host_heap_stats( &heap_end );
+
+	for( uint32_t i=0; i<count; i++ )
+	{
+		if( stream.frames[i].faulted == false )
+		{
+			if( stream.frames[i].received == false ) lost_clean++;
+			continue;
+		}
+		faults++;
+		if( stream.frames[i].received == false ) lost_faulted++;
+
+		// Next frame received after fault, none at end of stream
+		for( clean=i+1; (clean < count) && (stream.frames[clean].faulted == true); clean++ );
+		for( uint32_t next=i+1; next<count; next++ )
+		{
+			if( stream.frames[next].received == false ) continue;
+			latency = stream.frames[next].start - stream.frames[i].fault;
+			excess = (next > clean) ? (stream.frames[next].start - stream.frames[clean].start) : 0;
+			latency_sum += latency;
+			excess_sum += excess;
+			if( latency > latency_max ) latency_max = latency;
+			if( excess > excess_max ) excess_max = excess;
+			resyncs++;
+			break;
+		}
+	}
+
+	printf( "%s  {\"fault\":\"%s\",\"frames\":%u,\"faults\":%u,\"received\":%u,", first ? "" : ",\n",
+	        fault_str[kind], count, faults, stats_end.frames - stats_start.frames );
+	printf( "\"lost_faulted\":%u,\"lost_clean\":%u,\"crc_errors\":%u,\"aborted\":%u,\"skipped\":%u,",
+	        lost_faulted, lost_clean, stats_end.crc_errors - stats_start.crc_errors,
+	        stats_end.aborted - stats_start.aborted, stats_end.skipped - stats_start.skipped );
+	printf( "\"resync_bytes_avg\":%.1f,\"resync_bytes_max\":%llu,\"excess_bytes_avg\":%.1f,\"excess_bytes_max\":%llu,",
+	        resyncs ? (double)latency_sum / resyncs : 0, (unsigned long long)latency_max,
+	        resyncs ? (double)excess_sum / resyncs : 0, (unsigned long long)excess_max );
+	printf( "\"ns_per_byte\":%.2f,\"clean_ns_per_byte\":%.2f,\"heap_leak\":%lld}",
+	        stream.len ? cpu * 1e9 / stream.len : 0, clean_ns,
+	        (long long)heap_end.used - (long long)heap_start.used );
+
+	free( stream.data );
+	free( stream.frames );
+}
+
+
+
+int main( int argc, char* argv[] )
+{
+	uint32_t seed = FAULT_SEED;
+	double rate = FAULT_RATE;
+	bool kinds[FAULT_COUNT];
+	bool first = true;
+	unsigned char* data = NULL;
+	size_t len = 0;
+	size_t* starts;
+	uint32_t count;
+	double cpu;
+	char* kind;
+	int opt;
+
+	for( uint8_t k=0; k<FAULT_COUNT; k++ ) kinds[k] = true;
+	while( (opt = getopt(argc, argv, "s:r:f:")) != -1 )
+	{
+		switch( opt )
+		{
+			case 's': seed = strtoul( optarg, NULL, 10 ); break;
+			case 'r': rate = atof( optarg ); break;
+			case 'f':
+				memset( kinds, 0, sizeof(kinds) );
+				for( kind = strtok(optarg, ","); kind != NULL; kind = strtok(NULL, ",") )
+				{
+					uint8_t k;
+					for( k=0; (k < FAULT_COUNT) && (strcmp(kind, fault_str[k]) != 0); k++ );
+					if( k == FAULT_COUNT ) usage( argv[0] );
+					kinds[k] = true;
+				}
+				break;
+			default: usage( argv[0] );
+		}
+	}
+	if( (optind >= argc) || (rate < 0) || (rate > 1) ) usage( argv[0] );
+	for( int i=optind; i<argc; i++ ) fault_load( argv[i], &data, &len );
+
+	count = fault_split( data, len, NULL );
+	starts = malloc( (count + 1) * sizeof(size_t) );
+	if( (count == 0) || (starts == NULL) )
+	{
+		fprintf( stderr, "No frames found\n" );
+		return 1;
+	}
+	fault_split( data, len, starts );
+	if( host_replay_init() == false ) return 1;
+
+	// Clean run as reference, also takes one time publishes out of the others
+	cpu = fault_cpu();
+	host_uart_mem( &data[starts[0]], len - starts[0] );
+	while( host_uart_mem_pos() < len - starts[0] ) sml_server_poll();
+	cpu = fault_cpu() - cpu;
+
+	printf( "{\"seed\":%u,\"rate\":%.3f,\"results\":[\n", seed, rate );
+	for( uint8_t k=0; k<FAULT_COUNT; k++ )
+	{
+		if( kinds[k] == false ) continue;
+		fault_random_state = seed;
+		fault_run( k, data, starts, count, len, rate, cpu * 1e9 / (len - starts[0]), first );
+		first = false;
+	}
+	printf( "\n]}\n" );
+	free( starts );
+	free( data );
+	return 0;
+}
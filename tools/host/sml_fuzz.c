@@ -0,0 +1,97 @@
+// Fuzz target of SML transport and parser, for libFuzzer or AFL.
+//
+//	make -C tools/host fuzz					# clang, libFuzzer with ASan and UBSan
+//	tools/host/build/fuzz/sml_fuzz corpus/ sml/libsml-testing
+//	make -C tools/host SANITIZE=1		# build-asan/sml_fuzz_replay for AFL or crash files
+//
+// Each input goes two ways: As byte stream through sml_server_poll(), where
+// the CRC check stops most random frames, and wrapped in start and end
+// sequence directly into sml_transport_receiver(), so the parser sees it too.
+// Without debug_init() and mqtt_init() debug and publish return early, which
+// keeps runs fast. Arguments of debug output are still evaluated.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "host.h"
+#include "sml_server.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+static const unsigned char fuzz_start_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01};
+static const unsigned char fuzz_end_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x1a, 0x00, 0x00, 0x00};
+
+host_config_t host_config =
+{
+	.input = NULL,
+	.baud = 0,
+	.capture = NULL,
+	.broker = NULL,
+	.port = 1883
+};
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+int LLVMFuzzerTestOneInput( const uint8_t* data, size_t size )
+{
+	static unsigned char frame[SML_BUFFER_LEN];
+
+	host_uart_mem( data, size );
+	while( host_uart_mem_pos() < size ) sml_server_poll();
+
+	if( size + sizeof(fuzz_start_seq) + sizeof(fuzz_end_seq) <= sizeof(frame) )
+	{
+		memcpy( frame, fuzz_start_seq, sizeof(fuzz_start_seq) );
+		memcpy( &frame[sizeof(fuzz_start_seq)], data, size );
+		memcpy( &frame[sizeof(fuzz_start_seq) + size], fuzz_end_seq, sizeof(fuzz_end_seq) );
+		sml_transport_receiver( frame, size + sizeof(fuzz_start_seq) + sizeof(fuzz_end_seq) );
+	}
+	return 0;
+}
+
+
+
+#ifdef SML_FUZZ_MAIN
+// Without libFuzzer: Each file given, or stdin like AFL does it
+static void fuzz_file( FILE* file, const char* name )
+{
+	static uint8_t data[SML_BUFFER_LEN * 4];
+	size_t size = fread( data, 1, sizeof(data), file );
+
+	if( ferror(file) )
+	{
+		perror( name );
+		exit( 1 );
+	}
+	LLVMFuzzerTestOneInput( data, size );
+}
+
+int main( int argc, char* argv[] )
+{
+	FILE* file;
+
+	if( argc < 2 ) fuzz_file( stdin, "stdin" );
+	for( int i=1; i<argc; i++ )
+	{
+		file = fopen( argv[i], "rb" );
+		if( file == NULL )
+		{
+			perror( argv[i] );
+			return 1;
+		}
+		fuzz_file( file, argv[i] );
+		fclose( file );
+	}
+	return 0;
+}
+#endif
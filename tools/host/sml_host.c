@@ -0,0 +1,167 @@
+// Host build of SML to MQTT pipeline: sml_server.c, mqtt.c, debug.c and buffer.h
+// of firmware with shims for FreeRTOS, UART, lwIP and paho, see Makefile.
+//
+//	sml_host -i <file|pty|-> [-B baud] [-o capture|-b broker[:port]] [-w] [-v] [-s stacks]
+//
+// Runs until end of input, then waits until all values are published and
+// prints a summary to stderr. Stack use of tasks is measured on the way, see
+// 'make stack' and tools/ram_report.py.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "host.h"
+#include "debug.h"
+#include "probe.h"
+#include "mqtt.h"
+#include "sml_server.h"
+#include "boot.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define HOST_DRAIN_POLL								100		// ms
+#define HOST_DRAIN_IDLE								3			// Polls without publish until done
+
+static const char* const host_probe_str[PROBE_COUNT] =
+{
+	[PROBE_UART_WAKEUP]	= "wakeup",
+	[PROBE_FRAME]				= "frame",
+	[PROBE_PARSE]				= "parse",
+	[PROBE_QUEUE]				= "queue",
+	[PROBE_SEND]				= "send"
+};
+
+host_config_t host_config =
+{
+	.input = "-",
+	.baud = 0,
+	.capture = NULL,
+	.broker = NULL,
+	.port = 1883
+};
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+static void usage( const char* name )
+{
+	fprintf( stderr,
+	         "Usage: %s [-i input] [-B baud] [-o capture | -b broker[:port]] [-w] [-v] [-s stacks]\n"
+	         "  -i  SML bytes from file, pty of meter simulator or '-' for stdin (default)\n"
+	         "  -B  Pace input like UART at this baud rate, default as fast as possible\n"
+	         "  -o  Write 'topic payload' lines to file, '-' for stdout (default)\n"
+	         "  -b  Publish to MQTT broker instead\n"
+	         "  -w  Wait when publish queue is full instead of dropping, for lossless replay\n"
+	         "  -v  Debug output to stderr\n"
+	         "  -s  Write stack use of tasks as JSON to file\n", name );
+	exit( 2 );
+}
+
+
+
+int main( int argc, char* argv[] )
+{
+	const char* capture = "-";
+	const char* stacks = NULL;
+	FILE* file;
+	bool verbose = false;
+	uint32_t published, last = 0, idle = 0;
+	uint64_t payload_bytes;
+	bool busy;
+	sml_stats_t stats;
+	host_heap_t heap;
+	uint32_t count;
+	uint64_t cycles;
+	char* colon;
+	int opt;
+
+	while( (opt = getopt(argc, argv, "i:B:o:b:wvs:")) != -1 )
+	{
+		switch( opt )
+		{
+			case 'i': host_config.input = optarg; break;
+			case 'B': host_config.baud = strtoul( optarg, NULL, 10 ); break;
+			case 'o': capture = optarg; break;
+			case 'b':
+				host_config.broker = optarg;
+				colon = strrchr( optarg, ':' );
+				if( colon != NULL )
+				{
+					*colon = '\0';
+					host_config.port = atoi( colon + 1 );
+				}
+				break;
+			case 'w': host_queue_block( true ); break;
+			case 'v': verbose = true; break;
+			case 's': stacks = optarg; break;
+			default: usage( argv[0] );
+		}
+	}
+	if( optind < argc ) usage( argv[0] );
+
+	if( host_config.broker == NULL )
+	{
+		host_config.capture = (strcmp(capture, "-") == 0) ? stdout : fopen( capture, "w" );
+		if( host_config.capture == NULL )
+		{
+			perror( capture );
+			return 1;
+		}
+	}
+
+	// Same order as user_init(), wifi is always up
+	debug_init();
+	probe_init();
+	if( verbose == true ) debug_wifi_init();
+	if( sml_server_init() == false ) return 1;
+	if( mqtt_init() == false ) return 1;
+	boot_mark( BOOT_INIT );
+
+	// All frames are handled when uart task blocks at end of input
+	while( (host_uart_done() == false) || (idle < HOST_DRAIN_IDLE) )
+	{
+		host_sleep_ms( HOST_DRAIN_POLL );
+		host_mqtt_stats( &published, &payload_bytes, &busy );
+		if( (host_uart_done() == true) && (host_queued() == 0) && (busy == false) && (published == last) ) idle++;
+		else idle = 0;
+		last = published;
+	}
+
+	sml_server_stats( &stats );
+	host_heap_stats( &heap );
+	fprintf( stderr, "frames %u, crc errors %u, extended %u\n", stats.frames, stats.crc_errors, stats.extended );
+	fprintf( stderr, "published %u, payload %llu bytes, mqtt errors %u\n", published,
+	         (unsigned long long)payload_bytes, mqtt_errors() );
+	fprintf( stderr, "heap: %u allocations, %zu bytes in use, peak %zu bytes\n", heap.allocs, heap.used, heap.peak );
+	for( uint8_t stage=0; stage<PROBE_COUNT; stage++ )
+	{
+		probe_get( stage, &count, &cycles );
+		if( count == 0 ) continue;
+		fprintf( stderr, "probe %s: n %u, avg %lluus\n", host_probe_str[stage], count,
+		         (unsigned long long)(cycles / count / PROBE_CYCLES_PER_US) );
+	}
+	if( host_config.capture != NULL ) fclose( host_config.capture );
+
+	if( stacks != NULL )
+	{
+		file = fopen( stacks, "w" );
+		if( file == NULL )
+		{
+			perror( stacks );
+			return 1;
+		}
+		host_task_report( file );
+		fclose( file );
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "sml_uart.h"
+#include "host.h"
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+// 7 data bits, even parity, start and stop bit like meter interface
+#define HOST_UART_BITS								10
+
+static int host_uart_fd = -1;
+static bool host_uart_eof = false;
+static uint64_t host_uart_bytes = 0;
+static struct timespec host_uart_start;
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Input replaces UART0, a tty (pty of meter simulator) is switched to raw mode
+bool sml_uart_init( void )
+{
+	struct termios tio;
+
+	if( strcmp(host_config.input, "-") == 0 ) host_uart_fd = STDIN_FILENO;
+	else host_uart_fd = open( host_config.input, O_RDONLY | O_NOCTTY );
+	if( host_uart_fd < 0 )
+	{
+		perror( host_config.input );
+		return false;
+	}
+	if( (isatty(host_uart_fd) == 1) && (tcgetattr(host_uart_fd, &tio) == 0) )
+	{
+		cfmakeraw( &tio );
+		tcsetattr( host_uart_fd, TCSANOW, &tio );
+	}
+	clock_gettime( CLOCK_MONOTONIC, &host_uart_start );
+	return true;
+}
+
+
+
+// Blocks until len bytes are read. Task stays blocked at end of input, like a meter
+// which stopped sending. With baud rate set, bytes are not returned before they
+// would have been received over the wire.
+size_t sml_uart_read( unsigned char *buffer, size_t len )
+{
+	struct timespec due;
+	uint64_t ns;
+	size_t n = 0;
+	ssize_t ret;
+
+	while( n < len )
+	{
+		ret = read( host_uart_fd, &buffer[n], len - n );
+		if( ret <= 0 )
+		{
+			host_uart_eof = true;
+			while( true ) host_sleep_ms( 1000 );
+		}
+		n += ret;
+	}
+
+	host_uart_bytes += len;
+	if( host_config.baud > 0 )
+	{
+		ns = host_uart_bytes * HOST_UART_BITS * 1000000000ULL / host_config.baud;
+		due.tv_sec = host_uart_start.tv_sec + (host_uart_start.tv_nsec + ns) / 1000000000ULL;
+		due.tv_nsec = (host_uart_start.tv_nsec + ns) % 1000000000ULL;
+		clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL );
+	}
+	return n;
+}
+
+
+
+// Errors of line can't be seen through a file
+void sml_uart_errors( uint32_t* overflows, uint32_t* framing_errors )
+{
+	*overflows = 0;
+	*framing_errors = 0;
+}
+
+
+
+// End of input was reached and all bytes before it were handed to transport
+bool host_uart_done( void )
+{
+	return host_uart_eof;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "espressif/esp_common.h"
+#include "wifi.h"
+#include "light.h"
+#include "rboot-ota/ota-http.h"
+
+
+
+//*****************************************************************************
+// SDK
+//*****************************************************************************
+
+// us since start of process, wraps like SDK after 71 minutes
+uint32_t sdk_system_get_time( void )
+{
+	static struct timespec start;
+	struct timespec now;
+
+	if( start.tv_sec == 0 ) clock_gettime( CLOCK_MONOTONIC, &start );
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint32_t)((now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000);
+}
+
+uint32_t sdk_system_get_free_heap_size( void )
+{
+	return xPortGetFreeHeapSize();
+}
+
+// Locally administered address, topic ids stay the same on every run
+bool sdk_wifi_get_macaddr( uint8_t if_index, uint8_t* macaddr )
+{
+	static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+	for( int n=0; n<6; n++ ) macaddr[n] = host_mac[n];
+	return true;
+}
+
+
+
+//*****************************************************************************
+// Firmware modules which are not part of host build
+//*****************************************************************************
+
+// Host is always connected
+EventBits_t wifi_wait( EventBits_t bits, TickType_t timeout )
+{
+	return bits & WIFI_EVENT_GOT_IP;
+}
+
+void wifi_pub_stations( void )
+{
+}
+
+bool wifi_connect_cached( void )
+{
+	return false;
+}
+
+void light_start( const char* str, size_t len )
+{
+	fprintf( stderr, "light: %.*s\n", (int)len, str );
+}
+
+bool ota_http_start( const char* server, uint16_t len )
+{
+	return false;
+}
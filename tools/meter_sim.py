@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""Simulated meter with IR head: sends SML frames over a pty at baud rate timing.
+
+Replaces the OpenWay 3HZ with its IR reader for tests without hardware.
+Frames are synthesised with selected OBIS values, or taken from captures:
+	tools/meter_sim.py --host tools/host/build/sml_host
+	tools/meter_sim.py --capture sml/libsml-testing/*.bin --interval 0
+	tools/meter_sim.py                      # then: sml_host -i <pty shown>
+
+With --host the host build reads the pty and writes values to stdout. Frame
+latency (last byte sent -> value line) and lost frames are taken from 1.8.0,
+which changes with each synthesised frame. --device sends to a serial port
+instead, e.g. a USB adapter at RX of the ESP.
+"""
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+import termios
+import threading
+import time
+import tty
+
+# 7 data bits, even parity, start and stop bit
+BITS_PER_BYTE = 10
+
+START = b'\x1b\x1b\x1b\x1b\x01\x01\x01\x01'
+SERVER_ID = b'\x0a\x01\x49\x53\x4b\x00\x04\x2f\x5e\x21'
+
+# OBIS C.D.E of group A=1, B=0 -> unit (DLMS), scaler, kind
+OBIS = {
+	'1.8.0': (30, -1, 'import'),
+	'2.8.0': (30, -1, 'export'),
+	'16.7.0': (27, 0, 'power'),
+	'36.7.0': (27, 0, 'phase'),
+	'56.7.0': (27, 0, 'phase'),
+	'76.7.0': (27, 0, 'phase'),
+	'96.1.0': (None, None, 'id'),
+}
+
+BAUD = {1200: termios.B1200, 2400: termios.B2400, 4800: termios.B4800, 9600: termios.B9600,
+        19200: termios.B19200, 38400: termios.B38400, 57600: termios.B57600, 115200: termios.B115200}
+
+
+#*****************************************************************************
+# SML encoding
+#*****************************************************************************
+
+def crc16(data):
+	crc = 0xffff
+	for byte in data:
+		crc ^= byte
+		for _ in range(8):
+			crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+	crc ^= 0xffff
+	return ((crc & 0xff) << 8) | (crc >> 8)
+
+
+def octet(data):
+	if len(data) + 1 < 16:
+		return bytes([len(data) + 1]) + data
+	return bytes([0x80 | ((len(data) + 2) >> 4), (len(data) + 2) & 0x0f]) + data
+
+
+def unsigned(value, size):
+	return bytes([0x60 | (size + 1)]) + value.to_bytes(size, 'big')
+
+
+def signed(value, size):
+	return bytes([0x50 | (size + 1)]) + value.to_bytes(size, 'big', signed=True)
+
+
+def sml_list(*items):
+	return bytes([0x70 | len(items)]) + b''.join(items)
+
+
+SKIP = b'\x01'
+
+
+def message(transaction, body):
+	data = b'\x76' + octet(transaction) + unsigned(0, 1) + unsigned(0, 1) + body
+	return data + unsigned(crc16(data), 2) + b'\x00'
+
+
+def frame(index, values):
+	"""Open response, get list response and close response like the meter"""
+	transaction = lambda n: bytes([index & 0xff, (index >> 8) & 0xff, n])
+	seconds = sml_list(unsigned(1, 1), unsigned(index & 0xffffffff, 4))
+	entries = []
+	for obis, (unit, scaler, value) in values.items():
+		if isinstance(value, bytes):
+			encoded = octet(value)
+		elif value < 0:
+			encoded = signed(value, 4)
+		else:
+			encoded = unsigned(value, 8 if value > 0xffffffff else 4)
+		name = octet(bytes([1, 0] + [int(x) for x in obis.split('.')] + [255]))
+		entries.append(sml_list(name, SKIP, SKIP, unsigned(unit, 1) if unit else SKIP,
+		                        signed(scaler, 1) if scaler is not None else SKIP, encoded, SKIP))
+
+	body = message(transaction(1), sml_list(unsigned(0x0101, 4),
+	               sml_list(SKIP, SKIP, octet(b'\x01\x02'), octet(SERVER_ID), seconds, SKIP)))
+	body += message(transaction(2), sml_list(unsigned(0x0701, 4),
+	                sml_list(SKIP, octet(SERVER_ID), octet(bytes([1, 0, 0x62, 0x0a, 0xff, 0xff])),
+	                         seconds, sml_list(*entries), SKIP, SKIP)))
+	body += message(transaction(3), sml_list(unsigned(0x0201, 4), sml_list(SKIP)))
+	pad = (4 - len(body) % 4) % 4
+	data = START + body + b'\x00' * pad + b'\x1b\x1b\x1b\x1b\x1a' + bytes([pad])
+	crc = crc16(data)
+	return data + bytes([crc >> 8, crc & 0xff])
+
+
+class Meter:
+	"""Synthesised values, energy counts up with power so 1.8.0 differs in each frame"""
+
+	def __init__(self, obis, power, noise, interval):
+		self.obis = obis
+		self.power = power
+		self.noise = noise
+		self.interval = interval
+		self.imported = 12345670		# 0.1 Wh
+		self.exported = 0
+		self.index = 0
+
+	def next(self):
+		power = round(self.power + random.uniform(-self.noise, self.noise))
+		energy = max(1, round(abs(power) * max(self.interval, 1) / 360))
+		if power >= 0:
+			self.imported += energy
+		else:
+			self.exported += energy
+		values = {}
+		for obis in self.obis:
+			unit, scaler, kind = OBIS[obis]
+			value = {'import': self.imported, 'export': self.exported, 'power': power,
+			         'phase': power // 3, 'id': SERVER_ID}[kind]
+			values[obis] = (unit, scaler, value)
+		self.index += 1
+		return frame(self.index, values), self.imported / 10
+
+
+def split_frames(data):
+	"""Frames of a capture, bytes before first start sequence are dropped"""
+	starts = [m.start() for m in re.finditer(re.escape(START), data)]
+	return [data[a:b] for a, b in zip(starts, starts[1:] + [len(data)])]
+
+
+#*****************************************************************************
+# Output
+#*****************************************************************************
+
+def send(fd, data, baud, jitter, start):
+	"""Writes each byte not before it would be through the wire, returns end time.
+	Jitter adds a random gap up to that many us before each byte."""
+	due = []
+	at = start
+	for _ in data:
+		at += BITS_PER_BYTE / baud + (random.uniform(0, jitter) / 1e6 if jitter else 0)
+		due.append(at)
+	sent = 0
+	while sent < len(data):
+		now = time.monotonic()
+		count = sent
+		while count < len(data) and due[count] <= now:
+			count += 1
+		if count > sent:
+			sent += os.write(fd, data[sent:count])
+		else:
+			time.sleep(due[sent] - now)
+	return due[-1]
+
+
+def open_device(path, baud):
+	fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+	tty.setraw(fd)
+	attr = termios.tcgetattr(fd)
+	attr[2] = (attr[2] & ~(termios.CSIZE | termios.PARODD)) | termios.CS7 | termios.PARENB
+	attr[4] = attr[5] = BAUD[baud]
+	termios.tcsetattr(fd, termios.TCSANOW, attr)
+	return fd
+
+
+def read_host(process, lines):
+	for line in process.stdout:
+		lines.append((time.monotonic(), line))
+
+
+def percentile(values, p):
+	return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report(sent, lines, frames, corrupted, duration, bytes_sent, baud):
+	print('sent %d frames, %d bytes in %.1fs (line %.0f%% busy), %d corrupted' %
+	      (frames, bytes_sent, duration, bytes_sent * BITS_PER_BYTE * 100.0 / baud / duration if duration else 0, corrupted))
+	print('received %d values' % len(lines))
+	if not sent:
+		return
+	received = {}
+	for at, line in lines:
+		match = re.search(r'1\.8\.0\*255 \{"value":([0-9.]+)', line)
+		if match and float(match.group(1)) not in received:
+			received[float(match.group(1))] = at
+	latency = sorted((received[value] - at) * 1000 for value, at in sent if value in received)
+	lost = len(sent) - len(latency)
+	print('frames with 1.8.0: %d received, %d lost (%.1f%%)' % (len(latency), lost, lost * 100.0 / len(sent)))
+	if latency:
+		print('latency ms: min %.1f, avg %.1f, p50 %.1f, p95 %.1f, max %.1f' %
+		      (latency[0], sum(latency) / len(latency), percentile(latency, 50), percentile(latency, 95), latency[-1]))
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('--capture', nargs='+', help='send frames of these captures instead of synthesised ones')
+	parser.add_argument('--obis', default='96.1.0,1.8.0,2.8.0,16.7.0',
+	                    help='synthesised values, any of %s' % ','.join(OBIS))
+	parser.add_argument('--power', type=float, default=350, help='W, negative feeds in')
+	parser.add_argument('--noise', type=float, default=50, help='W, random change of power')
+	parser.add_argument('--interval', type=float, default=1.0, help='s between frame starts, 0 back to back')
+	parser.add_argument('--frames', type=int, default=0, help='stop after that many, default 60 or all of captures')
+	parser.add_argument('--baud', type=int, default=9600)
+	parser.add_argument('--jitter', type=float, default=0, help='us, random gap up to that before each byte')
+	parser.add_argument('--corrupt', type=float, default=0, help='fraction of frames with one bit flipped')
+	parser.add_argument('--seed', type=int, default=1)
+	parser.add_argument('--delay', type=float, default=2.0, help='s before first frame, time to start reader')
+	parser.add_argument('--device', help='serial port instead of pty')
+	parser.add_argument('--host', help='run this host build on the pty and measure latency and loss')
+	args = parser.parse_args()
+
+	random.seed(args.seed)
+	obis = args.obis.split(',')
+	for name in obis:
+		if name not in OBIS:
+			sys.exit('Unknown OBIS %s' % name)
+	if args.device and args.baud not in BAUD:
+		sys.exit('Baud rate of serial port needs to be one of %s' % ', '.join(map(str, BAUD)))
+
+	captured = []
+	for path in args.capture or []:
+		with open(path, 'rb') as f:
+			captured += split_frames(f.read())
+	if args.capture and not captured:
+		sys.exit('No frames in captures')
+	count = args.frames or (len(captured) if captured else 60)
+
+	# Slave stays open here, so data is kept until reader opens it
+	if args.device:
+		fd, name = open_device(args.device, args.baud), args.device
+	else:
+		fd, slave = os.openpty()
+		tty.setraw(slave)
+		name = os.ttyname(slave)
+	print('Meter on %s, %d frames at %d baud' % (name, count, args.baud), flush=True)
+
+	lines = []
+	process = None
+	if args.host:
+		process = subprocess.Popen([args.host, '-i', name, '-o', '-'], stdout=subprocess.PIPE, text=True)
+		reader = threading.Thread(target=read_host, args=(process, lines), daemon=True)
+		reader.start()
+	time.sleep(args.delay)
+
+	meter = Meter(obis, args.power, args.noise, args.interval)
+	sent = []
+	frames = 0
+	corrupted = 0
+	bytes_sent = 0
+	start = next_start = time.monotonic()
+	try:
+		for index in range(count):
+			if captured:
+				data, value = captured[index % len(captured)], None
+			else:
+				data, value = meter.next()
+			if random.random() < args.corrupt:
+				data = bytearray(data)
+				data[random.randrange(len(data))] ^= 1 << random.randrange(8)
+				data = bytes(data)
+				corrupted += 1
+				value = None
+			now = time.monotonic()
+			if next_start > now:
+				time.sleep(next_start - now)
+			end = send(fd, data, args.baud, args.jitter, max(next_start, now))
+			next_start += args.interval
+			frames += 1
+			bytes_sent += len(data)
+			if '1.8.0' in obis and value is not None:
+				sent.append((value, end))
+	except KeyboardInterrupt:
+		pass
+	duration = time.monotonic() - start
+
+	if process:
+		# Values of last frame are still on their way
+		time.sleep(1.0)
+		os.close(fd)
+		process.wait()
+		reader.join(1.0)
+	report(sent, lines, frames, corrupted, duration, bytes_sent, args.baud)
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Pack firmware image for compressed OTA upload (see rboot-ota/ota-image.h).
+
+	tools/ota_pack.py firmware/main.bin firmware/main.lz4
+	tftp -m octet <esp-ip> -c put firmware/main.lz4 main.lz4
+
+Uses the 'lz4' python module when installed, otherwise a built in compressor.
+Output is decompressed again and compared before it is written.
+"""
+
+import struct
+import sys
+
+MAGIC = 0x315a4c4f				# "OLZ1"
+BLOCK = 4096						# One flash sector
+STORED = 0x8000
+MIN_MATCH = 4
+MF_LIMIT = 12						# LZ4: last match starts at least 12 bytes before end
+LAST_LITERALS = 5				# LZ4: last 5 bytes are always literals
+
+try:
+	import lz4.block
+
+	def compress_block(data):
+		return lz4.block.compress(data, mode='high_compression', store_size=False)
+except ImportError:
+	lz4 = None
+
+	def compress_block(data):
+		return compress_block_simple(data)
+
+
+def length_bytes(length):
+	out = bytearray()
+	while length >= 255:
+		out.append(255)
+		length -= 255
+	out.append(length)
+	return out
+
+
+def sequence(literals, offset=None, match=0):
+	lit = len(literals)
+	token = min(lit, 15) << 4
+	if offset is not None:
+		token |= min(match - MIN_MATCH, 15)
+	out = bytearray([token])
+	if lit >= 15:
+		out += length_bytes(lit - 15)
+	out += literals
+	if offset is not None:
+		out += struct.pack('<H', offset)
+		if match - MIN_MATCH >= 15:
+			out += length_bytes(match - MIN_MATCH - 15)
+	return out
+
+
+def compress_block_simple(data):
+	"""Greedy LZ4 block compressor with a hash of the last position of each 4 byte string"""
+	n = len(data)
+	out = bytearray()
+	table = {}
+	anchor = 0
+	i = 0
+	while i < n - MF_LIMIT:
+		key = data[i:i + MIN_MATCH]
+		candidate = table.get(key)
+		table[key] = i
+		if candidate is None:
+			i += 1
+			continue
+		match = MIN_MATCH
+		limit = n - LAST_LITERALS - i
+		while match < limit and data[candidate + match] == data[i + match]:
+			match += 1
+		while i > anchor and candidate > 0 and data[i - 1] == data[candidate - 1]:
+			i -= 1
+			candidate -= 1
+			match += 1
+		out += sequence(data[anchor:i], i - candidate, match)
+		i += match
+		anchor = i
+	out += sequence(data[anchor:])
+	return bytes(out)
+
+
+def decompress_block(src, size):
+	out = bytearray()
+	i = 0
+	while i < len(src):
+		token = src[i]
+		i += 1
+		lit = token >> 4
+		if lit == 15:
+			while True:
+				lit += src[i]
+				i += 1
+				if src[i - 1] != 255:
+					break
+		out += src[i:i + lit]
+		i += lit
+		if i >= len(src):
+			break
+		offset = src[i] | src[i + 1] << 8
+		i += 2
+		match = token & 15
+		if match == 15:
+			while True:
+				match += src[i]
+				i += 1
+				if src[i - 1] != 255:
+					break
+		for _ in range(match + MIN_MATCH):
+			out.append(out[-offset])
+	if len(out) != size:
+		raise ValueError('block decompressed to %d bytes, expected %d' % (len(out), size))
+	return bytes(out)
+
+
+def pack(image):
+	out = bytearray(struct.pack('<II', MAGIC, len(image)))
+	stored = 0
+	for start in range(0, len(image), BLOCK):
+		raw = image[start:start + BLOCK]
+		data = compress_block(raw)
+		if len(data) >= len(raw):
+			out += struct.pack('<H', len(raw) | STORED) + raw
+			stored += 1
+		else:
+			out += struct.pack('<H', len(data)) + data
+	return bytes(out), stored
+
+
+def unpack(packed):
+	magic, length = struct.unpack('<II', packed[:8])
+	if magic != MAGIC:
+		raise ValueError('bad magic')
+	out = bytearray()
+	i = 8
+	while len(out) < length:
+		header = struct.unpack('<H', packed[i:i + 2])[0]
+		size = header & ~STORED
+		data = packed[i + 2:i + 2 + size]
+		i += 2 + size
+		out += data if header & STORED else decompress_block(data, min(BLOCK, length - len(out)))
+	if i != len(packed):
+		raise ValueError('data after last block')
+	return bytes(out)
+
+
+def main():
+	if len(sys.argv) != 3:
+		print(__doc__)
+		sys.exit(1)
+	with open(sys.argv[1], 'rb') as f:
+		image = f.read()
+	packed, stored = pack(image)
+	if unpack(packed) != image:
+		sys.exit('Check of packed image failed')
+	with open(sys.argv[2], 'wb') as f:
+		f.write(packed)
+	print('%s: %d -> %d bytes (%.1f%%), %d of %d blocks stored, %s compressor' % (
+		sys.argv[2], len(image), len(packed), 100.0 * len(packed) / max(len(image), 1), stored,
+		(len(image) + BLOCK - 1) // BLOCK, 'lz4 module' if lz4 else 'built in'))
+
+
+if __name__ == '__main__':
+	main()
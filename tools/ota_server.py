@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Local update server for HTTP pull OTA (see rboot-ota/ota-http.h).
+
+Serves files of the firmware directory with Range support and generates
+'manifest.txt' for the image, version defaults to 'git describe' like the Makefile:
+	make ota-pack
+	tools/ota_server.py firmware
+	mosquitto_pub -h <broker> -t OpenWay/Remote/Ota -m <server-ip>:8000
+
+--drop closes every image response after that many bytes, so each meter has to
+resume with Range requests, like after a wifi drop.
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import re
+import subprocess
+import sys
+
+MANIFEST = 'manifest.txt'
+
+
+def git_version():
+	try:
+		return subprocess.check_output(['git', 'describe', '--always', '--dirty'],
+		                               stderr=subprocess.DEVNULL, text=True).strip()
+	except (OSError, subprocess.CalledProcessError):
+		return None
+
+
+def make_manifest(directory, name, version):
+	with open(os.path.join(directory, name), 'rb') as f:
+		data = f.read()
+	return ('version %s\nfile %s\nsize %d\nsha256 %s\n' %
+	        (version, name, len(data), hashlib.sha256(data).hexdigest())).encode()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+	protocol_version = 'HTTP/1.1'
+
+	def do_GET(self):
+		name = self.path.lstrip('/').split('/')[-1]
+		if name == MANIFEST:
+			data = make_manifest(self.server.directory, self.server.image, self.server.version)
+		elif name in (self.server.image, 'main.bin', 'main.lz4') and os.path.isfile(os.path.join(self.server.directory, name)):
+			with open(os.path.join(self.server.directory, name), 'rb') as f:
+				data = f.read()
+		else:
+			self.send_error(404)
+			return
+
+		start = 0
+		match = re.fullmatch(r'bytes=(\d+)-', self.headers.get('Range', ''))
+		if match:
+			start = int(match.group(1))
+			if start >= len(data):
+				self.send_response(416)
+				self.send_header('Content-Range', 'bytes */%d' % len(data))
+				self.send_header('Content-Length', '0')
+				self.send_header('Connection', 'close')
+				self.end_headers()
+				return
+			self.send_response(206)
+			self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, len(data) - 1, len(data)))
+		else:
+			self.send_response(200)
+		self.send_header('Content-Length', str(len(data) - start))
+		self.send_header('Connection', 'close')
+		self.end_headers()
+
+		body = data[start:]
+		if name != MANIFEST and self.server.drop:
+			body = body[:self.server.drop]
+		self.wfile.write(body)
+		self.close_connection = True
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('directory', nargs='?', default='firmware')
+	parser.add_argument('--port', type=int, default=8000)
+	parser.add_argument('--version', default=git_version(), help='default: git describe --always --dirty')
+	parser.add_argument('--file', help='image in manifest, default: main.lz4 if present, else main.bin')
+	parser.add_argument('--drop', type=int, default=0, help='bytes per image response before closing')
+	args = parser.parse_args()
+
+	image = args.file
+	if image is None:
+		image = 'main.lz4' if os.path.isfile(os.path.join(args.directory, 'main.lz4')) else 'main.bin'
+	if not os.path.isfile(os.path.join(args.directory, image)):
+		sys.exit('%s not found in %s' % (image, args.directory))
+	if not args.version:
+		sys.exit('No version, use --version')
+
+	server = http.server.ThreadingHTTPServer(('', args.port), Handler)
+	server.directory = args.directory
+	server.image = image
+	server.version = args.version
+	server.drop = args.drop
+	print('Serving %s version %s on port %d' % (image, args.version, args.port))
+	server.serve_forever()
+
+
+if __name__ == '__main__':
+	main()
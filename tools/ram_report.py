@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""Static RAM of firmware per symbol and module, with stack use of tasks.
+
+	make ram-report
+	tools/ram_report.py --map build/main.map --stacks tools/host/build/stack.json build/main.out
+
+Symbols are taken from the ELF with nm, everything placed in DRAM counts:
+initialised data, zeroed data (bss) and constants which are not moved to flash.
+Modules are the input files of the linker map, so string literals and other
+data without symbol are included. Without map, modules come from debug info.
+
+Task stacks are allocated from heap at runtime. Their configured size is set
+against use measured by the host build ('make -C tools/host stack'). Host frames
+are larger (64 bit, glibc printf), so it is an upper bound, compare tasks with
+each other and with high-water marks published by diag.c on the device.
+"""
+
+import argparse
+import bisect
+import collections
+import json
+import os
+import re
+import subprocess
+import sys
+
+# ESP8266 data RAM, heap is what remains after static data
+DRAM = (0x3ffe8000, 0x40000000)
+STACK_WORD = 4
+
+KIND = {'d': 'data', 'b': 'bss', 'c': 'bss', 'r': 'rodata'}
+
+
+#*****************************************************************************
+# Input
+#*****************************************************************************
+
+def read_symbols(nm, elf, lines):
+	"""(address, size, kind, name, file) of sized symbols"""
+	cmd = [nm, '-S', '--defined-only'] + (['-l'] if lines else []) + [elf]
+	try:
+		output = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+	except (OSError, subprocess.CalledProcessError) as e:
+		sys.exit('%s: %s' % (nm, e))
+	symbols = []
+	for line in output.splitlines():
+		line, _, source = line.partition('\t')
+		fields = line.split()
+		if len(fields) != 4:
+			continue
+		kind = KIND.get(fields[2].lower())
+		if kind is None:
+			continue
+		source = os.path.relpath(os.path.normpath(source.rsplit(':', 1)[0])) if source else '?'
+		symbols.append((int(fields[0], 16), int(fields[1], 16), kind, fields[3], source))
+	return symbols
+
+
+def module_name(path):
+	"""'libsml.a(sml_list.o)' and 'build/sml/sml_server.o' -> 'libsml.a(sml_list.o)', 'sml/sml_server.o'"""
+	match = re.match(r'(.*?)([^/]+\.a)\((.*)\)$', path)
+	if match:
+		return '%s(%s)' % (match.group(2), match.group(3))
+	parts = os.path.normpath(path).split(os.sep)
+	return '/'.join(parts[-2:]) if len(parts) > 1 and parts[-2] != 'build' else parts[-1]
+
+
+def section_kind(name):
+	for prefix, kind in (('.bss', 'bss'), ('COMMON', 'bss'), ('.rodata', 'rodata'), ('.data', 'data')):
+		if name.startswith(prefix):
+			return kind
+	return None
+
+
+def read_map(path, ram):
+	"""Sorted (start, size, module, kind) of input sections in RAM from GNU ld map"""
+	ranges = []
+	section = None
+	started = False
+	with open(path) as f:
+		for line in f:
+			if not started:
+				started = line.startswith('Linker script and memory map')
+				continue
+			# Long section names are on a line of their own
+			match = re.match(r'^ (\.\S+|COMMON)\s*$', line)
+			if match:
+				section = match.group(1)
+				continue
+			match = re.match(r'^ (\.\S+|COMMON)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$', line)
+			if match:
+				name = match.group(1) or section
+				start, size = int(match.group(2), 16), int(match.group(3), 16)
+				if name and size and ram[0] <= start < ram[1]:
+					ranges.append((start, size, module_name(match.group(4).strip()), section_kind(name)))
+			section = None
+	ranges.sort()
+	return ranges
+
+
+def read_stacks(path):
+	with open(path) as f:
+		return [t for t in json.load(f)['tasks'] if t['stack_words'] > 0]
+
+
+#*****************************************************************************
+# Output
+#*****************************************************************************
+
+def report_symbols(symbols, top):
+	print('Largest symbols:')
+	print('  %-40s %-7s %8s  %s' % ('symbol', 'kind', 'bytes', 'module'))
+	for address, size, kind, name, module in sorted(symbols, key=lambda s: -s[1])[:top]:
+		print('  %-40s %-7s %8d  %s' % (name, kind, size, module))
+
+
+def report_modules(modules, top):
+	print('Largest modules:')
+	print('  %-40s %8s %8s %8s %8s' % ('module', 'data', 'bss', 'rodata', 'total'))
+	for name, kinds in sorted(modules.items(), key=lambda m: -sum(m[1].values()))[:top]:
+		print('  %-40s %8d %8d %8d %8d' % (name, kinds['data'], kinds['bss'], kinds['rodata'], sum(kinds.values())))
+
+
+def report_stacks(stacks):
+	print('Task stacks (host use is an upper bound, see above):')
+	print('  %-16s %8s %8s %10s %6s' % ('task', 'words', 'bytes', 'host used', 'used'))
+	total = 0
+	for task in stacks:
+		size = task['stack_words'] * STACK_WORD
+		total += size
+		print('  %-16s %8d %8d %10d %5.0f%%%s' % (task['name'], task['stack_words'], size, task['used_bytes'],
+		      task['used_bytes'] * 100.0 / size, '  check on device' if task['used_bytes'] > size else ''))
+	print('  %-16s %8s %8d' % ('total', '', total))
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('elf')
+	parser.add_argument('--nm', default='xtensa-lx106-elf-nm')
+	parser.add_argument('--map', help='linker map, gives modules including data without symbol')
+	parser.add_argument('--stacks', help='stack use of tasks measured by host build')
+	parser.add_argument('--ram', default='%x-%x' % DRAM, help='address range of RAM, default %x-%x' % DRAM)
+	parser.add_argument('--top', type=int, default=20, help='symbols and modules listed, default 20')
+	parser.add_argument('--budget', type=int, help='bytes of static RAM, exit code 1 above')
+	args = parser.parse_args()
+
+	ram = tuple(int(x, 16) for x in args.ram.split('-'))
+	ranges = read_map(args.map, ram) if args.map and os.path.exists(args.map) else []
+	if args.map and not ranges:
+		print('No RAM sections in %s, modules from debug info' % args.map, file=sys.stderr)
+	symbols = [s for s in read_symbols(args.nm, args.elf, not ranges) if ram[0] <= s[0] < ram[1]]
+
+	modules = collections.defaultdict(lambda: collections.Counter(data=0, bss=0, rodata=0))
+	totals = collections.Counter(data=0, bss=0, rodata=0)
+	if ranges:
+		# Sections of unusual name get the kind of their symbols, without any they are no data
+		starts = [r[0] for r in ranges]
+		kinds = {}
+		for i, symbol in enumerate(symbols):
+			n = bisect.bisect_right(starts, symbol[0]) - 1
+			if n >= 0 and symbol[0] < ranges[n][0] + ranges[n][1]:
+				kinds[n] = symbol[2]
+				symbols[i] = symbol[:4] + (ranges[n][2],)
+		for n, (start, size, module, kind) in enumerate(ranges):
+			kind = kind or kinds.get(n)
+			if kind is None:
+				continue
+			modules[module][kind] += size
+			totals[kind] += size
+	else:
+		for address, size, kind, name, module in symbols:
+			modules[module][kind] += size
+			totals[kind] += size
+
+	total = sum(totals.values())
+	print('Static RAM: %d bytes (data %d, bss %d, rodata %d)\n' % (total, totals['data'], totals['bss'], totals['rodata']))
+	report_symbols(symbols, args.top)
+	print()
+	report_modules(modules, args.top)
+	if args.stacks:
+		print()
+		report_stacks(read_stacks(args.stacks))
+
+	if args.budget is not None and total > args.budget:
+		print('\nStatic RAM exceeds budget of %d bytes by %d' % (args.budget, total - args.budget))
+		sys.exit(1)
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Measure TFTP OTA transfer time for block size / window size combinations.
+
+Each successful transfer makes the device switch slot and restart, so the
+WRQ of the next run is repeated until the TFTP server is up again:
+	tools/tftp_bench.py <esp-ip> firmware/main.bin
+	tools/tftp_bench.py <esp-ip> firmware/main.bin 512:1 1468:1 1468:4
+
+Combinations are given as blksize:windowsize, 'plain' sends no options.
+"""
+
+import socket
+import struct
+import sys
+import time
+
+OP_WRQ, OP_DATA, OP_ACK, OP_ERROR, OP_OACK = 2, 3, 4, 5, 6
+PORT = 69
+FILENAME = 'main.bin'
+TIMEOUT = 2.0
+RETRIES = 5
+RESTART_WAIT = 120			# s, device restarts after each successful transfer
+DEFAULT_COMBINATIONS = ['plain', '512:4', '1024:1', '1468:1', '1468:2', '1468:4']
+
+
+class TftpError(Exception):
+	pass
+
+
+def wrq(blksize, windowsize):
+	packet = struct.pack('!H', OP_WRQ) + FILENAME.encode() + b'\0octet\0'
+	if blksize:
+		packet += b'blksize\0%d\0' % blksize
+	if windowsize:
+		packet += b'windowsize\0%d\0' % windowsize
+	return packet
+
+
+def parse_oack(payload):
+	fields = payload.split(b'\0')
+	return {fields[n].decode().lower(): int(fields[n + 1]) for n in range(0, len(fields) - 1, 2)}
+
+
+def check_error(packet):
+	opcode = struct.unpack('!H', packet[:2])[0]
+	if opcode == OP_ERROR:
+		code = struct.unpack('!H', packet[2:4])[0]
+		raise TftpError('error %d: %s' % (code, packet[4:].rstrip(b'\0').decode(errors='replace')))
+	return opcode
+
+
+def put(host, image, blksize=None, windowsize=None, wait=0):
+	"""Send image, returns (seconds, negotiated blksize, windowsize, retransmitted blocks).
+	WRQ is repeated for 'wait' seconds, until device is up. Time is measured from answered WRQ."""
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.settimeout(TIMEOUT)
+	deadline = time.monotonic() + max(wait, TIMEOUT * RETRIES)
+
+	while True:
+		start = time.monotonic()
+		sock.sendto(wrq(blksize, windowsize), (host, PORT))
+		try:
+			packet, peer = sock.recvfrom(1500)
+			break
+		except (socket.timeout, ConnectionRefusedError):
+			if time.monotonic() > deadline:
+				raise TftpError('no answer to WRQ')
+
+	opcode = check_error(packet)
+	options = parse_oack(packet[2:]) if opcode == OP_OACK else {}
+	blksize = options.get('blksize', 512)
+	windowsize = options.get('windowsize', 1)
+	blocks = len(image) // blksize + 1				# Last block is short, maybe empty
+	acked = 0
+	retransmits = 0
+	retries = RETRIES
+
+	while acked < blocks:
+		last = min(acked + windowsize, blocks)
+		for block in range(acked + 1, last + 1):
+			data = image[(block - 1) * blksize:block * blksize]
+			sock.sendto(struct.pack('!HH', OP_DATA, block & 0xffff) + data, peer)
+		try:
+			packet, _ = sock.recvfrom(1500)
+		except socket.timeout:
+			retries -= 1
+			if retries == 0:
+				raise TftpError('timeout at block %d' % (acked + 1))
+			retransmits += last - acked
+			continue
+		if check_error(packet) != OP_ACK:
+			continue
+		ack = struct.unpack('!H', packet[2:4])[0]
+		# Ack is 16 bit, find matching block number in current window
+		ack = acked + ((ack - acked) & 0xffff)
+		if ack > last:
+			continue
+		retransmits += last - ack
+		acked = ack
+		retries = RETRIES
+
+	return time.monotonic() - start, blksize, windowsize, retransmits
+
+
+def main():
+	if len(sys.argv) < 3:
+		print(__doc__)
+		sys.exit(1)
+	host = sys.argv[1]
+	with open(sys.argv[2], 'rb') as f:
+		image = f.read()
+	combinations = sys.argv[3:] or DEFAULT_COMBINATIONS
+
+	print('%-10s %8s %6s %8s %10s %6s' % ('request', 'blksize', 'window', 'time/s', 'kB/s', 'rexmit'))
+	for combination in combinations:
+		if combination == 'plain':
+			blksize, windowsize = None, None
+		else:
+			blksize, windowsize = (int(v) for v in combination.split(':'))
+		try:
+			seconds, blksize, windowsize, retransmits = put(host, image, blksize, windowsize, RESTART_WAIT)
+		except TftpError as e:
+			print('%-10s failed: %s' % (combination, e))
+			continue
+		print('%-10s %8d %6d %8.2f %10.1f %6d' % (combination, blksize, windowsize, seconds,
+		                                          len(image) / 1024 / seconds, retransmits))
+		time.sleep(5)								# Device verifies image and restarts
+
+
+if __name__ == '__main__':
+	main()
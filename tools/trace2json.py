@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Convert output of 'trace' debug command into Chrome trace JSON.
+
+Capture the debug port, enter 'trace' and store everything to a file:
+	nc <esp-ip> 20000 | tee trace.txt
+Then convert and open result in https://ui.perfetto.dev or chrome://tracing:
+	tools/trace2json.py trace.txt trace.json
+"""
+
+import json
+import sys
+
+
+def convert(lines):
+	tasks = {}
+	events = []
+	cycles_per_us = 80
+	last_ccount = None
+	time = 0			# Unwrapped cycle count
+	running = None
+	running_since = 0
+
+	for line in lines:
+		fields = line.split()
+		if len(fields) >= 4 and fields[0] == '#' and fields[1] == 'trace':
+			cycles_per_us = int(fields[3])
+		elif len(fields) >= 3 and fields[0] == 'T':
+			tasks[int(fields[1])] = fields[2]
+		elif len(fields) == 5 and fields[0] == 'E':
+			ccount, kind, task, arg = int(fields[1]), fields[2], int(fields[3]), int(fields[4])
+			if last_ccount is not None:
+				time += (ccount - last_ccount) & 0xffffffff
+			last_ccount = ccount
+			ts = time / cycles_per_us
+			name = tasks.get(task, 'task%d' % task)
+
+			if kind == 'switch':
+				if running is not None:
+					events.append({'name': 'running', 'ph': 'X', 'pid': 0, 'tid': running,
+					               'ts': running_since, 'dur': ts - running_since})
+				running = name
+				running_since = ts
+			elif kind == 'isr':
+				events.append({'name': 'irq%d' % arg, 'ph': 'i', 's': 't', 'pid': 0, 'tid': 'ISR', 'ts': ts})
+			elif kind == 'inherit':
+				events.append({'name': 'inherit prio %d' % arg, 'ph': 'i', 's': 't', 'pid': 0, 'tid': name, 'ts': ts})
+			else:
+				events.append({'name': '%s 0x%04x' % (kind, arg), 'ph': 'i', 's': 't', 'pid': 0, 'tid': name, 'ts': ts})
+
+	return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+	if len(sys.argv) != 3:
+		print(__doc__)
+		sys.exit(1)
+	with open(sys.argv[1], errors='replace') as f:
+		trace = convert(f)
+	with open(sys.argv[2], 'w') as f:
+		json.dump(trace, f)
+	print('%d events written' % len(trace['traceEvents']))
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,167 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <string.h>
+#include <common_macros.h>
+
+#include "trace.h"
+#include "debug.h"
+
+#ifdef INCLUDE_TRACE
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+#define TRACE_MASK										(TRACE_EVENTS - 1)
+#define TRACE_PRINT_SPACE							40			// Bytes needed in tcp buffer for one line
+
+typedef struct
+{
+	uint32_t	ccount;
+	uint8_t		type;
+	uint8_t		task;				// Index in trace_tasks
+	uint16_t	arg;				// Lower bits of queue address, irq or priority
+} trace_entry_t;
+
+typedef struct
+{
+	void*			handle;
+	char			name[configMAX_TASK_NAME_LEN];
+} trace_task_t;
+
+
+static trace_entry_t trace_entries[TRACE_EVENTS];
+static trace_task_t trace_tasks[TRACE_TASKS_MAX];
+static uint32_t trace_index = 0;			// Free running, masked on access
+static uint8_t trace_current = 0;			// Task index of running task
+static volatile bool trace_enabled = false;
+
+static const char* const trace_type_str[TRACE_TYPE_COUNT] =
+{
+	[TRACE_TASK_SWITCH]					= "switch",
+	[TRACE_ISR]									= "isr",
+	[TRACE_QUEUE_SEND]					= "give",
+	[TRACE_QUEUE_SEND_FROM_ISR]	= "give_isr",
+	[TRACE_QUEUE_RECEIVE]				= "take",
+	[TRACE_QUEUE_BLOCK]					= "block",
+	[TRACE_PRIORITY_INHERIT]		= "inherit"
+};
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+static void trace_command( const char* args );
+static uint8_t trace_task_index( void );
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+bool trace_init( void )
+{
+	memset( trace_tasks, 0x00, sizeof(trace_tasks) );
+	trace_index = 0;
+	trace_enabled = true;
+	return debug_add_command( "trace", trace_command );
+}
+
+
+
+// Called by scheduler with interrupts disabled
+void trace_task_switch( void )
+{
+	trace_current = trace_task_index();
+	trace_event( TRACE_TASK_SWITCH, 0 );
+}
+
+
+
+// Called from kernel hooks and interrupt handlers. Some kernel hooks run with
+// interrupts enabled, so they are disabled here to keep entries consistent.
+void IRAM trace_event( trace_type_t type, uint32_t arg )
+{
+	trace_entry_t* entry;
+	uint32_t ps;
+
+	if( trace_enabled == false ) return;
+
+	__asm__ __volatile__( "rsil %0, 15" : "=a"(ps) :: "memory" );
+	entry = &trace_entries[trace_index & TRACE_MASK];
+	trace_index++;
+	__asm__ __volatile__( "rsr %0, ccount" : "=a"(entry->ccount) );
+	entry->type = type;
+	entry->task = trace_current;
+	entry->arg = (uint16_t)arg;
+	__asm__ __volatile__( "wsr %0, ps; rsync" :: "a"(ps) : "memory" );
+}
+
+
+
+// Name is copied, because task might be deleted before export
+static uint8_t trace_task_index( void )
+{
+	void* handle = xTaskGetCurrentTaskHandle();
+	uint8_t n;
+
+	for( n=0; n<TRACE_TASKS_MAX; n++ )
+	{
+		if( trace_tasks[n].handle == handle ) return n;
+		if( trace_tasks[n].handle == NULL ) break;
+	}
+	if( n >= TRACE_TASKS_MAX ) n = TRACE_TASKS_MAX - 1;		// Table full, last entry is shared
+
+	trace_tasks[n].handle = handle;
+	strncpy( trace_tasks[n].name, pcTaskGetName(NULL), sizeof(trace_tasks[n].name) - 1 );
+	return n;
+}
+
+
+
+// Debug port command: 'trace' exports the ring buffer oldest first, 'trace clear' empties it.
+// Output is converted with 'tools/trace2json.py' into Chrome trace format:
+//   # trace <events> <cycles per us>
+//   T <task index> <name>
+//   E <ccount> <type> <task index> <arg>
+static void trace_command( const char* args )
+{
+	trace_entry_t* entry;
+	uint32_t first, count;
+
+	trace_enabled = false;
+	if( strcmp(args, "clear") == 0 )
+	{
+		trace_index = 0;
+		trace_enabled = true;
+		debug_print( "Trace cleared\n" );
+		return;
+	}
+
+	count = (trace_index < TRACE_EVENTS) ? trace_index : TRACE_EVENTS;
+	first = trace_index - count;
+
+	debug_print( "# trace %u %u\n", count, (uint32_t)(configCPU_CLOCK_HZ / 1000000) );
+	for( uint8_t n=0; (n < TRACE_TASKS_MAX) && (trace_tasks[n].handle != NULL); n++ )
+	{
+		debug_wait_space( TRACE_PRINT_SPACE );
+		debug_print( "T %u %s\n", n, trace_tasks[n].name );
+	}
+	for( uint32_t n=0; n<count; n++ )
+	{
+		entry = &trace_entries[(first + n) & TRACE_MASK];
+		if( debug_wait_space(TRACE_PRINT_SPACE) == false ) break;
+		debug_print( "E %u %s %u %u\n", entry->ccount, trace_type_str[entry->type], entry->task, entry->arg );
+	}
+	debug_print( "# end\n" );
+
+	trace_index = 0;
+	trace_enabled = true;
+}
+
+#endif // INCLUDE_TRACE
@@ -0,0 +1,60 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// Included by FreeRTOSConfig.h, so only basic types can be used here
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+#define TRACE_EVENTS									512			// Power of two, 8 bytes each
+#define TRACE_TASKS_MAX								16
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+typedef enum
+{
+	TRACE_TASK_SWITCH,
+	TRACE_ISR,
+	TRACE_QUEUE_SEND,							// Also semaphore give
+	TRACE_QUEUE_SEND_FROM_ISR,
+	TRACE_QUEUE_RECEIVE,					// Also semaphore take
+	TRACE_QUEUE_BLOCK,						// Task blocks on empty queue / taken semaphore
+	TRACE_PRIORITY_INHERIT,
+	TRACE_TYPE_COUNT
+} trace_type_t;
+
+typedef enum
+{
+	TRACE_IRQ_UART,
+	TRACE_IRQ_LIGHT,
+	TRACE_IRQ_COUNT
+} trace_irq_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+#ifdef INCLUDE_TRACE
+	bool trace_init( void );
+	void trace_task_switch( void );
+	void trace_event( trace_type_t type, uint32_t arg );
+	#define trace_isr( irq )							trace_event( TRACE_ISR, (irq) )
+#else
+	#define trace_isr( irq )
+#endif
+
+
+
+#endif // TRACE_H_
@@ -0,0 +1,184 @@
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "unlock.h"
+#include "sml_server.h"
+#include "light.h"
+#include "mqtt.h"
+#ifdef UNLOCK_DEBUG
+	#include "debug.h"
+#endif
+
+
+
+//*****************************************************************************
+// Local variables and definitions
+//*****************************************************************************
+
+xTaskHandle unlock_task_handle = NULL;
+
+#ifdef METER_PIN
+static const char* const unlock_state_str[UNLOCK_STATE_COUNT] =
+{
+	[UNLOCK_WAIT]				= "wait",
+	[UNLOCK_VERIFY]			= "verify",
+	[UNLOCK_BACKOFF]		= "backoff",
+	[UNLOCK_UNLOCKED]		= "unlocked"
+};
+
+static unlock_state_t unlock_state = UNLOCK_WAIT;
+static uint32_t unlock_attempts = 0;				// Failed since last unlock
+static uint32_t unlock_count = 0;						// Successful since boot
+static uint32_t unlock_backoff = UNLOCK_BACKOFF_MIN;
+static bool unlock_pending = false;					// State not published yet
+#endif
+
+
+
+//*****************************************************************************
+// Local function prototypes
+//*****************************************************************************
+
+#ifdef METER_PIN
+	static void unlock_task( void *pvParameters );
+	static void unlock_set( unlock_state_t state );
+	static void unlock_send_pin( void );
+#endif
+
+#ifdef UNLOCK_DEBUG
+	#define unlock_debug_print(fmt, ...)			debug_print(fmt, ##__VA_ARGS__)
+#else
+	#define unlock_debug_print(fmt, ...)
+#endif
+
+
+
+//*****************************************************************************
+// Function code
+//*****************************************************************************
+
+// Light needs to be initialized before
+bool unlock_init( void )
+{
+	#ifdef METER_PIN
+		if( unlock_task_handle != NULL ) return false;
+		if( strlen(METER_PIN) != 4 )
+		{
+			unlock_debug_print( "%s: METER_PIN needs 4 digits\n", __FUNCTION__ );
+			return false;
+		}
+
+		xTaskCreate( unlock_task, "unlock", UNLOCK_TASK_STACK, NULL, UNLOCK_TASK_PRIORITY, &unlock_task_handle );
+		if( unlock_task_handle == NULL )
+		{
+			unlock_debug_print( "%s: Error creating task\n", __FUNCTION__ );
+			return false;
+		}
+	#endif
+	return true;
+}
+
+
+
+#ifdef METER_PIN
+// Meter only sends 16.7.0 after PIN entry, and forgets PIN on power loss.
+// So its presence in parsed frames confirms an unlock, and its absence starts a new one.
+// First decision is done as soon as meter sends frames after boot.
+static void unlock_task( void *pvParameters )
+{
+	TickType_t wake = xTaskGetTickCount();
+	sml_stats_t last, now;
+	uint32_t frames, extended;
+	uint32_t missing = 0;				// Frames without 16.7.0 in a row
+	uint32_t elapsed = 0;				// s in state
+
+	sml_server_stats( &last );
+
+	while (true)
+	{
+		vTaskDelayUntil( &wake, ((int32_t)UNLOCK_POLL * 1000) / portTICK_RATE_MS );
+		elapsed += UNLOCK_POLL;
+
+		sml_server_stats( &now );
+		frames = now.frames - last.frames;
+		extended = now.extended - last.extended;
+		last = now;
+		missing = (extended > 0) ? 0 : (missing + frames);
+
+		// Confirmed by meter, also when PIN was entered by hand or remote light command
+		if( (extended > 0) && (unlock_state != UNLOCK_UNLOCKED) )
+		{
+			if( unlock_state == UNLOCK_VERIFY ) unlock_count++;
+			unlock_attempts = 0;
+			unlock_backoff = UNLOCK_BACKOFF_MIN;
+			unlock_set( UNLOCK_UNLOCKED );
+			elapsed = 0;
+		}
+
+		switch( unlock_state )
+		{
+			case UNLOCK_WAIT:
+			case UNLOCK_UNLOCKED:
+				// Single frames might miss it while parsing, so wait for several
+				if( missing >= UNLOCK_LOST_FRAMES )
+				{
+					unlock_send_pin();
+					elapsed = 0;
+				}
+				break;
+
+			case UNLOCK_VERIFY:
+				if( elapsed >= UNLOCK_VERIFY_TIMEOUT )
+				{
+					unlock_attempts++;
+					unlock_debug_print( "%s: Attempt %u failed, next in %us\n", __FUNCTION__, unlock_attempts, unlock_backoff );
+					unlock_set( UNLOCK_BACKOFF );
+					elapsed = 0;
+				}
+				break;
+
+			case UNLOCK_BACKOFF:
+				if( elapsed >= unlock_backoff )
+				{
+					unlock_backoff = (unlock_backoff * 2 > UNLOCK_BACKOFF_MAX) ? UNLOCK_BACKOFF_MAX : unlock_backoff * 2;
+					unlock_send_pin();
+					elapsed = 0;
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		// State changes before broker is connected are published later
+		if( (unlock_pending == true) && (mqtt_is_connected() == true) )
+		{
+			unlock_pending = false;
+			mqtt_pub( "Status/Unlock", "{\"state\":\"%s\",\"attempts\":%u,\"unlocks\":%u,\"backoff\":%u}",
+			          unlock_state_str[unlock_state], unlock_attempts, unlock_count, unlock_backoff );
+		}
+	}
+}
+
+
+
+static void unlock_set( unlock_state_t state )
+{
+	unlock_debug_print( "%s: %s -> %s\n", __FUNCTION__, unlock_state_str[unlock_state], unlock_state_str[state] );
+	unlock_state = state;
+	unlock_pending = true;
+}
+
+
+
+// Queued like a remote light command, so it waits for one already in output
+static void unlock_send_pin( void )
+{
+	const char command[] = "pin " METER_PIN;
+
+	light_start( command, sizeof(command) - 1 );
+	unlock_set( UNLOCK_VERIFY );
+}
+#endif
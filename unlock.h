@@ -0,0 +1,53 @@
+#ifndef UNLOCK_H_
+#define UNLOCK_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stdbool.h"
+
+
+
+//*****************************************************************************
+// Configuration
+//*****************************************************************************
+
+// Uncomment to enable debug output
+//#define UNLOCK_DEBUG
+
+// PIN of meter is set in Makefile as METER_PIN. Without it automatic unlock is disabled.
+
+#define UNLOCK_TASK_PRIORITY					1
+#define UNLOCK_TASK_STACK							400
+
+#define UNLOCK_POLL										5			// s, check of SML frames
+#define UNLOCK_LOST_FRAMES						5			// Frames without 16.7.0 until meter is seen as locked
+#define UNLOCK_VERIFY_TIMEOUT					60		// s, after PIN is queued. Output takes up to 25s.
+#define UNLOCK_BACKOFF_MIN						60		// s, after failed attempt, doubled on each failure
+#define UNLOCK_BACKOFF_MAX						3600	// s
+
+
+
+//*****************************************************************************
+// Data structures
+//*****************************************************************************
+
+typedef enum
+{
+	UNLOCK_WAIT,							// No frames from meter yet
+	UNLOCK_VERIFY,						// PIN sent, waiting for extended values
+	UNLOCK_BACKOFF,						// Attempt failed, waiting until next
+	UNLOCK_UNLOCKED,
+	UNLOCK_STATE_COUNT
+} unlock_state_t;
+
+
+
+//*****************************************************************************
+// Function prototypes
+//*****************************************************************************
+
+bool unlock_init( void );
+
+
+
+#endif // UNLOCK_H_
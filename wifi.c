@@ -2,14 +2,18 @@
 #include "task.h"
 #include "espressif/esp_common.h"
 #include "espressif/user_interface.h"
+#include "espressif/spi_flash.h"
 #include "lwip/netif.h"
+#include "lwip/stats.h"
 #include "esplibs/libmain.h"
 #include "esplibs/libnet80211.h"
 
 #include "wifi.h"
 #include "string.h"
+#include "stddef.h"
 #include "sdk_internal.h"
 #include "mqtt.h"
+#include "boot.h"
 #ifdef WIFI_DEBUG
 	#include "debug.h"
 #else
@@ -31,11 +35,26 @@ typedef struct sdk_station_config station_config_t;
 typedef struct ip_info ip_info_t;
 typedef struct sdk_bss_info bss_info_t;
 
-typedef struct wifi_list_t
+typedef struct
 {
-	char payload[30];
-	struct wifi_list_t* next;
-} wifi_list_t;
+	uint32_t		magic;
+	uint8_t			bssid[6];
+	uint8_t			channel;
+	uint8_t			has_ip;
+	ip_info_t		ip;
+	uint32_t		checksum;
+} __attribute__((aligned(4))) wifi_cache_t;
+
+#define WIFI_CACHE_MAGIC		0x57494649
+
+typedef struct
+{
+	char				ssid[33];
+	uint8_t			bssid[6];
+	uint8_t			channel;
+	int8_t			rssi;
+	uint8_t			authmode;
+} wifi_station_t;
 
 
 // According to enum in 'include/espressif/esp_wifi.h'
@@ -75,8 +94,31 @@ static const char* const wifi_auth_modes_str[] =
 
 wifi_init_callback_t wifi_init_callback = NULL;
 xTaskHandle wifi_init_task_handle = NULL;
-bool wifi_start_connection = false;
-wifi_list_t* wifi_station_list = NULL;
+static EventGroupHandle_t wifi_events = NULL;
+// Scan results sorted by RSSI, strongest first. Reused for every scan.
+static wifi_station_t wifi_stations[WIFI_SCAN_MAX];
+static uint8_t wifi_station_count = 0;
+static wifi_station_t wifi_best;						// Strongest AP of own SSID, also when not in list above
+static bool wifi_best_found = false;
+static bool wifi_pinned = false;						// Config is bound to one bssid
+static char wifi_station_payload[WIFI_SCAN_PAYLOAD_LEN];
+
+static wifi_cache_t wifi_cache;					// Content of flash
+static wifi_cache_t wifi_cache_new;				// Filled by wifi events
+static bool wifi_cache_valid = false;
+static bool wifi_cached = false;					// Connected with cached data
+
+typedef struct
+{
+	int8_t			rssi;
+	int16_t			rssi_avg8;			// Average RSSI * 8
+	uint8_t			weak;						// Weak samples in a row
+	uint16_t		roams;
+	TickType_t	last_search;
+	TickType_t	last_pub;
+} wifi_link_t;
+
+static wifi_link_t wifi_link;
 
 
 
@@ -87,7 +129,18 @@ static void wifi_init_task( void *pvParameters );
 void wifi_print_station_status( uint8_t state );
 void wifi_scan_done_callback( void *arg, sdk_scan_status_t status );
 static inline bool wifi_failed( bool ret );
-static bool wifi_config_station( void );
+static bool wifi_config_station( const uint8_t* bssid, uint8_t channel );
+static void wifi_event_handler( System_Event_t *event );
+static bool wifi_cache_load( void );
+static void wifi_cache_store( void );
+static uint32_t wifi_cache_checksum( wifi_cache_t* cache );
+static bool wifi_set_ip( void );
+static void wifi_station_insert( bss_info_t* bss );
+static void wifi_station_copy( wifi_station_t* station, bss_info_t* bss );
+static wifi_station_t* wifi_best_station( void );
+static bool wifi_link_monitor( void );
+static void wifi_roam( void );
+static void wifi_pub_link( void );
 
 #ifdef WIFI_DEBUG
 	#define wifi_debug_print(fmt, ...)			printf(fmt, ##__VA_ARGS__)
@@ -113,7 +166,17 @@ bool wifi_init( wifi_init_callback_t init_callback )
 		return false;
 	}
 	
-	ret = wifi_config_station();
+	wifi_events = xEventGroupCreate();
+	if( wifi_events == NULL )
+	{
+		wifi_debug_print( "%s: Failed to create event group\n", __FUNCTION__ );
+		return false;
+	}
+	sdk_wifi_set_event_handler_cb( wifi_event_handler );
+
+	wifi_cache_valid = wifi_cache_load();
+	wifi_cached = wifi_cache_valid;
+	ret = wifi_config_station( wifi_cached ? wifi_cache.bssid : NULL, wifi_cache.channel );
 	if( ret == false ) return false;
 	
 /*	ret = sdk_wifi_station_start();
@@ -155,7 +218,8 @@ bool wifi_init( wifi_init_callback_t init_callback )
 }
 
 
-static bool wifi_config_station( void )
+// Without bssid SDK picks AP on its own
+static bool wifi_config_station( const uint8_t* bssid, uint8_t channel )
 {
 	station_config_t	config;
 	int16_t						ret;
@@ -166,90 +230,355 @@ static bool wifi_config_station( void )
  			
 	strcpy((char*)config.ssid, WIFI_SSID);
 	strcpy((char*)config.password, WIFI_PASS);
+
+	// Connect directly to given AP on its channel, without searching all channels
+	if( bssid != NULL )
+	{
+		config.bssid_set = 1;
+		memcpy( config.bssid, bssid, sizeof(config.bssid) );
+		sdk_wifi_set_channel( channel );
+		wifi_debug_print( "%s: Using AP " MACSTR " on channel %d\n", __FUNCTION__, MAC2STR(bssid), channel );
+	}
 	
 	wifi_debug_print( "%s: Setting config ... ", __FUNCTION__ );		
 	ret = sdk_wifi_station_set_config( &config );
 	if( wifi_failed(ret) ) return false;
-	
-	return true;
+	wifi_pinned = (bssid != NULL);
+
+	return wifi_set_ip();
+}
+
+
+
+// Static IP or cached lease skips DHCP, otherwise DHCP client is (re)started
+static bool wifi_set_ip( void )
+{
+	ip_info_t	info;
+	bool			ret;
+
+	memset( &info, 0x00, sizeof(info) );
+	#if defined(WIFI_STATIC_IP) && defined(WIFI_STATIC_NETMASK) && defined(WIFI_STATIC_GW)
+		ip4addr_aton( WIFI_STATIC_IP, &info.ip );
+		ip4addr_aton( WIFI_STATIC_NETMASK, &info.netmask );
+		ip4addr_aton( WIFI_STATIC_GW, &info.gw );
+	#elif defined(WIFI_CACHE_LEASE)
+		if( (wifi_cached == true) && (wifi_cache.has_ip != 0) ) info = wifi_cache.ip;
+	#endif
+
+	if( info.ip.addr == 0 )
+	{
+		// Fails when already running, which is fine
+		sdk_wifi_station_dhcpc_start();
+		return true;
+	}
+
+	wifi_debug_print( "%s: Using IP " IPSTR "\n", __FUNCTION__, IP2STR(&info.ip) );
+	sdk_wifi_station_dhcpc_stop();
+	ret = sdk_wifi_set_ip_info( STATION_IF, &info );
+	if( ret == false ) wifi_debug_print( "%s: Failed to set IP\n", __FUNCTION__ );
+	return ret;
 }
 
 
 
 static void wifi_init_task( void *pvParameters )
 {
-	int16_t		timeout = WIFI_INIT_TIMEOUT;
-	int16_t		retry = 10;
-	uint8_t		state = STATION_IDLE;
-	bool			initialized = false;
-	bool			scan_done = false; 
+	TickType_t	deadline;
+	int16_t			retry = 10;
+	uint8_t			state = STATION_IDLE;
+	bool				initialized = false;
+	bool				scan_done = false; 
+	bool				cached = wifi_cached;
+	bool				pin_failed = false;
+	EventBits_t	bits;
+	wifi_station_t* station;
+
+	deadline = xTaskGetTickCount() + (((int32_t)WIFI_INIT_TIMEOUT * 1000) / portTICK_RATE_MS);
+	if( cached == true )
+	{
+		// Skip scan, connection with cached AP is already running
+		scan_done = true;
+		deadline = xTaskGetTickCount() + (((int32_t)WIFI_CACHE_TIMEOUT * 1000) / portTICK_RATE_MS);
+	}
 	
 	while (true)
 	{ 
 		if( scan_done == false )
 		{
-			wifi_start_connection = false;
+			xEventGroupClearBits( wifi_events, WIFI_EVENT_SCAN_DONE );
 			scan_done = sdk_wifi_station_scan( NULL, &wifi_scan_done_callback );
+			if( scan_done == true )
+			{
+				wifi_wait( WIFI_EVENT_SCAN_DONE, ((int32_t)WIFI_SCAN_TIMEOUT * 1000) / portTICK_RATE_MS );
+
+				// Prefer strongest AP of own network instead of the one SDK picks,
+				// unless that failed last time
+				station = wifi_best_station();
+				if( (station != NULL) && (pin_failed == false) && (wifi_wait(WIFI_EVENT_GOT_IP, 0) == 0) )
+				{
+					sdk_wifi_station_disconnect();
+					wifi_config_station( station->bssid, station->channel );
+					sdk_wifi_station_connect();
+				}
+			}
 		}
+
+		// Wakes up on IP or disconnect event, timeout is only used to retry a failed scan
+		bits = wifi_wait( WIFI_EVENT_GOT_IP | WIFI_EVENT_LOST_IP, ((int32_t)WIFI_INIT_DELAY * 1000) / portTICK_RATE_MS );
+		xEventGroupClearBits( wifi_events, WIFI_EVENT_LOST_IP );
 		state = sdk_wifi_station_get_connect_status();
 
-		if( (timeout <= 0) || (state == STATION_CONNECT_FAIL) )
+		if( (cached == true) && ((bits & WIFI_EVENT_GOT_IP) == 0) && 
+		    ((bits & WIFI_EVENT_LOST_IP) || ((int32_t)(xTaskGetTickCount() - deadline) >= 0)) )
+		{
+			// AP moved or is gone, do complete search and DHCP
+			wifi_debug_print( "%s: Cached connect failed, fallback to scan\n", __FUNCTION__ );
+			sdk_wifi_station_disconnect();
+			wifi_cached = false;
+			wifi_config_station( NULL, 0 );
+			cached = false;
+			sdk_wifi_station_connect();
+			scan_done = false;
+			deadline = xTaskGetTickCount() + (((int32_t)WIFI_INIT_TIMEOUT * 1000) / portTICK_RATE_MS);
+		}
+		else if( ((int32_t)(xTaskGetTickCount() - deadline) >= 0) || (state == STATION_CONNECT_FAIL) )
 		{
 			wifi_debug_print( "%s: Timeout or connection fail\n", __FUNCTION__ );
+			// Pinned AP might be gone, let SDK pick any AP of own SSID until next success
+			if( wifi_pinned == true )
+			{
+				wifi_debug_print( "%s: Releasing pinned AP\n", __FUNCTION__ );
+				sdk_wifi_station_disconnect();
+				wifi_config_station( NULL, 0 );
+				pin_failed = true;
+			}
 			// Rescan available stations, then connect
 			sdk_wifi_station_connect();
 			scan_done = false;
-			timeout = WIFI_INIT_TIMEOUT;
+			deadline = xTaskGetTickCount() + (((int32_t)WIFI_INIT_TIMEOUT * 1000) / portTICK_RATE_MS);
 			retry --;
 			if( retry <= 0 )
 			{
 				sdk_system_restart();
 			}
 		}
-		else if( (state == STATION_GOT_IP) && (wifi_start_connection == true) )
+		else if( bits & WIFI_EVENT_GOT_IP )
 		{
 			wifi_print_station_status( state );
+			cached = false;
+			pin_failed = false;
 	
+			wifi_cache_store();
 			if( initialized == false )
 			{
-				wifi_debug_print( "%s: Wifi is up -> Initing wifi tasks ...\n", __FUNCTION__);
+				boot_mark( BOOT_WIFI );
+				wifi_debug_print( "%s: Wifi is up after %ums -> Initing wifi tasks ...\n", __FUNCTION__, sdk_system_get_time() / 1000 );
 				vTaskDelay( 1000 / portTICK_RATE_MS );
 				wifi_init_callback();
-				#ifdef WIFI_SLEEP
-					bool ret;
-					uint8_t opmode = sdk_wifi_get_opmode();
-					if( opmode == STATION_MODE )
-					{
-						wifi_debug_print( "%s: Setting automatic sleep mode (%d)\n", __FUNCTION__, WIFI_SLEEP );
-						ret = sdk_wifi_set_sleep_type( WIFI_SLEEP );
-						if( ret == false ) wifi_debug_print( "%s: Failed to set sleep mode\n", __FUNCTION__ );
-					}
-				#endif
 
 				initialized = true;
+				// Station list is still needed when connected without scan
+				if( wifi_station_count == 0 ) sdk_wifi_station_scan( NULL, &wifi_scan_done_callback );
 			}
 			
-			do 
-			{
-				vTaskDelay( ((int32_t)WIFI_INIT_DELAY * 1000) / portTICK_RATE_MS );
-				state = sdk_wifi_station_get_connect_status();
-			} while (state == STATION_GOT_IP);
-
-			// Go to reconnect in next cycle
-			timeout = true;
+			// Monitor link quality until connection is lost
+			wifi_link.rssi_avg8 = 0;
+			wifi_link.weak = 0;
+			while( wifi_link_monitor() == true );
+			wifi_debug_print( "%s: Connection lost\n", __FUNCTION__ );
+
+			// SDK reconnects on its own, rescan if it doesn't succeed within one cycle
+			deadline = xTaskGetTickCount() + (((int32_t)WIFI_INIT_DELAY * 1000) / portTICK_RATE_MS);
 		}
 		else
 		{
-			wifi_debug_print( "%s: Waiting %ds for wifi to come up ...\n", __FUNCTION__, timeout);
-			timeout -= WIFI_INIT_DELAY;
+			wifi_debug_print( "%s: Waiting %ds for wifi to come up ...\n", __FUNCTION__, 
+			                  (int32_t)(deadline - xTaskGetTickCount()) * portTICK_RATE_MS / 1000 );
 		}
-		
-		vTaskDelay( ((int32_t)WIFI_INIT_DELAY * 1000) / portTICK_RATE_MS );
 	}
 }
 
 
 
+// Called every WIFI_LINK_INTERVAL while connected, returns false when connection is lost
+static bool wifi_link_monitor( void )
+{
+	int8_t rssi;
+
+	if( wifi_wait(WIFI_EVENT_LOST_IP, ((int32_t)WIFI_LINK_INTERVAL * 1000) / portTICK_RATE_MS) != 0 ) return false;
+
+	// SDK returns 31 on error
+	rssi = sdk_wifi_station_get_rssi();
+	if( rssi >= 0 ) return true;
+
+	wifi_link.rssi = rssi;
+	if( wifi_link.rssi_avg8 == 0 ) wifi_link.rssi_avg8 = rssi * 8;
+	else wifi_link.rssi_avg8 += rssi - (wifi_link.rssi_avg8 / 8);
+
+	if( (wifi_link.rssi_avg8 / 8) < WIFI_ROAM_RSSI ) wifi_link.weak++;
+	else wifi_link.weak = 0;
+
+	if( (wifi_link.weak >= WIFI_ROAM_COUNT) && 
+	    ((wifi_link.last_search == 0) || ((xTaskGetTickCount() - wifi_link.last_search) >= (((int32_t)WIFI_ROAM_HOLDOFF * 1000) / portTICK_RATE_MS))) )
+	{
+		wifi_debug_print( "%s: Weak link (%d dBm), searching better AP\n", __FUNCTION__, wifi_link.rssi_avg8 / 8 );
+		wifi_link.weak = 0;
+		wifi_link.last_search = xTaskGetTickCount();
+		xEventGroupClearBits( wifi_events, WIFI_EVENT_SCAN_DONE );
+		if( sdk_wifi_station_scan(NULL, &wifi_scan_done_callback) == true )
+		{
+			if( wifi_wait(WIFI_EVENT_SCAN_DONE, ((int32_t)WIFI_SCAN_TIMEOUT * 1000) / portTICK_RATE_MS) != 0 ) wifi_roam();
+		}
+	}
+
+	if( (xTaskGetTickCount() - wifi_link.last_pub) >= (((int32_t)WIFI_LINK_PUB_INTERVAL * 1000) / portTICK_RATE_MS) )
+	{
+		wifi_link.last_pub = xTaskGetTickCount();
+		wifi_pub_link();
+	}
+	return true;
+}
+
+
+
+// Switch to strongest AP of own network, if it is clearly better than current one
+static void wifi_roam( void )
+{
+	wifi_station_t* station = wifi_best_station();
+
+	if( station == NULL ) return;
+	if( memcmp(station->bssid, wifi_cache_new.bssid, sizeof(station->bssid)) == 0 ) return;
+	if( station->rssi < (wifi_link.rssi + WIFI_ROAM_HYSTERESIS) ) return;
+
+	wifi_debug_print( "%s: Roaming to " MACSTR " (%d dBm)\n", __FUNCTION__, MAC2STR(station->bssid), station->rssi );
+	wifi_link.roams++;
+	sdk_wifi_station_disconnect();
+	wifi_config_station( station->bssid, station->channel );
+	sdk_wifi_station_connect();
+}
+
+
+
+// Kept apart from published list, so own SSID is found among many stronger neighbour APs
+static wifi_station_t* wifi_best_station( void )
+{
+	return (wifi_best_found == true) ? &wifi_best : NULL;
+}
+
+
+
+// TCP retransmits are only available when lwip is built with statistics
+static void wifi_pub_link( void )
+{
+	uint32_t rexmit = 0;
+
+	#if LWIP_STATS && TCP_STATS
+		rexmit = lwip_stats.tcp.rexmit;
+	#endif
+	mqtt_pub( "Wifi/Link", "{\"bssid\":\"%02x%02x%02x%02x%02x%02x\",\"ch\":%d,\"rssi\":%d,\"avg\":%d,\"rexmit\":%u,\"errors\":%u,\"roams\":%u}",
+	          MAC2STR(wifi_cache_new.bssid), wifi_cache_new.channel, wifi_link.rssi, wifi_link.rssi_avg8 / 8,
+	          rexmit, mqtt_errors(), wifi_link.roams );
+}
+
+
+
+bool wifi_connect_cached( void )
+{
+	return wifi_cached;
+}
+
+
+
+// Wait for any of the given event bits, returns bits set at return
+EventBits_t wifi_wait( EventBits_t bits, TickType_t timeout )
+{
+	if( wifi_events == NULL ) return 0;
+	return xEventGroupWaitBits( wifi_events, bits, pdFALSE, pdFALSE, timeout ) & bits;
+}
+
+
+
+// Called from SDK task, only stores data and signals waiting tasks
+static void wifi_event_handler( System_Event_t *event )
+{
+	switch( event->event )
+	{
+		case EVENT_STAMODE_CONNECTED:
+			memcpy( wifi_cache_new.bssid, event->event_info.connected.bssid, sizeof(wifi_cache_new.bssid) );
+			wifi_cache_new.channel = event->event_info.connected.channel;
+			xEventGroupSetBits( wifi_events, WIFI_EVENT_LINK_UP );
+			break;
+
+		case EVENT_STAMODE_GOT_IP:
+			xEventGroupSetBits( wifi_events, WIFI_EVENT_GOT_IP );
+			break;
+
+		case EVENT_STAMODE_DISCONNECTED:
+		case EVENT_STAMODE_DHCP_TIMEOUT:
+			xEventGroupClearBits( wifi_events, WIFI_EVENT_LINK_UP | WIFI_EVENT_GOT_IP );
+			xEventGroupSetBits( wifi_events, WIFI_EVENT_LOST_IP );
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+
+static bool wifi_cache_load( void )
+{
+	if( sdk_spi_flash_read(WIFI_CACHE_SECTOR * SECTOR_SIZE, (uint32_t*)&wifi_cache, sizeof(wifi_cache)) != SPI_FLASH_RESULT_OK )
+	{
+		return false;
+	}
+	if( (wifi_cache.magic != WIFI_CACHE_MAGIC) || (wifi_cache.checksum != wifi_cache_checksum(&wifi_cache)) )
+	{
+		wifi_debug_print( "%s: No cached connection\n", __FUNCTION__ );
+		return false;
+	}
+	return true;
+}
+
+
+
+// Writing only on changes keeps flash wear low
+static void wifi_cache_store( void )
+{
+	ip_info_t info;
+
+	if( sdk_wifi_get_ip_info(STATION_IF, &info) == true )
+	{
+		wifi_cache_new.ip = info;
+		wifi_cache_new.has_ip = 1;
+	}
+	if( wifi_cache_new.channel == 0 ) return;
+
+	wifi_cache_new.magic = WIFI_CACHE_MAGIC;
+	wifi_cache_new.checksum = wifi_cache_checksum( &wifi_cache_new );
+	if( (wifi_cache_valid == true) && (memcmp(&wifi_cache, &wifi_cache_new, sizeof(wifi_cache)) == 0) ) return;
+
+	wifi_debug_print( "%s: Storing AP " MACSTR " on channel %d\n", __FUNCTION__, MAC2STR(wifi_cache_new.bssid), wifi_cache_new.channel );
+	wifi_cache = wifi_cache_new;
+	wifi_cache_valid = false;
+	if( sdk_spi_flash_erase_sector(WIFI_CACHE_SECTOR) != SPI_FLASH_RESULT_OK ) return;
+	if( sdk_spi_flash_write(WIFI_CACHE_SECTOR * SECTOR_SIZE, (uint32_t*)&wifi_cache, sizeof(wifi_cache)) != SPI_FLASH_RESULT_OK ) return;
+	wifi_cache_valid = true;
+}
+
+
+
+static uint32_t wifi_cache_checksum( wifi_cache_t* cache )
+{
+	uint32_t* data = (uint32_t*)cache;
+	uint32_t sum = 0;
+
+	for( uint8_t n=0; n<(offsetof(wifi_cache_t, checksum) / sizeof(uint32_t)); n++ ) sum += data[n];
+	return ~sum;
+}
+
+
+
 void wifi_print_station_status( uint8_t state )
 {
 	#ifdef WIFI_DEBUG
@@ -264,7 +593,6 @@ void wifi_print_station_status( uint8_t state )
 void wifi_scan_done_callback( void *arg, sdk_scan_status_t status )
 {
 	bss_info_t* bss;
-	wifi_list_t* list = NULL;
 
 	if( status != SCAN_OK )
 	{
@@ -273,18 +601,12 @@ void wifi_scan_done_callback( void *arg, sdk_scan_status_t status )
 		#else
 			printf( "Wifi scan failed\n" );
 		#endif
+		xEventGroupSetBits( wifi_events, WIFI_EVENT_SCAN_DONE );
 		return;
 	}
 
-	// Clear if an old list exists
-	list = wifi_station_list;
-	while( list != NULL )
-	{
-		list = wifi_station_list->next;
-		vPortFree( wifi_station_list );
-		wifi_station_list = list;
-	}
-	wifi_station_list = NULL;
+	wifi_station_count = 0;
+	wifi_best_found = false;
 	
 	bss = (struct sdk_bss_info*)arg;
 	// first one is invalid
@@ -297,59 +619,97 @@ void wifi_scan_done_callback( void *arg, sdk_scan_status_t status )
 	else
 	{
 		wifi_debug_print( "%s: Found stations:\n", __FUNCTION__ );		
-		wifi_station_list = pvPortMalloc(sizeof(wifi_list_t));
-		list = wifi_station_list;
-		while(true)
+		for( ; bss != NULL; bss = bss->next.stqe_next )
 		{
-			if( list == NULL )
-			{
-				wifi_debug_print( "%s: Error creating list\n", __FUNCTION__ );		
-				break;
-			}
-			snprintf( list->payload, 30, "%.20s,%d,%d", bss->ssid, bss->channel, bss->rssi );
 			wifi_debug_print( DEBUG_INDENT "%s (" MACSTR "), Ch: %d, RSSI: %02d, security: %s\n", bss->ssid, MAC2STR(bss->bssid), bss->channel, bss->rssi, wifi_auth_modes_str[bss->authmode]);
-
-			bss = bss->next.stqe_next;
-			if( bss == NULL )
+			wifi_station_insert( bss );
+			if( (strcmp((char*)bss->ssid, WIFI_SSID) == 0) && ((wifi_best_found == false) || (bss->rssi > wifi_best.rssi)) )
 			{
-				list->next = NULL;
-				break;
+				wifi_station_copy( &wifi_best, bss );
+				wifi_best_found = true;
 			}
-			
-			list->next = pvPortMalloc(sizeof(wifi_list_t));
-			list = list->next;
 		}
 	}
 		
-	wifi_start_connection = true;
+	xEventGroupSetBits( wifi_events, WIFI_EVENT_SCAN_DONE );
 }
 
 
 
+// Insert sorted by RSSI, weakest station drops out when array is full
+static void wifi_station_insert( bss_info_t* bss )
+{
+	uint8_t n;
+
+	for( n=0; n<wifi_station_count; n++ )
+	{
+		if( bss->rssi > wifi_stations[n].rssi ) break;
+	}
+	if( n >= WIFI_SCAN_MAX ) return;
+
+	if( wifi_station_count < WIFI_SCAN_MAX ) wifi_station_count++;
+	memmove( &wifi_stations[n+1], &wifi_stations[n], (wifi_station_count - n - 1) * sizeof(wifi_station_t) );
+
+	wifi_station_copy( &wifi_stations[n], bss );
+}
+
+
+
+static void wifi_station_copy( wifi_station_t* station, bss_info_t* bss )
+{
+	strncpy( station->ssid, (char*)bss->ssid, sizeof(station->ssid) - 1 );
+	station->ssid[sizeof(station->ssid) - 1] = '\0';
+	memcpy( station->bssid, bss->bssid, sizeof(station->bssid) );
+	station->channel = bss->channel;
+	station->rssi = bss->rssi;
+	station->authmode = bss->authmode;
+}
+
+
+
+// All stations in one message:
+// [{"ssid":"Home","bssid":"001122334455","ch":6,"rssi":-61,"auth":"WPA2/PSK"},...]
 void wifi_pub_stations( void )
 {
-	wifi_list_t* list = wifi_station_list;
-	char topic[20];
-	uint8_t n = 0;
-	bool ret;
+	wifi_station_t* station;
+	const char* auth;
+	char ssid[21];
+	size_t len = 0;
+	int ret;
 
-	if ( list == NULL )
+	if ( wifi_station_count == 0 )
 	{
 		mqtt_pub( "Error", "Stations" );
 		return;
 	}
-	
-	while( list != NULL )
+
+	wifi_station_payload[len++] = '[';
+	for( uint8_t n=0; n<wifi_station_count; n++ )
 	{
-		snprintf( topic, sizeof(topic), "WifiStation/%d", n );
-		ret = mqtt_pub( topic, list->payload );
-		if( ret == false ) return;
-		
-		list = list->next;
-		n++;
+		station = &wifi_stations[n];
+		auth = (station->authmode < ELEMS(wifi_auth_modes_str)) ? wifi_auth_modes_str[station->authmode] : "";
+
+		// SSID is free text, replace chars breaking json
+		strncpy( ssid, station->ssid, sizeof(ssid) - 1 );
+		ssid[sizeof(ssid) - 1] = '\0';
+		for( char* c = ssid; *c != '\0'; c++ )
+		{
+			if( (*c == '"') || (*c == '\\') || (*c < ' ') ) *c = '_';
+		}
+
+		ret = snprintf( &wifi_station_payload[len], sizeof(wifi_station_payload) - len,
+		                "%s{\"ssid\":\"%s\",\"bssid\":\"%02x%02x%02x%02x%02x%02x\",\"ch\":%d,\"rssi\":%d,\"auth\":\"%s\"}",
+		                (n == 0) ? "" : ",", ssid, MAC2STR(station->bssid), station->channel, station->rssi, auth );
+		len = (ret < 0) ? sizeof(wifi_station_payload) : (len + ret);
+		if( len >= sizeof(wifi_station_payload) - 2 )
+		{
+			mqtt_pub( "Error", "Stations too long" );
+			return;
+		}
 	}
-	snprintf( topic, sizeof(topic), "WifiStation/%d", n );
-	mqtt_pub( topic, "-" );
+	strcpy( &wifi_station_payload[len], "]" );
+
+	mqtt_pub( "Wifi/Stations", "%s", wifi_station_payload );
 }
 
 
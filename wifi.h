@@ -1,7 +1,10 @@
 #ifndef WIFI_H_
 #define WIFI_H_
 
+#include "FreeRTOS.h"
+#include "event_groups.h"
 #include "stdbool.h"
+#include "stdint.h"
 
 
 
@@ -12,19 +15,45 @@
 // Uncomment to enable debug output
 #define WIFI_DEBUG
 
-#define WIFI_SLEEP												WIFI_SLEEP_LIGHT
 
 #define WIFI_INIT_TASK_PRIORITY						1   // For init and fallback
 #define WIFI_INIT_TASK_STACK							400
 
 #define WIFI_INIT_DELAY										2  // s
 #define WIFI_INIT_TIMEOUT									30 // s
+#define WIFI_SCAN_TIMEOUT									10 // s
+#define WIFI_SCAN_MAX											8  // Strongest stations of any SSID kept for 'Wifi/Stations', best own AP is kept apart
+#define WIFI_SCAN_PAYLOAD_LEN							(WIFI_SCAN_MAX * 100 + 4)
+
+// Link monitoring and roaming between APs with same SSID
+#define WIFI_LINK_INTERVAL								10		// s, RSSI sample interval
+#define WIFI_LINK_PUB_INTERVAL						60		// s, link metrics to 'Wifi/Link'
+#define WIFI_ROAM_RSSI										-75		// dBm, averaged RSSI below starts search for better AP
+#define WIFI_ROAM_COUNT										3			// Number of weak samples in a row before search
+#define WIFI_ROAM_HYSTERESIS							8			// dB, other AP needs to be this much stronger
+#define WIFI_ROAM_HOLDOFF									300		// s, minimum time between two searches
+
+// Last AP (bssid, channel) and IP is stored in flash to reconnect without scan.
+// Sector is behind the 2MB area used for firmware slots.
+#define WIFI_CACHE_SECTOR									0x200
+#define WIFI_CACHE_TIMEOUT								6  // s, fallback to scan and DHCP when cached connect fails
+// Uncomment to reuse last DHCP lease without asking server.
+// Only use this, when the router reserves the address for this device.
+//#define WIFI_CACHE_LEASE
+
+// Static IP can be set in Makefile with WIFI_STATIC_IP, WIFI_STATIC_NETMASK and WIFI_STATIC_GW
 
 //*****************************************************************************
 // Data structures
 //*****************************************************************************
 typedef void(*wifi_init_callback_t)(void);
 
+// Bits of wifi event group, driven by SDK wifi events
+#define WIFI_EVENT_LINK_UP								(1 << 0)	// Associated with AP
+#define WIFI_EVENT_GOT_IP									(1 << 1)	// State, set as long as IP is valid
+#define WIFI_EVENT_LOST_IP								(1 << 2)	// Set on disconnect, cleared by wifi_init_task
+#define WIFI_EVENT_SCAN_DONE							(1 << 3)
+
 
 
 //*****************************************************************************
@@ -32,6 +61,8 @@ typedef void(*wifi_init_callback_t)(void);
 //*****************************************************************************
 bool wifi_init( wifi_init_callback_t init_callback );
 void wifi_pub_stations( void );
+bool wifi_connect_cached( void );
+EventBits_t wifi_wait( EventBits_t bits, TickType_t timeout );
 
 
 